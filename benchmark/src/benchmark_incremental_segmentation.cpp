@@ -20,10 +20,8 @@ using HistT = pcl::Histogram<250>;
 using HistCloudT = pcl::PointCloud<HistT>;
 
 grouped_vocabulary_tree<HistT, 8> vt;
-map<grouped_vocabulary_tree<HistT, 8>::node*, int> mapping;
-map<int, grouped_vocabulary_tree<HistT, 8>::node*> inverse_mapping;
 
-void visualize_adjacencies(vector<CloudT::Ptr>& segments, const set<pair<int, int> >& adjacencies)
+void visualize_adjacencies(vector<CloudT::Ptr>& segments, const subgroup_adjacencies& adjacencies)
 {
     CloudT::Ptr visualization_cloud(new CloudT);
 
@@ -43,12 +41,14 @@ void visualize_adjacencies(vector<CloudT::Ptr>& segments, const set<pair<int, in
     viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "sample cloud");
 
     int i = 0;
-    for (const pair<int, int>& a : adjacencies) {
-        string line_id = string("line") + to_string(i);
-        cout << "Centroids size: " << centroids->size() << endl;
-        cout << "Adjacency: (" << a.first << ", " << a.second << ")" << endl;
-        viewer->addLine<PointT>(centroids->at(a.first), centroids->at(a.second), 1.0, 0.0, 0.0, line_id);
-        ++i;
+    for (int a = 0; a < adjacencies.size(); ++a) {
+        for (auto it = adjacencies.neighbours_begin(a); it != adjacencies.neighbours_end(a) && *it < a; ++it) {
+            string line_id = string("line") + to_string(i);
+            cout << "Centroids size: " << centroids->size() << endl;
+            cout << "Adjacency: (" << a << ", " << *it << ")" << endl;
+            viewer->addLine<PointT>(centroids->at(a), centroids->at(*it), 1.0, 0.0, 0.0, line_id);
+            ++i;
+        }
     }
 
     //viewer->addCoordinateSystem(1.0);
@@ -101,7 +101,7 @@ vector<CloudT::Ptr> perform_incremental_segmentation(CloudT::Ptr& training_map,
 #endif
 
     vector<vocabulary_vector> vectors;
-    set<pair<int, int> > adjacencies;
+    subgroup_adjacencies adjacencies;
     vt.load_cached_vocabulary_vectors_for_group(vectors, adjacencies, sweep_index); // sweep index needed!
 
     //visualize_adjacencies(segments, adjacencies);
@@ -140,7 +140,7 @@ vector<CloudT::Ptr> perform_incremental_segmentation(CloudT::Ptr& training_map,
     // e.g. when I get the segments back from selected_indices when using -1, this also returns
     // correct results so it seems like that is the correct way to decide subgroup_index
     double score = vt.compute_min_combined_dist(selected_indices, query_cloud, vectors, adjacencies,
-                                                mapping, inverse_mapping, start_index); // segment index in sweep needed!
+                                                start_index); // segment index in sweep needed!
     //vector<int> selected_indices = {start_index};
 
     vector<CloudT::Ptr> single_cloud;
@@ -212,10 +212,6 @@ int main(int argc, char** argv)
     dynamic_object_retrieval::load_vocabulary(vt, vocabulary_path);
     vt.set_min_match_depth(3);
     vt.compute_normalizing_constants();
-    vt.get_node_mapping(mapping);
-    for (const pair<grouped_vocabulary_tree<HistT, 8>::node*, int>& u : mapping) {
-        inverse_mapping.insert(make_pair(u.second, u.first));
-    }
 
     vector<CloudT::Ptr> top_segment = perform_incremental_segmentation(training_map, training_object, query_map, query_object, query_map_path);
 
@@ -242,10 +238,6 @@ int main(int argc, char** argv)
     vt.set_cache_path(vocabulary_path.string());
     vt.set_min_match_depth(3);
     vt.compute_normalizing_constants();
-    vt.get_node_mapping(mapping);
-    for (const pair<grouped_vocabulary_tree<HistT, 8>::node*, int>& u : mapping) {
-        inverse_mapping.insert(make_pair(u.second, u.first));
-    }
 
     map<string, pair<float, int> > overlap_ratios = benchmark_retrieval::get_segmentation_scores_for_data(&perform_incremental_segmentation, data_path);
 
@@ -91,10 +91,54 @@ benchmark_retrieval::benchmark_result run_benchmark(const vector<string>& folder
     return benchmark;
 }
 
+// creates a benchmark folder in the vocabulary path and runs the benchmark with the vocabulary
+// type of the summary, with projected descriptors if the vocabulary was trained with a projection
+benchmark_retrieval::benchmark_result benchmark_vocabulary(const vector<string>& folder_xmls, const boost::filesystem::path& vocabulary_path,
+                                                           const string& timestamp)
+{
+#if CONVEX_SEGMENTS_ONLY
+    boost::filesystem::path benchmark_path = vocabulary_path / (string("benchmark ") + timestamp + " CONVEX SURFELS");
+#else
+    boost::filesystem::path benchmark_path = vocabulary_path / (string("benchmark ") + timestamp + " INCREMENTAL SURFELS");
+#endif
+    boost::filesystem::create_directory(benchmark_path);
+
+    TICK("load_summary");
+    dynamic_object_retrieval::vocabulary_summary summary;
+    summary.load(vocabulary_path);
+    TOCK("load_summary");
+
+    bool projected = dynamic_object_retrieval::has_descriptor_projection(vocabulary_path);
+    benchmark_retrieval::benchmark_result benchmark;
+    if (summary.vocabulary_type == "standard") {
+        //benchmark = run_benchmark<vocabulary_tree<HistT, 8> >(folder_xmls, vocabulary_path, summary, benchmark_path);
+    }
+    else if (summary.vocabulary_type == "incremental" && projected) {
+        benchmark = run_benchmark<grouped_vocabulary_tree<ProjectedHistT, 8> >(folder_xmls, vocabulary_path, summary, benchmark_path);
+    }
+    else if (summary.vocabulary_type == "incremental") {
+        benchmark = run_benchmark<grouped_vocabulary_tree<HistT, 8> >(folder_xmls, vocabulary_path, summary, benchmark_path);
+    }
+
+    benchmark_retrieval::save_benchmark(benchmark, benchmark_path);
+
+    return benchmark;
+}
+
+double get_instance_ratio(const benchmark_retrieval::benchmark_result& benchmark, const string& instance)
+{
+    auto iter = benchmark.instance_ratios.find(instance);
+    if (iter == benchmark.instance_ratios.end()) {
+        return 0.0;
+    }
+    return iter->second.first / iter->second.second;
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 3) {
         cout << "Please provide path to the vocabulary and the annotated data path(s) to query..." << endl;
+        cout << "Usage: ./benchmark_query_vocabulary /path/to/vocabulary (--compare /path/to/full/vocabulary) /path/to/data..." << endl;
         return -1;
     }
 
@@ -103,8 +147,19 @@ int main(int argc, char** argv)
     TICK("run");
 
     boost::filesystem::path vocabulary_path(argv[1]);
+    // compare e.g. a vocabulary of projected descriptors to one of the full descriptors on the same queries
+    boost::filesystem::path compare_path;
+    int data_start = 2;
+    if (string(argv[2]) == "--compare") {
+        if (argc < 5) {
+            cout << "Please provide the vocabulary to compare with and the annotated data path(s) to query..." << endl;
+            return -1;
+        }
+        compare_path = boost::filesystem::path(argv[3]);
+        data_start = 4;
+    }
     vector<string> folder_xmls;
-    for (int i = 2; i < argc; ++i) {
+    for (int i = data_start; i < argc; ++i) {
         boost::filesystem::path data_path(argv[i]);
         vector<string> data_xmls = semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string(), true);
         folder_xmls.insert(folder_xmls.end(), data_xmls.begin(), data_xmls.end());
@@ -129,24 +184,10 @@ int main(int argc, char** argv)
     timeinfo = localtime(&rawtime);
     strftime(buffer, 80, "%Y-%m-%d %H:%M:%S", timeinfo);
 
-#if CONVEX_SEGMENTS_ONLY
-    boost::filesystem::path benchmark_path = vocabulary_path / (string("benchmark ") + buffer + " CONVEX SURFELS");
-#else
-    boost::filesystem::path benchmark_path = vocabulary_path / (string("benchmark ") + buffer + " INCREMENTAL SURFELS");
-#endif
-    boost::filesystem::create_directory(benchmark_path);
-
-    TICK("load_summary");
-    dynamic_object_retrieval::vocabulary_summary summary;
-    summary.load(vocabulary_path);
-    TOCK("load_summary");
-
-    benchmark_retrieval::benchmark_result benchmark;
-    if (summary.vocabulary_type == "standard") {
-        //benchmark = run_benchmark<vocabulary_tree<HistT, 8> >(folder_xmls, vocabulary_path, summary, benchmark_path);
-    }
-    else if (summary.vocabulary_type == "incremental") {
-        benchmark = run_benchmark<grouped_vocabulary_tree<HistT, 8> >(folder_xmls, vocabulary_path, summary, benchmark_path);
+    benchmark_retrieval::benchmark_result benchmark = benchmark_vocabulary(folder_xmls, vocabulary_path, buffer);
+    benchmark_retrieval::benchmark_result compare_benchmark;
+    if (!compare_path.empty()) {
+        compare_benchmark = benchmark_vocabulary(folder_xmls, compare_path, buffer);
     }
 
     TOCK("run");
@@ -157,7 +198,14 @@ int main(int argc, char** argv)
         cout << "Ratio for instance " << instance_ratio.first << ": " << instance_ratio.second.first/instance_ratio.second.second << endl;
     }
 
-    benchmark_retrieval::save_benchmark(benchmark, benchmark_path);
+    if (!compare_path.empty()) {
+        cout << "Got overall ratio " << benchmark.ratio.first / benchmark.ratio.second << " vs "
+             << compare_benchmark.ratio.first / compare_benchmark.ratio.second << " for " << compare_path.string() << endl;
+        for (const pair<string, benchmark_retrieval::correct_ratio>& instance_ratio : benchmark.instance_ratios) {
+            cout << "Ratio for instance " << instance_ratio.first << ": " << instance_ratio.second.first/instance_ratio.second.second
+                 << " vs " << get_instance_ratio(compare_benchmark, instance_ratio.first) << endl;
+        }
+    }
 
     Stopwatch::getInstance().sendAll();
 
@@ -79,6 +79,8 @@ map<string, pair<float, int> > get_segmentation_scores_for_data(const std::funct
         boost::filesystem::path sweep_path = boost::filesystem::path(sweep_xml).parent_path();
         SurfelCloudT::Ptr surfel_map(new SurfelCloudT);
         pcl::io::loadPCDFile((sweep_path / "surfel_map.pcd").string(), *surfel_map);
+        // shared by all the labelled objects of the sweep
+        dynamic_object_retrieval::surfel_normal_index surfel_index(surfel_map);
 
         for (auto tup : dynamic_object_retrieval::zip(labels.objectClouds, labels.objectLabels, labels.objectMasks, labels.objectScanIndices)) {
             CloudT::Ptr cloud;
@@ -125,7 +127,7 @@ map<string, pair<float, int> > get_segmentation_scores_for_data(const std::funct
                 ratio.second += 1;
             }
 
-            NormalCloudT::Ptr query_normals = dynamic_object_retrieval::compute_surfel_normals(surfel_map, query_cloud);
+            NormalCloudT::Ptr query_normals = dynamic_object_retrieval::compute_surfel_normals(surfel_index, query_cloud);
             map_object_for_instance[label] = make_pair(query_cloud, sweep_cloud);
             map_normal_for_instance[label] = query_normals;
         }
@@ -83,25 +83,26 @@ float compute_cloud_size(CloudT::Ptr& cloud)
 }
 
 // TODO: finish this
-set<pair<int, int> > compute_group_adjacencies_subsegments(CloudT::Ptr& centroids, float adj_dist)
+subgroup_adjacencies compute_group_adjacencies_subsegments(CloudT::Ptr& centroids, float adj_dist)
 {
-    set<pair<int, int> > adjacencies;
+    vector<pair<int, int> > edges;
 
     for (int i = 0; i < centroids->size(); ++i) {
         for (int j = 0; j < i; ++j) {
             if ((centroids->at(i).getVector3fMap()-centroids->at(j).getVector3fMap()).norm() < adj_dist) {
-                adjacencies.insert(make_pair(i, j));
-                // adjacencies.insert(make_pair(j, i));
+                edges.push_back(make_pair(i, j));
             }
         }
     }
 
+    subgroup_adjacencies adjacencies;
+    adjacencies.assign(edges, centroids->size());
     return adjacencies;
 }
 
-set<pair<int, int> > compute_group_adjacencies_supervoxels(const boost::filesystem::path& segment_path)
+subgroup_adjacencies compute_group_adjacencies_supervoxels(const boost::filesystem::path& segment_path)
 {
-    set<pair<int, int> > adjacencies;
+    vector<pair<int, int> > edges;
 
     boost::filesystem::path graph_path = segment_path / "graph.cereal";
     supervoxel_segmentation ss;
@@ -110,7 +111,7 @@ set<pair<int, int> > compute_group_adjacencies_supervoxels(const boost::filesyst
 
     typename boost::property_map<supervoxel_segmentation::Graph, boost::vertex_name_t>::type vertex_name = boost::get(boost::vertex_name, g);
 
-    // now iterate over all of the adjacencies in the original graph and add them to the set data structure
+    // now iterate over all of the adjacencies in the original graph and add them to the adjacency graph
     using edge_iterator = boost::graph_traits<supervoxel_segmentation::Graph>::edge_iterator;
     edge_iterator edge_it, edge_end;
     for (tie(edge_it, edge_end) = boost::edges(g); edge_it != edge_end; ++edge_it) {
@@ -118,9 +119,11 @@ set<pair<int, int> > compute_group_adjacencies_supervoxels(const boost::filesyst
         supervoxel_segmentation::Vertex v = target(*edge_it, g);
         supervoxel_segmentation::vertex_name_property from = boost::get(vertex_name, u);
         supervoxel_segmentation::vertex_name_property to = boost::get(vertex_name, v);
-        adjacencies.insert(make_pair(from.m_value, to.m_value));
+        edges.push_back(make_pair(from.m_value, to.m_value));
     }
 
+    subgroup_adjacencies adjacencies;
+    adjacencies.assign(edges, boost::num_vertices(g));
     return adjacencies;
 }
 
@@ -156,7 +159,7 @@ add_segments(VocabularyT& vt,
 
     HistCloudT::Ptr features(new HistCloudT);
     CloudT::Ptr centroids(new CloudT);
-    vector<set<pair<int, int> > > adjacencies;
+    vector<subgroup_adjacencies> adjacencies;
     vector<typename VocabularyT::index_type> indices;
 
     size_t counter = 0;
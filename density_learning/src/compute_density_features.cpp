@@ -1,8 +1,6 @@
 #include "dynamic_object_retrieval/summary_types.h"
 #include "dynamic_object_retrieval/summary_iterators.h"
 #include "dynamic_object_retrieval/definitions.h"
-#include "iss/iss_conf.h"
-#include "iss/iss_conf.hpp"
 #include <pcl/features/pfhrgb.h>
 #include <pcl/features/normal_3d_omp.h>
 #include <dynamic_object_retrieval/visualize.h>
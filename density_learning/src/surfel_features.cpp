@@ -1,13 +1,9 @@
 #include "density_learning/surfel_features.h"
+#include "object_3d_retrieval/feature_pipeline.h"
 
 #include <pcl/kdtree/impl/kdtree_flann.hpp>
-#include <pcl/features/pfhrgb.h>
-#include <pcl/features/normal_3d_omp.h>
 #include <pcl/visualization/pcl_visualizer.h>
 
-#include "iss/iss_conf.h"
-#include "iss/iss_conf.hpp"
-
 using namespace std;
 
 namespace surfel_features {
@@ -29,68 +25,29 @@ void visualize(CloudT::Ptr& cloud)
 void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud,
                       NormalCloudT::Ptr& normals, bool visualize_features)
 {
-    pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>);
-    if (normals->empty()) {
-        // first, extract normals, if we don't use the lowres cloud
-        pcl::NormalEstimationOMP<PointT, NormalT> ne;
-        ne.setInputCloud(cloud);
-        ne.setSearchMethod(tree);
-        ne.setRadiusSearch(0.04); // 0.02
-        ne.compute(*normals);
-    }
-
-    //float threshold = std::max(1.0-0.5*float(segment->size())/(0.3*480*640), 0.5);
-    //
-    //  ISS3D parameters
-    //
-    double iss_salient_radius_;
-    double iss_non_max_radius_;
-    double iss_normal_radius_;
-    double iss_border_radius_;
-    double iss_gamma_21_ (1.0); // 0.975 orig
-    double iss_gamma_32_ (1.0); // 0.975 orig
-    double iss_min_neighbors_ (5);
-    int iss_threads_ (3);
+    // Fill in the model cloud
+    double model_resolution = 0.003;
 
+    //  ISS3D parameters, all the keypoints are kept and thresholded on their saliency later
+    pfhrgb_estimation::iss_parameters iss_params(model_resolution, 1.0); // 0.975 orig
 
-    pcl::IndicesPtr indices(new std::vector<int>);
+    // only the normals and keypoints need the neighborhoods of all the points,
+    // the descriptors search their keypoints again if their radius is larger
+    pfhrgb_estimation::feature_pipeline pipeline(cloud, normals->empty()? std::max(0.04, iss_params.salient_radius) : iss_params.salient_radius);
 
-    // Fill in the model cloud
-    double model_resolution = 0.003;
+    if (normals->empty()) {
+        // first, extract normals, if we don't use the lowres cloud
+        normals = pipeline.compute_normals(0.04); // 0.02
+    }
 
-    // Compute model_resolution
-    iss_salient_radius_ = 6 * model_resolution;
-    iss_non_max_radius_ = 4 * model_resolution;
-    iss_normal_radius_ = 4 * model_resolution;
-    iss_border_radius_ = 0.5 * model_resolution; // 1
-
-    //
-    // Compute keypoints
-    //
-    pcl::ISSKeypoint3D<PointT, PointT> iss_detector;
-    iss_detector.setSearchMethod(tree);
-    iss_detector.setSalientRadius(iss_salient_radius_);
-    iss_detector.setNonMaxRadius(iss_non_max_radius_);
-
-    iss_detector.setNormalRadius(iss_normal_radius_); // comment these two if not to use border removal
-    iss_detector.setBorderRadius(iss_border_radius_); // comment these two if not to use border removal
-
-    iss_detector.setThreshold21(iss_gamma_21_);
-    iss_detector.setThreshold32(iss_gamma_32_);
-    iss_detector.setMinNeighbors(iss_min_neighbors_);
-    iss_detector.setNumberOfThreads(iss_threads_);
-    iss_detector.setInputCloud(cloud);
-    //iss_detector.setNormals(normals);
-    iss_detector.compute(*keypoints);
-
-    pcl::KdTreeFLANN<PointT> kdtree; // might be possible to just use the other tree here
-    kdtree.setInputCloud(cloud);
-    for (const PointT& k : keypoints->points) {
-        std::vector<int> ind;
-        std::vector<float> dist;
-        kdtree.nearestKSearchT(k, 1, ind, dist);
-        //cout << "Keypoint threshold: " << k.rgb << endl;
-        indices->push_back(ind[0]);
+    // the saliency is kept in the rgb field of the keypoints
+    std::vector<int> indices;
+    std::vector<float> saliencies;
+    pipeline.compute_iss_keypoints(indices, saliencies, iss_params);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        PointT p = cloud->at(indices[i]);
+        p.rgb = saliencies[i];
+        keypoints->push_back(p);
     }
 
     if (visualize_features) {
@@ -102,27 +59,11 @@ void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT:
         }
         visualize(vis_cloud);
     }
-    // ISS3D
-
-    // PFHRGB
-    pcl::PFHRGBEstimation<PointT, NormalT> se;
-    se.setSearchMethod(tree);
-    //se.setKSearch(100);
-    se.setIndices(indices); //keypoints
-    se.setInputCloud(cloud);
-    se.setInputNormals(normals);
-    se.setRadiusSearch(0.04); //support 0.06 orig, 0.04 still seems too big, takes time
-
-    pcl::PointCloud<pcl::PFHRGBSignature250> pfhrgb_cloud;
-    se.compute(pfhrgb_cloud); //descriptors
-
-    const int N = 250;
-    features->resize(pfhrgb_cloud.size());
-    for (size_t i = 0; i < pfhrgb_cloud.size(); ++i) {
-        std::copy(pfhrgb_cloud.at(i).histogram, pfhrgb_cloud.at(i).histogram+N, features->at(i).histogram);
-    }
 
-    std::cout << "Number of features: " << pfhrgb_cloud.size() << std::endl;
+    // PFHRGB, the features have the same layout as the pfhrgb histograms
+    pipeline.compute_pfhrgb_features(features, indices, normals, 0.04); //support 0.06 orig, 0.04 still seems too big, takes time
+
+    std::cout << "Number of features: " << features->size() << std::endl;
 }
 
 void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud,
@@ -0,0 +1,227 @@
+#ifndef DATASET_CATALOG_H
+#define DATASET_CATALOG_H
+
+/*
+ *  The dataset catalog collects everything that is needed to resolve
+ * vocabulary results into paths: the sweep folders, the segments of
+ * every sweep with their global vt indices and the vt index to path maps
+ * of the segments summary. It is built once from the summaries and the
+ * sweep folders and is then kept as segments_catalog.bin next to the
+ * summary, which is rebuilt whenever the segments summary is newer than it.
+ * The catalog is read through a memory mapping, so loading it and looking
+ * up a path takes the same time however large the data set is.
+ * For grouped vocabularies, subgroup_path_resolver uses the catalogs to
+ * find the paths of the subgroups without looking in the sweep folders.
+ */
+
+#include "dynamic_object_retrieval/summary_types.h"
+#include "dynamic_object_retrieval/summary_format.h"
+
+#include <pcl/point_types.h>
+#include <metaroom_xml_parser/load_utilities.h>
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace dynamic_object_retrieval {
+
+class dataset_catalog {
+protected:
+
+    summary_reader file;
+
+public:
+
+    using int_list = summary_reader::int_list;
+    using string_list = summary_reader::string_list;
+
+    int64_t version; // modification time of the segments summary when the catalog was built
+
+    string_list sweep_paths; // the sweep folders, in the order of getSweepXmls
+
+    // the segments of sweep i are [offsets[i], offsets[i+1]) in the segment lists
+    int_list convex_segment_offsets;
+    int_list subsegment_offsets;
+    int_list convex_segment_indices; // global vt indices, as in the segments summaries of the sweeps
+    int_list subsegment_indices;
+
+    // maps indices in vt to segment paths, same as in data_summary
+    string_list index_convex_segment_paths;
+    string_list index_subsegment_paths;
+
+    static int64_t current_version(const boost::filesystem::path& data_path)
+    {
+        return summary_version(data_path, "segments_summary");
+    }
+
+    size_t nbr_sweeps() const { return sweep_paths.size(); }
+    size_t nbr_convex_segments(size_t sweep_id) const { return convex_segment_offsets[sweep_id+1] - convex_segment_offsets[sweep_id]; }
+    size_t nbr_subsegments(size_t sweep_id) const { return subsegment_offsets[sweep_id+1] - subsegment_offsets[sweep_id]; }
+
+    // writes the catalog of a data set to catalog_path
+    static void build(const boost::filesystem::path& data_path, const boost::filesystem::path& catalog_path)
+    {
+        data_summary summary;
+        summary.load(data_path);
+
+        std::vector<std::string> folder_xmls = semantic_map_load_utilties::getSweepXmls<pcl::PointXYZRGB>(data_path.string());
+        std::vector<std::string> sweep_paths;
+        std::vector<int> convex_segment_offsets(1, 0);
+        std::vector<int> subsegment_offsets(1, 0);
+        std::vector<int> convex_segment_indices;
+        std::vector<int> subsegment_indices;
+        for (const std::string& xml : folder_xmls) {
+            boost::filesystem::path sweep_path = boost::filesystem::path(xml).parent_path();
+            sweep_paths.push_back(sweep_path.string());
+            append_sweep_segments(convex_segment_offsets, convex_segment_indices, sweep_path / "convex_segments");
+            append_sweep_segments(subsegment_offsets, subsegment_indices, sweep_path / "subsegments");
+        }
+
+        summary_writer writer;
+        writer.add("version", current_version(data_path));
+        writer.add("sweep_paths", sweep_paths);
+        writer.add("convex_segment_offsets", convex_segment_offsets);
+        writer.add("subsegment_offsets", subsegment_offsets);
+        writer.add("convex_segment_indices", convex_segment_indices);
+        writer.add("subsegment_indices", subsegment_indices);
+        writer.add("index_convex_segment_paths", summary.index_convex_segment_paths);
+        writer.add("index_subsegment_paths", summary.index_subsegment_paths);
+        writer.save(catalog_path);
+    }
+
+    bool load(const boost::filesystem::path& catalog_path)
+    {
+        if (!boost::filesystem::exists(catalog_path) || !file.open(catalog_path)) {
+            return false;
+        }
+        version = file.get_integer("version");
+        sweep_paths = file.get_string_list("sweep_paths");
+        convex_segment_offsets = file.get_int_list("convex_segment_offsets");
+        subsegment_offsets = file.get_int_list("subsegment_offsets");
+        convex_segment_indices = file.get_int_list("convex_segment_indices");
+        subsegment_indices = file.get_int_list("subsegment_indices");
+        index_convex_segment_paths = file.get_string_list("index_convex_segment_paths");
+        index_subsegment_paths = file.get_string_list("index_subsegment_paths");
+        return true;
+    }
+
+    dataset_catalog() : version(-1) {}
+
+protected:
+
+    static void append_sweep_segments(std::vector<int>& offsets, std::vector<int>& indices,
+                                      const boost::filesystem::path& segments_path)
+    {
+        if (has_summary(segments_path, "segments")) {
+            sweep_summary summary;
+            summary.load(segments_path);
+            // not all of the segments need to have been added to the vt
+            indices.insert(indices.end(), summary.segment_indices.begin(), summary.segment_indices.end());
+            indices.resize(offsets.back() + summary.nbr_segments, -1);
+        }
+        offsets.push_back(indices.size());
+    }
+};
+
+// returns the catalog of a data set, loaded or built at most once
+// per version of the data set and then shared within the process
+inline std::shared_ptr<const dataset_catalog> get_dataset_catalog(const boost::filesystem::path& data_path)
+{
+    static std::mutex catalogs_mutex;
+    static std::map<std::string, std::shared_ptr<const dataset_catalog> > catalogs;
+
+    std::lock_guard<std::mutex> lock(catalogs_mutex);
+
+    int64_t version = dataset_catalog::current_version(data_path);
+    std::shared_ptr<const dataset_catalog>& cached = catalogs[data_path.string()];
+    if (cached && cached->version == version) {
+        return cached;
+    }
+
+    boost::filesystem::path catalog_path = data_path / "segments_catalog.bin";
+    std::shared_ptr<dataset_catalog> catalog = std::make_shared<dataset_catalog>();
+    if (!catalog->load(catalog_path) || catalog->version != version) {
+        std::cout << "Building the segment catalog of " << data_path.string() << "..." << std::endl;
+        // if the data set is read only, the catalog is kept in a temporary
+        // file that is removed once it is mapped and built again next time
+        boost::filesystem::path build_path = catalog_path;
+        if (access(data_path.string().c_str(), W_OK) != 0) {
+            build_path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("segments_catalog_%%%%%%%%.bin");
+            std::cout << "Could not write the catalog to " << data_path.string() << ", it will be rebuilt next time" << std::endl;
+        }
+        catalog = std::make_shared<dataset_catalog>();
+        dataset_catalog::build(data_path, build_path);
+        catalog->load(build_path);
+        if (build_path != catalog_path) {
+            boost::filesystem::remove(build_path);
+        }
+    }
+    cached = catalog;
+    return cached;
+}
+
+// resolves the (group, subgroup) indices of the grouped vocabulary into segment paths,
+// the groups are the sweeps of the noise data set followed by those of the annotated one
+struct subgroup_path_resolver {
+
+    std::shared_ptr<const dataset_catalog> noise_catalog;
+    std::shared_ptr<const dataset_catalog> annotated_catalog;
+    size_t nbr_noise_sweeps;
+    bool convex_segments; // otherwise subsegments or supervoxels
+    std::string folder_name;
+    std::string segment_name;
+
+    // appends the paths of the subgroups of a group that exist, in increasing subgroup order
+    void get_paths(std::vector<boost::filesystem::path>& paths, size_t group_id, std::vector<int> subgroup_ids) const
+    {
+        const dataset_catalog* catalog = noise_catalog.get();
+        if (group_id >= nbr_noise_sweeps) {
+            group_id -= nbr_noise_sweeps;
+            catalog = annotated_catalog.get();
+        }
+        boost::filesystem::path segments_path = boost::filesystem::path(catalog->sweep_paths[group_id]) / folder_name;
+        size_t nbr_segments = convex_segments? catalog->nbr_convex_segments(group_id) : catalog->nbr_subsegments(group_id);
+
+        std::sort(subgroup_ids.begin(), subgroup_ids.end());
+        for (int subgroup_id : subgroup_ids) {
+            if (subgroup_id < 0 || size_t(subgroup_id) >= nbr_segments) {
+                continue;
+            }
+            std::stringstream ss;
+            ss << segment_name << std::setw(4) << std::setfill('0') << subgroup_id;
+            paths.push_back(segments_path / (ss.str() + ".pcd"));
+        }
+    }
+
+    subgroup_path_resolver(const vocabulary_summary& summary) :
+        noise_catalog(get_dataset_catalog(summary.noise_data_path)),
+        annotated_catalog(get_dataset_catalog(summary.annotated_data_path)),
+        nbr_noise_sweeps(summary.nbr_noise_sweeps)
+    {
+        if (summary.subsegment_type == "subsegment" || summary.subsegment_type == "supervoxel") {
+            convex_segments = false;
+            folder_name = "subsegments";
+            segment_name = "pfhrgbkeypoint";
+        }
+        else if (summary.subsegment_type == "convex_segment") {
+            convex_segments = true;
+            folder_name = "convex_segments";
+            segment_name = "segment";
+        }
+        else {
+            std::cout << summary.subsegment_type << " not a valid subsegment type..." << std::endl;
+            exit(-1);
+        }
+    }
+};
+
+} // namespace dynamic_object_retrieval
+
+#endif // DATASET_CATALOG_H
@@ -5,6 +5,8 @@
 
 static const int N = 250;
 //static const int N = 1344;
+// dimension of the descriptors in vocabularies trained with a descriptor projection
+static const int PROJECTED_N = 64;
 
 //namespace dynamic_object_retrieval {
 //
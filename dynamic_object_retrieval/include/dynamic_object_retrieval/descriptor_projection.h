@@ -0,0 +1,202 @@
+#ifndef DESCRIPTOR_PROJECTION_H
+#define DESCRIPTOR_PROJECTION_H
+
+/*
+ *  A linear projection of the descriptors into a lower dimensional space,
+ * fit with PCA on the features that a vocabulary is trained on. It is kept
+ * as descriptor_projection.cereal in the vocabulary folder and the features
+ * are projected before they are added to or queried against the vocabulary.
+ * A vocabulary folder without the file contains a vocabulary of the full
+ * descriptors. The projection can optionally whiten the projected features,
+ * scaling all of the dimensions to unit variance.
+ */
+
+#include <eigen_cereal/eigen_cereal.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <Eigen/Dense>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+namespace dynamic_object_retrieval {
+
+inline boost::filesystem::path descriptor_projection_path(const boost::filesystem::path& vocabulary_path)
+{
+    return vocabulary_path / "descriptor_projection.cereal";
+}
+
+inline bool has_descriptor_projection(const boost::filesystem::path& vocabulary_path)
+{
+    return boost::filesystem::exists(descriptor_projection_path(vocabulary_path));
+}
+
+template <typename InPointT, typename OutPointT>
+struct descriptor_projection {
+
+    static const int in_rows = std::extent<decltype(InPointT::histogram)>::value;
+    static const int out_rows = std::extent<decltype(OutPointT::histogram)>::value;
+
+    // the descriptors are stored one after the other in the point clouds
+    using in_map_type = Eigen::Map<const Eigen::MatrixXf, 0, Eigen::OuterStride<> >;
+    using out_map_type = Eigen::Map<Eigen::MatrixXf, 0, Eigen::OuterStride<> >;
+
+    bool whiten;
+    Eigen::VectorXf mean;
+    Eigen::MatrixXf basis; // out_rows x in_rows, the principal directions with the largest variance first
+    Eigen::VectorXf variances; // the variances along the principal directions, before whitening
+
+    static in_map_type map_cloud(const pcl::PointCloud<InPointT>& cloud)
+    {
+        return in_map_type(cloud.points[0].histogram, in_rows, cloud.size(), Eigen::OuterStride<>(sizeof(InPointT)/sizeof(float)));
+    }
+
+    static out_map_type map_cloud(pcl::PointCloud<OutPointT>& cloud)
+    {
+        return out_map_type(cloud.points[0].histogram, out_rows, cloud.size(), Eigen::OuterStride<>(sizeof(OutPointT)/sizeof(float)));
+    }
+
+    void fit(const typename pcl::PointCloud<InPointT>::Ptr& features, bool do_whiten)
+    {
+        whiten = do_whiten;
+        size_t nbr_features = features->size();
+        if (nbr_features < 2) {
+            std::cout << "Need at least two features to fit the descriptor projection..." << std::endl;
+            exit(-1);
+        }
+
+        in_map_type X = map_cloud(*features);
+        Eigen::VectorXd mean_d = X.template cast<double>().rowwise().sum() / double(nbr_features);
+        mean = mean_d.template cast<float>();
+
+        // accumulate the covariance in chunks so that we never copy all of the features
+        const size_t chunk_size = 10000;
+        Eigen::MatrixXd covariance = Eigen::MatrixXd::Zero(in_rows, in_rows);
+        for (size_t i = 0; i < nbr_features; i += chunk_size) {
+            size_t nbr_chunk = std::min(chunk_size, nbr_features - i);
+            Eigen::MatrixXf centered = X.middleCols(i, nbr_chunk).colwise() - mean;
+            Eigen::MatrixXf chunk_covariance = Eigen::MatrixXf::Zero(in_rows, in_rows);
+            chunk_covariance.template selfadjointView<Eigen::Lower>().rankUpdate(centered);
+            covariance += chunk_covariance.template cast<double>();
+        }
+        covariance /= double(nbr_features - 1);
+
+        // only reads the lower triangle, the eigenvalues are in increasing order
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(covariance);
+        basis.resize(out_rows, in_rows);
+        variances.resize(out_rows);
+        for (int i = 0; i < out_rows; ++i) {
+            int j = in_rows - 1 - i;
+            variances(i) = std::max(es.eigenvalues()(j), 0.0);
+            basis.row(i) = es.eigenvectors().col(j).transpose().template cast<float>();
+            if (whiten) {
+                basis.row(i) /= std::sqrt(variances(i) + 1e-12f);
+            }
+        }
+
+        std::cout << "Descriptor projection keeps " << variances.sum() / std::max(es.eigenvalues().sum(), 1e-12)
+                  << " of the variance with " << out_rows << " dimensions" << std::endl;
+    }
+
+    void project(typename pcl::PointCloud<OutPointT>::Ptr& projected, const typename pcl::PointCloud<InPointT>::Ptr& features) const
+    {
+        projected.reset(new pcl::PointCloud<OutPointT>);
+        projected->resize(features->size());
+        if (features->empty()) {
+            return;
+        }
+        out_map_type Y = map_cloud(*projected);
+        Y.noalias() = basis * map_cloud(*features);
+        Y.colwise() -= basis * mean;
+    }
+
+    bool load(const boost::filesystem::path& vocabulary_path)
+    {
+        std::ifstream in(descriptor_projection_path(vocabulary_path).string(), std::ios::binary);
+        if (!in.is_open()) {
+            return false;
+        }
+        cereal::BinaryInputArchive archive_i(in);
+        archive_i(*this);
+        if (basis.rows() != out_rows || basis.cols() != in_rows) {
+            std::cout << "The descriptor projection of " << vocabulary_path.string() << " is " << basis.cols() << " to "
+                      << basis.rows() << " dimensions, expected " << in_rows << " to " << out_rows << "..." << std::endl;
+            exit(-1);
+        }
+        return true;
+    }
+
+    void save(const boost::filesystem::path& vocabulary_path) const
+    {
+        std::ofstream out(descriptor_projection_path(vocabulary_path).string(), std::ios::binary);
+        cereal::BinaryOutputArchive archive_o(out);
+        archive_o(*this);
+    }
+
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+        archive(whiten, mean, basis, variances);
+    }
+
+    descriptor_projection() : whiten(false) {}
+};
+
+// no projection, for vocabularies of the full descriptors
+template <typename PointT>
+struct descriptor_projection<PointT, PointT> {
+
+    void fit(const typename pcl::PointCloud<PointT>::Ptr& features, bool do_whiten) {}
+
+    void project(typename pcl::PointCloud<PointT>::Ptr& projected, const typename pcl::PointCloud<PointT>::Ptr& features) const
+    {
+        projected = features;
+    }
+
+    bool load(const boost::filesystem::path& vocabulary_path) { return true; }
+
+    // removes any projection left from a vocabulary previously trained in the same folder
+    void save(const boost::filesystem::path& vocabulary_path) const
+    {
+        boost::filesystem::remove(descriptor_projection_path(vocabulary_path));
+    }
+};
+
+// returns the projection of a vocabulary, loaded at most once per
+// version of the projection file and then shared within the process
+template <typename InPointT, typename OutPointT>
+std::shared_ptr<const descriptor_projection<InPointT, OutPointT> > get_descriptor_projection(const boost::filesystem::path& vocabulary_path)
+{
+    using projection_type = descriptor_projection<InPointT, OutPointT>;
+
+    static std::mutex projections_mutex;
+    static std::map<std::string, std::pair<int64_t, std::shared_ptr<const projection_type> > > projections;
+
+    std::lock_guard<std::mutex> lock(projections_mutex);
+
+    boost::filesystem::path projection_path = descriptor_projection_path(vocabulary_path);
+    int64_t version = boost::filesystem::exists(projection_path)? int64_t(boost::filesystem::last_write_time(projection_path)) : -1;
+    std::pair<int64_t, std::shared_ptr<const projection_type> >& cached = projections[vocabulary_path.string()];
+    if (cached.second && cached.first == version) {
+        return cached.second;
+    }
+
+    std::shared_ptr<projection_type> projection = std::make_shared<projection_type>();
+    if (!projection->load(vocabulary_path)) {
+        std::cout << "Could not read the descriptor projection of " << vocabulary_path.string() << "..." << std::endl;
+        exit(-1);
+    }
+    cached = std::make_pair(version, std::shared_ptr<const projection_type>(projection));
+    return cached.second;
+}
+
+} // namespace dynamic_object_retrieval
+
+#endif // DESCRIPTOR_PROJECTION_H
@@ -2,6 +2,8 @@
 #define DYNAMIC_RETRIEVAL_H
 
 #include "dynamic_object_retrieval/summary_types.h"
+#include "dynamic_object_retrieval/dataset_catalog.h"
+#include "dynamic_object_retrieval/descriptor_projection.h"
 #include "dynamic_object_retrieval/visualize.h"
 #include "dynamic_object_retrieval/summary_iterators.h"
 #include "dynamic_object_retrieval/extract_surfel_features.h"
@@ -15,6 +17,7 @@
 #include <object_3d_retrieval/register_objects.h>
 #include <boost/filesystem.hpp>
 #include <pcl/io/pcd_io.h>
+#include <future>
 #include <dynamic_object_retrieval/definitions.h>
 
 #define WITH_SURFEL_NORMALS 1
@@ -33,30 +36,27 @@ struct path_result {
     using type =  boost::filesystem::path;
 };
 
-template <>
-struct path_result<grouped_vocabulary_tree<HistT, 8> > {
+template <typename PointT>
+struct path_result<grouped_vocabulary_tree<PointT, 8> > {
     using type = std::vector<boost::filesystem::path>;
 };
 
 template <typename IndexT>
 std::vector<boost::filesystem::path> get_retrieved_paths(const std::vector<IndexT>& scores, const vocabulary_summary& summary)
 {
-    // here we'll make use of the info saved in the data_summaries
-    // maybe we should cache these as well as they might get big?
-    data_summary noise_summary;
-    noise_summary.load(boost::filesystem::path(summary.noise_data_path));
-    data_summary annotated_summary;
-    annotated_summary.load(boost::filesystem::path(summary.annotated_data_path));
+    // the catalogs keep the paths of the data_summaries, loaded once per process
+    std::shared_ptr<const dataset_catalog> noise_catalog = get_dataset_catalog(summary.noise_data_path);
+    std::shared_ptr<const dataset_catalog> annotated_catalog = get_dataset_catalog(summary.annotated_data_path);
 
     std::vector<boost::filesystem::path> retrieved_paths;
     size_t offset = summary.nbr_noise_segments;
     for (IndexT s : scores) {
         // TODO: vt index is not correct for grouped_vocabulary
         if (s.index < offset) {
-            retrieved_paths.push_back(boost::filesystem::path(noise_summary.index_convex_segment_paths[s.index]));
+            retrieved_paths.push_back(boost::filesystem::path(noise_catalog->index_convex_segment_paths[s.index]));
         }
         else {
-            retrieved_paths.push_back(boost::filesystem::path(annotated_summary.index_convex_segment_paths[s.index-offset]));
+            retrieved_paths.push_back(boost::filesystem::path(annotated_catalog->index_convex_segment_paths[s.index-offset]));
         }
     }
 
@@ -78,81 +78,32 @@ get_retrieved_path_scores(const std::vector<vocabulary_tree<HistT, 8>::result_ty
 std::vector<std::pair<std::vector<boost::filesystem::path>, grouped_vocabulary_tree<HistT, 8>::result_type> >
 get_retrieved_path_scores(const std::vector<grouped_vocabulary_tree<HistT, 8>::result_type>& scores, const vocabulary_summary& summary)
 {
-    // OK, now we need to get the paths for all of the stuff within the scans instead, so basically
-    // we need to get a subsegment_sweep__path_iterator and add all of the path corresponding to groups
+    // the segment paths of the groups come directly from the dataset catalogs
+    subgroup_path_resolver resolver(summary);
     std::vector<std::pair<std::vector<boost::filesystem::path>, grouped_vocabulary_tree<HistT, 8>::result_type> > path_scores;
 
-    int temp = 0;
     for (const grouped_vocabulary_tree<HistT, 8>::result_type& score : scores) {
-        std::cout << "Iteration nbr: " << temp << std::endl;
-        std::cout << "Scores size: " << scores.size() << std::endl;
-        std::cout << "Subsegments in group: " << score.subgroup_group_indices.size() << std::endl;
         path_scores.push_back(std::make_pair(std::vector<boost::filesystem::path>(), score));
-
-        int sweep_id = score.group_index;
-        std::cout << "Getting sweep xml for group: " << sweep_id << std::endl;
-        std::cout << "With subsegment: " << score.subgroup_index << std::endl;
-        boost::filesystem::path sweep_path = dynamic_object_retrieval::get_sweep_xml(sweep_id, summary);
-        std::cout << "Getting a subsegment iterator for sweep: " << sweep_path.string() << std::endl;
-        if (summary.subsegment_type == "subsegment" || summary.subsegment_type == "supervoxel") {
-            dynamic_object_retrieval::sweep_subsegment_keypoint_map subsegments(sweep_path); // this is a problem
-            std::cout << "Finished getting a subsegment iterator for sweep: " << sweep_path.string() << std::endl;
-            int counter = 0;
-            for (const boost::filesystem::path& path : subsegments) {
-                if (std::find(score.subgroup_group_indices.begin(), score.subgroup_group_indices.end(), counter) != score.subgroup_group_indices.end()) {
-                    path_scores.back().first.push_back(path);
-                }
-                ++counter;
-            }
-        }
-        else if (summary.subsegment_type == "convex_segment") {
-            dynamic_object_retrieval::sweep_convex_segment_map subsegments(sweep_path); // this is a problem
-            std::cout << "Finished getting a subsegment iterator for sweep: " << sweep_path.string() << std::endl;
-            int counter = 0;
-            for (const boost::filesystem::path& path : subsegments) {
-                if (std::find(score.subgroup_group_indices.begin(), score.subgroup_group_indices.end(), counter) != score.subgroup_group_indices.end()) {
-                    path_scores.back().first.push_back(path);
-                }
-                ++counter;
-            }
-        }
-        else {
-            std::cout << summary.subsegment_type << " not a valid subsegment type..." << std::endl;
-            exit(-1);
-        }
-
-        std::cout << "Finished getting sweep xml for group: " << sweep_id << std::endl;
-        std::cout << "Got " << path_scores.back().first.size() << " subsegments..." << std::endl;
-        ++temp;
+        resolver.get_paths(path_scores.back().first, score.group_index, score.subgroup_group_indices);
+        std::cout << "Got " << path_scores.back().first.size() << " subsegments for group " << score.group_index << std::endl;
     }
 
     return path_scores;
 }
 
+// returns the features in the descriptor space of the vocabulary, they are
+// projected if the vocabulary was trained with a descriptor projection
 template <typename VocabularyT>
-std::vector<std::pair<typename path_result<VocabularyT>::type, typename VocabularyT::result_type> >
-query_vocabulary(HistCloudT::Ptr& features, size_t nbr_query, VocabularyT& vt,
-                 const boost::filesystem::path& vocabulary_path,
-                 const vocabulary_summary& summary)
+typename VocabularyT::cloud_ptr_type project_features(HistCloudT::Ptr& features, const boost::filesystem::path& vocabulary_path)
 {
-    // we need to cache the vt if we are to do this multiple times
-    if (vt.empty()) {
-        load_vocabulary(vt, vocabulary_path);
-        vt.set_min_match_depth(3);
-        vt.compute_normalizing_constants();
-    }
-
-    // add some common methods in vt for querying, really only one!
-    std::vector<typename VocabularyT::result_type> scores;
-    vt.query_vocabulary(scores, features, nbr_query);
-
-    return get_retrieved_path_scores(scores, summary);
+    typename VocabularyT::cloud_ptr_type projected;
+    get_descriptor_projection<HistT, typename VocabularyT::point_type>(vocabulary_path)->project(projected, features);
+    return projected;
 }
 
-// OK, the solution here is to turn the groups into the path scores
-template <>
-std::vector<std::pair<path_result<grouped_vocabulary_tree<HistT, 8> >::type, typename grouped_vocabulary_tree<HistT, 8>::result_type> >
-query_vocabulary(HistCloudT::Ptr& features, size_t nbr_query, grouped_vocabulary_tree<HistT, 8>& vt,
+template <typename VocabularyT>
+std::vector<std::pair<typename path_result<VocabularyT>::type, typename VocabularyT::result_type> >
+query_vocabulary(HistCloudT::Ptr& features, size_t nbr_query, VocabularyT& vt,
                  const boost::filesystem::path& vocabulary_path,
                  const vocabulary_summary& summary)
 {
@@ -164,8 +115,9 @@ query_vocabulary(HistCloudT::Ptr& features, size_t nbr_query, grouped_vocabulary
     }
 
     // add some common methods in vt for querying, really only one!
-    std::vector<typename grouped_vocabulary_tree<HistT, 8>::result_type> scores;
-    vt.query_vocabulary(scores, features, nbr_query);
+    std::vector<typename VocabularyT::result_type> scores;
+    typename VocabularyT::cloud_ptr_type vocabulary_features = project_features<VocabularyT>(features, vocabulary_path);
+    vt.query_vocabulary(scores, vocabulary_features, nbr_query);
 
     return get_retrieved_path_scores(scores, summary);
 }
@@ -188,8 +140,8 @@ struct segment_index {
     using type = int;
 };
 
-template <>
-struct segment_index<grouped_vocabulary_tree<HistT, 8> > {
+template <typename PointT>
+struct segment_index<grouped_vocabulary_tree<PointT, 8> > {
     using type = std::set<int>;
 };
 
@@ -204,12 +156,28 @@ float compute_cloud_volume(CloudT::Ptr& cloud)
     return centers*resolution*resolution*resolution;
 }
 
+// the sift features, keypoints and feature index of the candidates, in the same order as the candidates
+using candidate_sift_type = std::vector<extract_sift::indexed_sift>;
+
+template <typename PathT, typename IndexT>
+candidate_sift_type load_candidate_sift(const std::vector<std::pair<PathT, IndexT> >& path_scores)
+{
+    candidate_sift_type candidate_sift(path_scores.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < int(path_scores.size()); ++i) {
+        // reads the stored features of the segments, only crops the sweep features if there are none
+        candidate_sift[i] = extract_sift::get_indexed_sift_for_segment_path(path_scores[i].first);
+    }
+    return candidate_sift;
+}
+
 // this should definitely be generic to both!
 template <typename VocabularyT>
 std::vector<std::pair<typename path_result<VocabularyT>::type, typename VocabularyT::result_type> >
 reweight_query(CloudT::Ptr& query_cloud, HistCloudT::Ptr& features, SiftCloudT::Ptr& sift_features,
                CloudT::Ptr& sift_keypoints, size_t nbr_query, VocabularyT& vt,
                const std::vector<std::pair<typename path_result<VocabularyT>::type, typename VocabularyT::result_type> >& path_scores,
+               const candidate_sift_type& candidate_sift,
                const boost::filesystem::path& vocabulary_path, const vocabulary_summary& summary)
 {
     using result_type = std::vector<std::pair<typename path_result<VocabularyT>::type, typename VocabularyT::result_type> >;
@@ -218,36 +186,37 @@ reweight_query(CloudT::Ptr& query_cloud, HistCloudT::Ptr& features, SiftCloudT::
     float query_volume = compute_cloud_volume(query_cloud);
 
     TICK("registration_score");
-    //std::map<int, double> weighted_indices; // it would make more sense to keep a vector of sorted indices here I guess?
-    std::vector<reweight_type> weighted_indices;
-    double weight_sum = 0.0;
-    for (auto s : path_scores) {
-        std::cout << "Loading sift for: " << s.second.index << std::endl;
-
-        CloudT::Ptr match_sift_keypoints;
-        SiftCloudT::Ptr match_sift_cloud;
-        CloudT::Ptr match_cloud;
-
-        // we could probably use the path for this??? would be nicer with something else
-        // on the other hand the path makes it open if we cache or not
-        std::tie(match_sift_cloud, match_sift_keypoints, match_cloud) = extract_sift::get_sift_for_cloud_path(s.first);
-        std::cout << "Number of sift features for match: " << match_sift_cloud->size() << std::endl;
+    // the registrations of the candidates are independent so they are run in parallel,
+    // the scores are then added in candidate order to make the weights deterministic
+    std::vector<double> spatial_scores(path_scores.size(), 0.0);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < int(path_scores.size()); ++i) {
+        CloudT::Ptr match_sift_keypoints = candidate_sift[i].keypoints;
 
         register_objects ro;
         ro.set_input_clouds(sift_keypoints, match_sift_keypoints);
         //ro.set_input_clouds(query_cloud, match_cloud); // here we should have the actual clouds instead
-        ro.do_registration(sift_features, match_sift_cloud, sift_keypoints, match_sift_keypoints);
+        // the index of a candidate segment is kept in the segment cache, so it is only built once
+        ro.do_registration(sift_features, *candidate_sift[i].index, sift_keypoints, match_sift_keypoints);
 
         // color score is not used atm
-        double spatial_score, color_score;
-        std::tie(spatial_score, color_score) = ro.get_match_score();
+        double color_score;
+        std::tie(spatial_scores[i], color_score) = ro.get_match_score();
+    }
+
+    //std::map<int, double> weighted_indices; // it would make more sense to keep a vector of sorted indices here I guess?
+    std::vector<reweight_type> weighted_indices;
+    double weight_sum = 0.0;
+    for (size_t i = 0; i < path_scores.size(); ++i) {
+        double spatial_score = spatial_scores[i];
+        std::cout << "Registration score for " << path_scores[i].second.index << ": " << spatial_score << std::endl;
         if (std::isinf(spatial_score)) {
             continue;
         }
         // TODO: vt index is not correct for grouped_vocabulary
         //weighted_indices.insert(std::make_pair(s.second.index, spatial_score));
         if (spatial_score != 0.0f) {
-            insert_index_score(weighted_indices, s.second, spatial_score);
+            insert_index_score(weighted_indices, path_scores[i].second, spatial_score);
 
             weight_sum += spatial_score;
         }
@@ -271,8 +240,9 @@ reweight_query(CloudT::Ptr& query_cloud, HistCloudT::Ptr& features, SiftCloudT::
     TICK("reweighting");
     // TODO: improve the weighting to be done in the querying instead, makes way more sense
     std::map<int, double> original_norm_constants;
-    std::map<vocabulary_tree<HistT, 8>::node*, double> original_weights; // maybe change this to e.g. node_type
-    vt.compute_new_weights(original_norm_constants, original_weights, weighted_indices, features);
+    std::map<int, double> original_weights; // indexed by node id
+    typename VocabularyT::cloud_ptr_type vocabulary_features = project_features<VocabularyT>(features, vocabulary_path);
+    vt.compute_new_weights(original_norm_constants, original_weights, weighted_indices, vocabulary_features);
     TOCK("reweighting");
 
     std::cout << "Done re-weighting" << std::endl;
@@ -292,6 +262,18 @@ reweight_query(CloudT::Ptr& query_cloud, HistCloudT::Ptr& features, SiftCloudT::
     return scores;
 }
 
+template <typename VocabularyT>
+std::vector<std::pair<typename path_result<VocabularyT>::type, typename VocabularyT::result_type> >
+reweight_query(CloudT::Ptr& query_cloud, HistCloudT::Ptr& features, SiftCloudT::Ptr& sift_features,
+               CloudT::Ptr& sift_keypoints, size_t nbr_query, VocabularyT& vt,
+               const std::vector<std::pair<typename path_result<VocabularyT>::type, typename VocabularyT::result_type> >& path_scores,
+               const boost::filesystem::path& vocabulary_path, const vocabulary_summary& summary)
+{
+    candidate_sift_type candidate_sift = load_candidate_sift(path_scores);
+    return reweight_query(query_cloud, features, sift_features, sift_keypoints, nbr_query, vt,
+                          path_scores, candidate_sift, vocabulary_path, summary);
+}
+
 // take a potentially cached vt as argument, to allow caching
 // potentially mark this as DEPRECATED, use the funcion below instead
 template <typename VocabularyT>
@@ -384,6 +366,15 @@ query_reweight_vocabulary(VocabularyT& vt, CloudT::Ptr& query_cloud, cv::Mat& qu
         std::cout << "Mean leaves: " << vt.get_mean_leaf_points() << std::endl;
     }
 
+    // the sift features of the query image do not depend on the vocabulary results,
+    // so they are extracted while we compute the query features and query the vocabulary
+    std::future<std::pair<SiftCloudT::Ptr, CloudT::Ptr> > query_sift;
+    if (do_reweighting) {
+        query_sift = std::async(std::launch::async, [&]() {
+            return extract_sift::extract_sift_for_image(query_image, query_depth, K);
+        });
+    }
+
     std::cout << "Computing query features..." << std::endl;
     TICK("compute_query_features");
     HistCloudT::Ptr features(new HistCloudT);
@@ -405,17 +396,24 @@ query_reweight_vocabulary(VocabularyT& vt, CloudT::Ptr& query_cloud, cv::Mat& qu
 
     TOCK("query_vocabulary");
 
-    std::cout << "Computing sift features for query..." << std::endl;
+    // load the sift features of the candidates while waiting for the query ones
+    std::future<candidate_sift_type> candidate_sift = std::async(std::launch::async, [&]() {
+        return load_candidate_sift(retrieved_paths);
+    });
+
+    std::cout << "Waiting for sift features of query..." << std::endl;
     TICK("extract_sift_features");
     SiftCloudT::Ptr sift_features;
     CloudT::Ptr sift_keypoints;
-    tie(sift_features, sift_keypoints) = extract_sift::extract_sift_for_image(query_image, query_depth, K);
+    tie(sift_features, sift_keypoints) = query_sift.get();
+    candidate_sift_type candidate_sift_features = candidate_sift.get();
     TOCK("extract_sift_features");
 
     std::cout << "Reweighting and querying..." << std::endl;
     std::cout << "Number of query sift features: " << sift_features->size() << std::endl;
     TICK("query_reweight_vocabulary");
-    result_type reweighted_paths = reweight_query(query_cloud, features, sift_features, sift_keypoints, nbr_query, vt, retrieved_paths, vocabulary_path, summary);
+    result_type reweighted_paths = reweight_query(query_cloud, features, sift_features, sift_keypoints, nbr_query, vt, retrieved_paths,
+                                                  candidate_sift_features, vocabulary_path, summary);
     TOCK("query_reweight_vocabulary");
 
     return std::make_pair(retrieved_paths, reweighted_paths);
@@ -438,6 +436,15 @@ query_reweight_vocabulary(VocabularyT& vt, CloudT::Ptr& query_cloud, cv::Mat& qu
         std::cout << "Mean leaves: " << vt.get_mean_leaf_points() << std::endl;
     }
 
+    // the sift features of the query image do not depend on the vocabulary results,
+    // so they are extracted while we compute the query features and query the vocabulary
+    std::future<std::pair<SiftCloudT::Ptr, CloudT::Ptr> > query_sift;
+    if (do_reweighting) {
+        query_sift = std::async(std::launch::async, [&]() {
+            return extract_sift::extract_sift_for_image(query_image, query_depth, K);
+        });
+    }
+
     std::cout << "Computing query features..." << std::endl;
     TICK("compute_query_features");
     HistCloudT::Ptr features(new HistCloudT);
@@ -458,17 +465,24 @@ query_reweight_vocabulary(VocabularyT& vt, CloudT::Ptr& query_cloud, cv::Mat& qu
 
     TOCK("query_vocabulary");
 
-    std::cout << "Computing sift features for query..." << std::endl;
+    // load the sift features of the candidates while waiting for the query ones
+    std::future<candidate_sift_type> candidate_sift = std::async(std::launch::async, [&]() {
+        return load_candidate_sift(retrieved_paths);
+    });
+
+    std::cout << "Waiting for sift features of query..." << std::endl;
     TICK("extract_sift_features");
     SiftCloudT::Ptr sift_features;
     CloudT::Ptr sift_keypoints;
-    tie(sift_features, sift_keypoints) = extract_sift::extract_sift_for_image(query_image, query_depth, K);
+    tie(sift_features, sift_keypoints) = query_sift.get();
+    candidate_sift_type candidate_sift_features = candidate_sift.get();
     TOCK("extract_sift_features");
 
     std::cout << "Reweighting and querying..." << std::endl;
     std::cout << "Number of query sift features: " << sift_features->size() << std::endl;
     TICK("query_reweight_vocabulary");
-    result_type reweighted_paths = reweight_query(query_cloud, features, sift_features, sift_keypoints, nbr_query, vt, retrieved_paths, vocabulary_path, summary);
+    result_type reweighted_paths = reweight_query(query_cloud, features, sift_features, sift_keypoints, nbr_query, vt, retrieved_paths,
+                                                  candidate_sift_features, vocabulary_path, summary);
     TOCK("query_reweight_vocabulary");
 
     return std::make_pair(retrieved_paths, reweighted_paths);
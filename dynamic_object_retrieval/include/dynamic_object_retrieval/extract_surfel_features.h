@@ -4,6 +4,11 @@
 #include "dynamic_object_retrieval/definitions.h"
 #include "dynamic_object_retrieval/surfel_type.h"
 #include <opencv2/core/core.hpp>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
 
 using PointT = pcl::PointXYZRGB;
 using CloudT = pcl::PointCloud<PointT>;
@@ -16,14 +21,48 @@ using SurfelCloudT = pcl::PointCloud<SurfelT>;
 
 namespace dynamic_object_retrieval {
 
+// nearest surfel lookup for the points of a sweep, build it once per sweep
+// and share it between the segments. the surfels are hashed into voxels so
+// that finding the nearest surfel of a point only looks at the 27 voxels
+// around it. points that have no surfel within one voxel fall back to a
+// kd-tree over the whole map, which is only built if it is ever needed
+class surfel_normal_index {
+protected:
+
+    SurfelCloudT::Ptr surfel_map;
+    float voxel_size;
+    std::vector<uint32_t> sorted_indices; // surfel indices sorted by voxel
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t> > voxels; // range in sorted_indices
+
+    mutable std::once_flag kdtree_flag;
+    mutable pcl::KdTreeFLANN<SurfelT> kdtree;
+
+    uint64_t voxel_key(int x, int y, int z) const;
+    int nearest_surfel(const PointT& p) const;
+
+public:
+
+    NormalCloudT::Ptr compute_normals(const CloudT& segment) const;
+    const SurfelCloudT::Ptr& get_surfel_map() const { return surfel_map; }
+
+    explicit surfel_normal_index(const SurfelCloudT::Ptr& surfel_map, float voxel_size = 0.02f);
+};
+
 void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud,
                       NormalCloudT::Ptr& normals, bool do_visualize = false, bool is_query = false);
+// the overloads taking the surfel map build a new index on every call, when
+// computing several segments of the same sweep, build one index and pass that
 void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
                       CloudT::Ptr& cloud, SurfelCloudT::Ptr& surfel_map, bool visualize_features = false);
+void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
+                      CloudT::Ptr& cloud, const surfel_normal_index& surfel_index, bool visualize_features = false);
 void compute_query_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
                             CloudT::Ptr& cloud, SurfelCloudT::Ptr& surfel_map, bool visualize_features = false);
+void compute_query_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
+                            CloudT::Ptr& cloud, const surfel_normal_index& surfel_index, bool visualize_features = false);
 float compute_cloud_volume_features(CloudT::Ptr& cloud);
 NormalCloudT::Ptr compute_surfel_normals(SurfelCloudT::Ptr& surfel_cloud, CloudT::Ptr& segment);
+NormalCloudT::Ptr compute_surfel_normals(const surfel_normal_index& surfel_index, CloudT::Ptr& segment);
 /*
 std::pair<CloudT::Ptr, NormalCloudT::Ptr>
 cloud_normals_from_surfel_mask(SurfelCloudT::Ptr& surfel_cloud, const cv::Mat& mask,
@@ -0,0 +1,422 @@
+#ifndef FEATURE_STORE_H
+#define FEATURE_STORE_H
+
+/*
+ *  The feature store keeps the pfhrgbfeature and pfhrgbkeypoint clouds of
+ * all segments of a data set in one file, e.g. convex_segments_features.store
+ * next to the segments summary, instead of two pcd files per segment.
+ * The segments are appended one after the other in the order of the segment
+ * iterators, each one as a column of descriptors followed by a column of
+ * keypoints. The file ends with a table of the sweeps and segment offsets.
+ *
+ * The descriptors can be kept as float, half floats or 8 bit codes with one
+ * scale per descriptor. The inf rows of segments without features are kept
+ * as an inf scale with 8 bit codes. The reader maps the file into memory, so float
+ * descriptors are read directly from the mapping. Since the segments are
+ * stored in iteration order, iterating over all of the segments of a data
+ * set is one sequential read of the file.
+ *
+ * The store is built from the pcd files with dynamic_build_feature_store and
+ * removed whenever the features are extracted again. It also keeps the version
+ * of the segments summary of every sweep, sweeps that have been segmented
+ * again since are read from the pcd files.
+ */
+
+#include "dynamic_object_retrieval/definitions.h"
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <boost/filesystem.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace dynamic_object_retrieval {
+
+enum feature_store_encoding { float32_encoding = 0, float16_encoding = 1, uint8_encoding = 2 };
+
+inline boost::filesystem::path feature_store_path(const boost::filesystem::path& data_path, const std::string& folder_name)
+{
+    return data_path / (folder_name + "_features.store");
+}
+
+// half floats with round to nearest even, denormals included
+inline uint16_t float_to_half(float value)
+{
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000;
+    f &= 0x7fffffff;
+    if (f >= 0x7f800000) { // inf or nan
+        return sign | 0x7c00 | (f > 0x7f800000? 0x200 : 0);
+    }
+    if (f >= 0x477ff000) { // overflows to inf after rounding
+        return sign | 0x7c00;
+    }
+    if (f < 0x38800000) { // denormal or zero in half precision
+        float abs_value;
+        std::memcpy(&abs_value, &f, sizeof(f));
+        return sign | uint16_t(std::nearbyint(abs_value * 16777216.0f)); // 2^24
+    }
+    uint32_t rounded = f + 0xfff + ((f >> 13) & 1);
+    return sign | uint16_t((rounded - 0x38000000) >> 13);
+}
+
+inline float half_to_float(uint16_t value)
+{
+    uint32_t sign = uint32_t(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    if (exponent == 0) {
+        float abs_value = float(mantissa) / 16777216.0f;
+        return sign? -abs_value : abs_value;
+    }
+    uint32_t f = sign | (exponent == 31? 0x7f800000 | (mantissa << 13) : ((exponent + 112) << 23) | (mantissa << 13));
+    float result;
+    std::memcpy(&result, &f, sizeof(f));
+    return result;
+}
+
+struct feature_store_table {
+
+    int32_t encoding;
+    int32_t dims;
+    std::vector<std::string> sweep_paths;
+    std::vector<uint64_t> sweep_offsets; // the segments of sweep i are [sweep_offsets[i], sweep_offsets[i+1])
+    std::vector<int64_t> sweep_versions; // summary_version of the segments summaries when the store was built
+    std::vector<uint64_t> segment_offsets; // file offsets of the segment blocks
+    std::vector<uint32_t> segment_sizes; // number of features in the segments
+
+    static const uint64_t magic = 0x3252545346524f44; // "DORFSTR2"
+
+    // the columns are padded so that all of them are aligned in the mapping
+    static size_t padded(size_t bytes) { return (bytes + 15) & ~size_t(15); }
+
+    size_t descriptor_bytes(size_t nbr_features) const
+    {
+        switch (encoding) {
+        case float16_encoding: return padded(nbr_features*dims*sizeof(uint16_t));
+        case uint8_encoding: return padded(nbr_features*sizeof(float)) + padded(nbr_features*dims);
+        default: return padded(nbr_features*dims*sizeof(float));
+        }
+    }
+
+    size_t block_bytes(size_t nbr_features) const
+    {
+        return descriptor_bytes(nbr_features) + padded(4*nbr_features*sizeof(float));
+    }
+
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+        archive(encoding, dims, sweep_paths, sweep_offsets, sweep_versions, segment_offsets, segment_sizes);
+    }
+
+    feature_store_table() : encoding(float32_encoding), dims(N), sweep_offsets(1, 0) {}
+};
+
+// the features of one segment in the mapped store
+struct feature_span {
+
+    const feature_store_table* table;
+    const char* data;
+    size_t size;
+
+    const char* descriptor_data() const { return table->encoding == uint8_encoding? data + feature_store_table::padded(size*sizeof(float)) : data; }
+    const float* scales() const { return reinterpret_cast<const float*>(data); } // only with 8 bit codes
+    const float* keypoints() const { return reinterpret_cast<const float*>(data + table->descriptor_bytes(size)); } // x, y, z and rgb of the features
+
+    // the descriptors without copying, only if they are stored as floats
+    const float* floats() const { return table->encoding == float32_encoding? reinterpret_cast<const float*>(data) : NULL; }
+
+    void decode(float* descriptor, size_t i) const
+    {
+        size_t dims = table->dims;
+        if (table->encoding == float32_encoding) {
+            std::copy(floats() + i*dims, floats() + (i+1)*dims, descriptor);
+        }
+        else if (table->encoding == float16_encoding) {
+            const uint16_t* halfs = reinterpret_cast<const uint16_t*>(data) + i*dims;
+            for (size_t j = 0; j < dims; ++j) {
+                descriptor[j] = half_to_float(halfs[j]);
+            }
+        }
+        else {
+            const uint8_t* codes = reinterpret_cast<const uint8_t*>(descriptor_data()) + i*dims;
+            float scale = scales()[i];
+            if (std::isinf(scale)) { // the codes are 0, so the scale would give nan
+                std::fill(descriptor, descriptor + dims, std::numeric_limits<float>::infinity());
+                return;
+            }
+            for (size_t j = 0; j < dims; ++j) {
+                descriptor[j] = scale*float(codes[j]);
+            }
+        }
+    }
+};
+
+class feature_store {
+protected:
+
+    feature_store_table table;
+    std::unordered_map<std::string, size_t> sweep_ids;
+    int fd;
+    const char* mapping;
+    size_t mapping_size;
+
+public:
+
+    size_t nbr_sweeps() const { return table.sweep_paths.size(); }
+    size_t nbr_segments() const { return table.segment_sizes.size(); }
+    size_t nbr_sweep_segments(size_t sweep_id) const { return table.sweep_offsets[sweep_id+1] - table.sweep_offsets[sweep_id]; }
+    size_t sweep_segment(size_t sweep_id, size_t segment_id) const { return table.sweep_offsets[sweep_id] + segment_id; }
+    int64_t sweep_version(size_t sweep_id) const { return table.sweep_versions[sweep_id]; }
+    const feature_store_table& get_table() const { return table; }
+
+    // returns -1 if the sweep is not in the store
+    int find_sweep(const boost::filesystem::path& sweep_path) const
+    {
+        auto iter = sweep_ids.find(sweep_path.string());
+        return iter == sweep_ids.end()? -1 : int(iter->second);
+    }
+
+    feature_span get_segment(size_t segment_id) const
+    {
+        feature_span span;
+        span.table = &table;
+        span.data = mapping + table.segment_offsets[segment_id];
+        span.size = table.segment_sizes[segment_id];
+        return span;
+    }
+
+    void get_cloud(pcl::PointCloud<pcl::Histogram<N> >& features, size_t segment_id) const
+    {
+        feature_span span = get_segment(segment_id);
+        features.resize(span.size);
+        for (size_t i = 0; i < span.size; ++i) {
+            span.decode(features.points[i].histogram, i);
+        }
+    }
+
+    void get_cloud(pcl::PointCloud<pcl::PointXYZRGB>& keypoints, size_t segment_id) const
+    {
+        feature_span span = get_segment(segment_id);
+        keypoints.resize(span.size);
+        const float* values = span.keypoints();
+        for (size_t i = 0; i < span.size; ++i) {
+            keypoints.points[i].getVector3fMap() = Eigen::Map<const Eigen::Vector3f>(values + 4*i);
+            keypoints.points[i].rgb = values[4*i+3];
+        }
+    }
+
+    // tell the kernel that we will read the segments in order
+    void advise_sequential() const
+    {
+        madvise(const_cast<char*>(mapping), mapping_size, MADV_SEQUENTIAL);
+    }
+
+    bool open(const boost::filesystem::path& store_path)
+    {
+        fd = ::open(store_path.string().c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat file_stat;
+        fstat(fd, &file_stat);
+        mapping_size = file_stat.st_size;
+        uint64_t footer[2];
+        if (mapping_size < sizeof(footer)) {
+            return false;
+        }
+        void* ptr = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        mapping = static_cast<const char*>(ptr);
+
+        // the footer is the offset of the table and the magic number
+        std::memcpy(footer, mapping + mapping_size - sizeof(footer), sizeof(footer));
+        if (footer[1] != feature_store_table::magic || footer[0] > mapping_size - sizeof(footer)) {
+            std::cout << store_path.string() << " is not a complete feature store..." << std::endl;
+            return false;
+        }
+        std::ifstream in(store_path.string(), std::ios::binary);
+        in.seekg(footer[0]);
+        {
+            cereal::BinaryInputArchive archive_i(in);
+            archive_i(table);
+        }
+        for (size_t i = 0; i < table.sweep_paths.size(); ++i) {
+            sweep_ids[table.sweep_paths[i]] = i;
+        }
+        return true;
+    }
+
+    feature_store() : fd(-1), mapping(NULL), mapping_size(0) {}
+    feature_store(const feature_store&) = delete;
+    feature_store& operator=(const feature_store&) = delete;
+
+    ~feature_store()
+    {
+        if (mapping != NULL) {
+            munmap(const_cast<char*>(mapping), mapping_size);
+        }
+        if (fd != -1) {
+            ::close(fd);
+        }
+    }
+};
+
+// writes the segments to a new store, the table is written on close
+class feature_store_writer {
+protected:
+
+    boost::filesystem::path store_path;
+    feature_store_table table;
+    std::ofstream out;
+    uint64_t position;
+
+public:
+
+    const feature_store_table& get_table() const { return table; }
+
+    // version is the summary_version of the segments summary of the sweep
+    void add_sweep(const boost::filesystem::path& sweep_path, int64_t version)
+    {
+        table.sweep_paths.push_back(sweep_path.string());
+        table.sweep_offsets.push_back(table.sweep_offsets.back());
+        table.sweep_versions.push_back(version);
+    }
+
+    void add_segment(const pcl::PointCloud<pcl::Histogram<N> >& features, const pcl::PointCloud<pcl::PointXYZRGB>& keypoints)
+    {
+        if (features.size() != keypoints.size()) {
+            std::cout << "The segment has " << features.size() << " features but " << keypoints.size() << " keypoints..." << std::endl;
+            exit(-1);
+        }
+        size_t nbr_features = features.size();
+        std::vector<char> block(table.block_bytes(nbr_features), 0);
+
+        if (table.encoding == float32_encoding) {
+            float* descriptors = reinterpret_cast<float*>(block.data());
+            for (size_t i = 0; i < nbr_features; ++i) {
+                std::copy(features.points[i].histogram, features.points[i].histogram + N, descriptors + i*N);
+            }
+        }
+        else if (table.encoding == float16_encoding) {
+            uint16_t* descriptors = reinterpret_cast<uint16_t*>(block.data());
+            for (size_t i = 0; i < nbr_features; ++i) {
+                for (size_t j = 0; j < N; ++j) {
+                    descriptors[i*N+j] = float_to_half(features.points[i].histogram[j]);
+                }
+            }
+        }
+        else {
+            // the pfhrgb histograms are non-negative, so the codes go from 0 to the largest bin
+            float* scales = reinterpret_cast<float*>(block.data());
+            uint8_t* codes = reinterpret_cast<uint8_t*>(block.data() + feature_store_table::padded(nbr_features*sizeof(float)));
+            for (size_t i = 0; i < nbr_features; ++i) {
+                const float* histogram = features.points[i].histogram;
+                // segments without features have one row of inf, the codes are left at 0
+                if (std::any_of(histogram, histogram + N, [](float value) { return !std::isfinite(value); })) {
+                    scales[i] = std::numeric_limits<float>::infinity();
+                    continue;
+                }
+                float max_value = *std::max_element(histogram, histogram + N);
+                scales[i] = max_value > 0.0f? max_value / 255.0f : 1.0f;
+                for (size_t j = 0; j < N; ++j) {
+                    codes[i*N+j] = uint8_t(std::min(std::max(std::round(histogram[j] / scales[i]), 0.0f), 255.0f));
+                }
+            }
+        }
+
+        float* values = reinterpret_cast<float*>(block.data() + table.descriptor_bytes(nbr_features));
+        for (size_t i = 0; i < nbr_features; ++i) {
+            Eigen::Map<Eigen::Vector3f>(values + 4*i) = keypoints.points[i].getVector3fMap();
+            values[4*i+3] = keypoints.points[i].rgb;
+        }
+
+        out.write(block.data(), block.size());
+        table.segment_offsets.push_back(position);
+        table.segment_sizes.push_back(nbr_features);
+        ++table.sweep_offsets.back();
+        position += block.size();
+    }
+
+    void close()
+    {
+        if (!out.is_open()) {
+            return;
+        }
+        uint64_t footer[2] = { position, feature_store_table::magic };
+        {
+            cereal::BinaryOutputArchive archive_o(out);
+            archive_o(table);
+        }
+        out.write(reinterpret_cast<const char*>(footer), sizeof(footer));
+        out.close();
+    }
+
+    // an existing store at store_path is overwritten
+    feature_store_writer(const boost::filesystem::path& store_path, feature_store_encoding encoding) : store_path(store_path), position(0)
+    {
+        table.encoding = encoding;
+        out.open(store_path.string(), std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cout << "Could not open " << store_path.string() << " for writing..." << std::endl;
+            exit(-1);
+        }
+    }
+
+    ~feature_store_writer() { close(); }
+};
+
+// returns the store of a data set if it has one, loaded at most once per
+// version of the store and then shared within the process
+inline std::shared_ptr<const feature_store> get_feature_store(const boost::filesystem::path& data_path, const std::string& folder_name)
+{
+    static std::mutex stores_mutex;
+    static std::map<std::string, std::pair<int64_t, std::shared_ptr<const feature_store> > > stores;
+
+    std::lock_guard<std::mutex> lock(stores_mutex);
+
+    boost::filesystem::path store_path = feature_store_path(data_path, folder_name);
+    if (!boost::filesystem::exists(store_path)) {
+        return std::shared_ptr<const feature_store>();
+    }
+
+    int64_t version = int64_t(boost::filesystem::last_write_time(store_path));
+    std::pair<int64_t, std::shared_ptr<const feature_store> >& cached = stores[store_path.string()];
+    if (cached.second && cached.first == version) {
+        return cached.second;
+    }
+
+    std::shared_ptr<feature_store> store = std::make_shared<feature_store>();
+    if (!store->open(store_path)) {
+        std::cout << "Could not read " << store_path.string() << ", reading the pcd files instead" << std::endl;
+        return std::shared_ptr<const feature_store>();
+    }
+    store->advise_sequential();
+    cached = std::make_pair(version, std::shared_ptr<const feature_store>(store));
+    return cached.second;
+}
+
+} // namespace dynamic_object_retrieval
+
+#endif // FEATURE_STORE_H
@@ -0,0 +1,465 @@
+#ifndef SUMMARY_FORMAT_H
+#define SUMMARY_FORMAT_H
+
+/*
+ *  The binary format of the summaries. A summary file is a list of named
+ * fields, each one an integer, a string, a list of ints or a list of strings.
+ * A string list is an offset index followed by the bytes of the strings, so
+ * any one string can be read without reading the others. The reader maps the
+ * file into memory and only touches the fields and entries that are asked for,
+ * opening a summary does not depend on how large it is.
+ *
+ * The summaries in summary_types.h are written and read through their cereal
+ * serialize functions, so the fields have the same names as in the json files.
+ * export_json writes a binary summary as json, e.g. for debugging.
+ */
+
+#include <cereal/cereal.hpp>
+#include <cereal/archives/json.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <boost/filesystem.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dynamic_object_retrieval {
+
+enum summary_field_type : uint32_t {
+    integer_field = 0,
+    string_field = 1,
+    int_list_field = 2,
+    string_list_field = 3
+};
+
+struct summary_field {
+    uint32_t type;
+    uint32_t name_size;
+    uint64_t name_offset;
+    uint64_t offset; // the value itself for integer fields
+    uint64_t count; // length of strings, nbr of entries in lists
+};
+
+// the file starts with the magic number, the nbr of fields and the offset of the field table
+struct summary_header {
+    static const uint64_t magic = 0x59524d4d55535244; // "DRSUMMRY"
+    uint64_t file_magic;
+    uint64_t nbr_fields;
+    uint64_t fields_offset;
+};
+
+class lazy_string_list;
+
+// collects the fields of a summary and then writes them to a file
+class summary_writer {
+protected:
+
+    std::vector<summary_field> fields;
+    std::string data;
+
+    uint64_t append(const void* bytes, size_t size)
+    {
+        data.resize((data.size() + 7) & ~size_t(7), '\0'); // 8 byte aligned
+        uint64_t offset = data.size();
+        data.append(static_cast<const char*>(bytes), size);
+        return offset;
+    }
+
+    void add_field(const std::string& name, summary_field_type type, uint64_t offset, uint64_t count)
+    {
+        summary_field field;
+        field.type = type;
+        field.name_size = name.size();
+        field.name_offset = append(name.data(), name.size());
+        field.offset = offset;
+        field.count = count;
+        fields.push_back(field);
+    }
+
+    template <typename ListT>
+    void add_string_list(const std::string& name, const ListT& values)
+    {
+        std::vector<uint64_t> index(values.size() + 1, 0);
+        for (size_t i = 0; i < values.size(); ++i) {
+            index[i+1] = index[i] + values[i].size();
+        }
+        uint64_t offset = append(index.data(), index.size()*sizeof(uint64_t));
+        for (size_t i = 0; i < values.size(); ++i) {
+            data.append(values[i]);
+        }
+        add_field(name, string_list_field, offset, values.size());
+    }
+
+public:
+
+    void add(const std::string& name, int64_t value)
+    {
+        add_field(name, integer_field, uint64_t(value), 0);
+    }
+
+    void add(const std::string& name, const std::string& value)
+    {
+        add_field(name, string_field, append(value.data(), value.size()), value.size());
+    }
+
+    void add(const std::string& name, const std::vector<int>& values)
+    {
+        std::vector<int32_t> values32(values.begin(), values.end());
+        add_field(name, int_list_field, append(values32.data(), values32.size()*sizeof(int32_t)), values.size());
+    }
+
+    void add(const std::string& name, const std::vector<std::string>& values)
+    {
+        add_string_list(name, values);
+    }
+
+    void add(const std::string& name, const lazy_string_list& values);
+
+    // so that the serialize functions of the summaries can be used to write them
+    template <typename T>
+    void operator()(const cereal::NameValuePair<T>& nvp)
+    {
+        add(nvp.name, nvp.value);
+    }
+
+    template <typename T, typename... Ts>
+    void operator()(const T& head, const Ts&... tail)
+    {
+        (*this)(head);
+        (*this)(tail...);
+    }
+
+    // the summary is written to a temporary file first, so readers never see half a summary
+    void save(const boost::filesystem::path& summary_path) const
+    {
+        summary_header header;
+        header.file_magic = summary_header::magic;
+        header.nbr_fields = fields.size();
+        size_t data_end = (sizeof(header) + data.size() + 7) & ~size_t(7);
+        header.fields_offset = data_end;
+
+        boost::filesystem::path temp_path = summary_path.string() + ".tmp";
+        {
+            std::ofstream out(temp_path.string(), std::ios::binary);
+            if (!out.is_open()) {
+                std::cout << "Could not write the summary " << summary_path.string() << "..." << std::endl;
+                exit(-1);
+            }
+            // the offsets in the fields are relative to the data, which starts after the header
+            std::vector<summary_field> file_fields = fields;
+            for (summary_field& field : file_fields) {
+                field.name_offset += sizeof(header);
+                if (field.type != integer_field) {
+                    field.offset += sizeof(header);
+                }
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(data.data(), data.size());
+            out.write(std::string(data_end - sizeof(header) - data.size(), '\0').data(), data_end - sizeof(header) - data.size());
+            out.write(reinterpret_cast<const char*>(file_fields.data()), file_fields.size()*sizeof(summary_field));
+        }
+        boost::filesystem::rename(temp_path, summary_path);
+    }
+};
+
+// reads the fields of a summary file through a memory mapping
+class summary_reader {
+protected:
+
+    std::shared_ptr<const char> mapped_file; // unmapped when the last list that uses it is gone
+    const char* mapping;
+    size_t mapping_size;
+    const summary_field* fields;
+    size_t nbr_fields;
+    std::string file_name;
+
+    const summary_field& get_field(const std::string& name, summary_field_type type) const
+    {
+        const summary_field* field = find(name);
+        if (field == NULL || field->type != type) {
+            std::cout << "The summary " << file_name << " has no field " << name << " of the right type..." << std::endl;
+            exit(-1);
+        }
+        return *field;
+    }
+
+public:
+
+    class int_list {
+    protected:
+        const int32_t* values;
+        size_t count;
+    public:
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        int operator[](size_t i) const { return values[i]; }
+        int_list(const int32_t* values = NULL, size_t count = 0) : values(values), count(count) {}
+    };
+
+    class string_list {
+    protected:
+        const uint64_t* index;
+        const char* strings;
+        size_t count;
+    public:
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        std::string operator[](size_t i) const { return std::string(strings + index[i], index[i+1] - index[i]); }
+        string_list(const uint64_t* index = NULL, size_t count = 0) :
+            index(index), strings(reinterpret_cast<const char*>(index + count + 1)), count(count) {}
+    };
+
+    size_t size() const { return nbr_fields; }
+    std::string field_name(size_t i) const { return std::string(mapping + fields[i].name_offset, fields[i].name_size); }
+
+    const summary_field* find(const std::string& name) const
+    {
+        for (size_t i = 0; i < nbr_fields; ++i) {
+            if (fields[i].name_size == name.size() && std::memcmp(mapping + fields[i].name_offset, name.data(), name.size()) == 0) {
+                return &fields[i];
+            }
+        }
+        return NULL;
+    }
+
+    int64_t get_integer(const std::string& name) const
+    {
+        return int64_t(get_field(name, integer_field).offset);
+    }
+
+    std::string get_string(const std::string& name) const
+    {
+        const summary_field& field = get_field(name, string_field);
+        return std::string(mapping + field.offset, field.count);
+    }
+
+    int_list get_int_list(const std::string& name) const
+    {
+        const summary_field& field = get_field(name, int_list_field);
+        return int_list(reinterpret_cast<const int32_t*>(mapping + field.offset), field.count);
+    }
+
+    string_list get_string_list(const std::string& name) const
+    {
+        const summary_field& field = get_field(name, string_list_field);
+        return string_list(reinterpret_cast<const uint64_t*>(mapping + field.offset), field.count);
+    }
+
+    // the fields that are not in the file keep their values
+    void read(const std::string& name, size_t& value) const
+    {
+        if (find(name) != NULL) {
+            value = get_integer(name);
+        }
+    }
+
+    void read(const std::string& name, std::string& value) const
+    {
+        if (find(name) != NULL) {
+            value = get_string(name);
+        }
+    }
+
+    void read(const std::string& name, std::vector<int>& values) const
+    {
+        if (find(name) != NULL) {
+            int_list list = get_int_list(name);
+            values.resize(list.size());
+            for (size_t i = 0; i < list.size(); ++i) {
+                values[i] = list[i];
+            }
+        }
+    }
+
+    void read(const std::string& name, std::vector<std::string>& values) const
+    {
+        if (find(name) != NULL) {
+            string_list list = get_string_list(name);
+            values.resize(list.size());
+            for (size_t i = 0; i < list.size(); ++i) {
+                values[i] = list[i];
+            }
+        }
+    }
+
+    // the strings are not copied, the list keeps the file mapped instead
+    void read(const std::string& name, lazy_string_list& values) const;
+
+    // so that the serialize functions of the summaries can be used to read them
+    template <typename T>
+    void operator()(const cereal::NameValuePair<T>& nvp) const
+    {
+        read(nvp.name, nvp.value);
+    }
+
+    template <typename T, typename... Ts>
+    void operator()(const T& head, const Ts&... tail) const
+    {
+        (*this)(head);
+        (*this)(tail...);
+    }
+
+    // writes all of the fields in the same layout as the json summaries, so the
+    // exported file can also be loaded as a json summary
+    void export_json(std::ostream& out) const
+    {
+        cereal::JSONOutputArchive archive_o(out);
+        archive_o.setNextName("value0");
+        archive_o.startNode();
+        for (size_t i = 0; i < nbr_fields; ++i) {
+            std::string name = field_name(i);
+            switch (fields[i].type) {
+            case integer_field: {
+                int64_t value = get_integer(name);
+                archive_o(cereal::make_nvp(name.c_str(), value));
+                break;
+            }
+            case string_field: {
+                std::string value = get_string(name);
+                archive_o(cereal::make_nvp(name.c_str(), value));
+                break;
+            }
+            case int_list_field: {
+                std::vector<int> values;
+                read(name, values);
+                archive_o(cereal::make_nvp(name.c_str(), values));
+                break;
+            }
+            case string_list_field: {
+                std::vector<std::string> values;
+                read(name, values);
+                archive_o(cereal::make_nvp(name.c_str(), values));
+                break;
+            }
+            }
+        }
+        archive_o.finishNode();
+    }
+
+    bool open(const boost::filesystem::path& summary_path)
+    {
+        file_name = summary_path.string();
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat file_stat;
+        fstat(fd, &file_stat);
+        size_t file_size = file_stat.st_size;
+        summary_header header;
+        if (file_size < sizeof(header)) {
+            std::cout << file_name << " is not a summary..." << std::endl;
+            ::close(fd);
+            return false;
+        }
+        void* ptr = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // the mapping stays valid
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        mapped_file = std::shared_ptr<const char>(static_cast<const char*>(ptr), [file_size](const char* p) {
+            munmap(const_cast<char*>(p), file_size);
+        });
+        mapping = mapped_file.get();
+        mapping_size = file_size;
+
+        std::memcpy(&header, mapping, sizeof(header));
+        if (header.file_magic != summary_header::magic ||
+                header.fields_offset + header.nbr_fields*sizeof(summary_field) > mapping_size) {
+            std::cout << file_name << " is not a summary..." << std::endl;
+            return false;
+        }
+        fields = reinterpret_cast<const summary_field*>(mapping + header.fields_offset);
+        nbr_fields = header.nbr_fields;
+        return true;
+    }
+
+    const std::shared_ptr<const char>& get_mapped_file() const { return mapped_file; }
+
+    summary_reader() : mapping(NULL), mapping_size(0), fields(NULL), nbr_fields(0) {}
+    summary_reader(const summary_reader&) = delete;
+    summary_reader& operator=(const summary_reader&) = delete;
+};
+
+// a list of strings that are read from a summary file when they are asked for. strings
+// that are added after loading are kept in memory, after the ones from the file
+class lazy_string_list {
+protected:
+
+    std::shared_ptr<const char> mapped_file;
+    summary_reader::string_list mapped;
+    std::vector<std::string> appended;
+
+public:
+
+    size_t size() const { return mapped.size() + appended.size(); }
+    bool empty() const { return size() == 0; }
+    std::string operator[](size_t i) const { return i < mapped.size()? mapped[i] : appended[i - mapped.size()]; }
+
+    void clear()
+    {
+        mapped_file.reset();
+        mapped = summary_reader::string_list();
+        appended.clear();
+    }
+
+    void push_back(const std::string& value) { appended.push_back(value); }
+
+    template <typename Iterator>
+    void append(Iterator first, Iterator last) { appended.insert(appended.end(), first, last); }
+
+    void assign(const std::shared_ptr<const char>& file, const summary_reader::string_list& list)
+    {
+        clear();
+        mapped_file = file;
+        mapped = list;
+    }
+};
+
+inline void summary_writer::add(const std::string& name, const lazy_string_list& values)
+{
+    add_string_list(name, values);
+}
+
+inline void summary_reader::read(const std::string& name, lazy_string_list& values) const
+{
+    if (find(name) != NULL) {
+        values.assign(mapped_file, get_string_list(name));
+    }
+}
+
+// same layout as std::vector<std::string>, so the json summaries do not change
+template <class Archive>
+void save(Archive& archive, const lazy_string_list& values)
+{
+    archive(cereal::make_size_tag(static_cast<cereal::size_type>(values.size())));
+    for (size_t i = 0; i < values.size(); ++i) {
+        archive(values[i]);
+    }
+}
+
+template <class Archive>
+void load(Archive& archive, lazy_string_list& values)
+{
+    cereal::size_type size;
+    archive(cereal::make_size_tag(size));
+    values.clear();
+    for (size_t i = 0; i < size; ++i) {
+        std::string value;
+        archive(value);
+        values.push_back(value);
+    }
+}
+
+} // namespace dynamic_object_retrieval
+
+#endif // SUMMARY_FORMAT_H
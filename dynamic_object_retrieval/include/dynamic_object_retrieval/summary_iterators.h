@@ -5,9 +5,16 @@
 #include <boost/iterator/zip_iterator.hpp>
 #include <boost/range.hpp>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include <metaroom_xml_parser/load_utilities.h>
 
 #include "dynamic_object_retrieval/summary_types.h"
+#include "dynamic_object_retrieval/dataset_catalog.h"
+#include "dynamic_object_retrieval/feature_store.h"
 #include "dynamic_object_retrieval/definitions.h"
 
 /*
@@ -22,27 +29,15 @@ namespace dynamic_object_retrieval {
 
 inline boost::filesystem::path get_sweep_xml(size_t sweep_id, const vocabulary_summary& summary)
 {
-    static std::vector<std::string> noise_xmls;
-    static std::vector<std::string> annotated_xmls;
-
     std::cout << "Looking a sweep_id: " << sweep_id << std::endl;
     std::cout << "And number of noise sweeps: " << summary.nbr_noise_sweeps << std::endl;
     if (sweep_id < summary.nbr_noise_sweeps) {
-        if (noise_xmls.empty()) {
-            noise_xmls = semantic_map_load_utilties::getSweepXmls<PointT>(summary.noise_data_path);
-        }
-        return boost::filesystem::path(noise_xmls[sweep_id]).parent_path();
+        return boost::filesystem::path(get_dataset_catalog(summary.noise_data_path)->sweep_paths[sweep_id]);
     }
     else {
-        if (annotated_xmls.empty()) {
-            annotated_xmls = semantic_map_load_utilties::getSweepXmls<PointT>(summary.annotated_data_path);
-        }
         sweep_id -= summary.nbr_noise_sweeps;
-        return boost::filesystem::path(annotated_xmls[sweep_id]).parent_path();
+        return boost::filesystem::path(get_dataset_catalog(summary.annotated_data_path)->sweep_paths[sweep_id]);
     }
-    //std::cout << "Number of xmls: " << xmls.size() << std::endl;
-    //std::cout << "Index: " << sweep_id << std::endl;
-    //return boost::filesystem::path(xmls[sweep_id]).parent_path();
 }
 
 struct segment_iterator_base {
@@ -216,6 +211,39 @@ struct sweep_segment_index_iterator : public segment_iterator_base, public std::
     sweep_segment_index_iterator() : segment_iterator_base() {}
 };
 
+// reads the cloud of a segment from the feature store if the sweep is in it, otherwise from the pcd file
+template <typename CloudT>
+void load_segment_cloud(CloudT& cloud, const boost::filesystem::path& segments_path, const std::string& segment_name,
+                        size_t segment, const feature_store* store, int store_sweep)
+{
+    if (store != NULL && store_sweep != -1) {
+        store->get_cloud(cloud, store->sweep_segment(store_sweep, segment));
+        return;
+    }
+    std::stringstream ss;
+    ss << segment_name << std::setw(4) << std::setfill('0') << segment;
+    boost::filesystem::path cloud_path = segments_path / (ss.str() + ".pcd");
+    pcl::io::loadPCDFile(cloud_path.string(), cloud);
+}
+
+// the sweep of the store to read a sweep from, or -1 for sweeps that are not
+// in the store or have been segmented again since the store was built
+inline int find_store_sweep(const feature_store* store, const boost::filesystem::path& segments_path, size_t nbr_segments)
+{
+    if (store == NULL) {
+        return -1;
+    }
+    int store_sweep = store->find_sweep(segments_path.parent_path());
+    if (store_sweep == -1) {
+        return -1;
+    }
+    if (store->nbr_sweep_segments(store_sweep) != nbr_segments ||
+        store->sweep_version(store_sweep) != summary_version(segments_path, "segments")) {
+        return -1;
+    }
+    return store_sweep;
+}
+
 template <typename CloudT>
 struct segment_cloud_iterator : public segment_iterator_base, public std::iterator<std::forward_iterator_tag, typename CloudT::Ptr> {
 
@@ -223,25 +251,204 @@ struct segment_cloud_iterator : public segment_iterator_base, public std::iterat
 
     mutable CloudPtrT current_value;
 
+    // if the data set has a feature store, the features and keypoints are read from there
+    std::shared_ptr<const feature_store> store;
+    mutable size_t store_xml_pos;
+    mutable int store_sweep;
+
     CloudPtrT& operator* () const
     {
-        std::stringstream ss;
-        ss << segment_name << std::setw(4) << std::setfill('0') << current_segment;
-        boost::filesystem::path cloud_path = current_path / (ss.str() + ".pcd");
-        pcl::io::loadPCDFile(cloud_path.string(), *current_value);
+        if (store && store_xml_pos != xml_pos) {
+            store_xml_pos = xml_pos;
+            store_sweep = find_store_sweep(store.get(), current_path, current_nbr_segments);
+        }
+        load_segment_cloud(*current_value, current_path, segment_name, current_segment, store.get(), store_sweep);
         return current_value;
     }
 
     segment_cloud_iterator(const std::vector<std::string>& xmls,
                            const std::string& folder_name,
-                           const std::string& segment_name) :
-        segment_iterator_base(xmls, folder_name, segment_name), current_value(new CloudT)
+                           const std::string& segment_name,
+                           const std::shared_ptr<const feature_store>& store = std::shared_ptr<const feature_store>()) :
+        segment_iterator_base(xmls, folder_name, segment_name), current_value(new CloudT),
+        store(store), store_xml_pos(-1), store_sweep(-1)
     {
 
     }
     segment_cloud_iterator() : segment_iterator_base() {}
 };
 
+// loads the clouds of the segments ahead of the consumer in background threads.
+// one thread reads the summaries of the sweeps and queues the segments in order,
+// the loading threads then fill in the clouds. at most nbr_prefetch segments are
+// queued at a time, so the memory use is bounded
+template <typename CloudT>
+class segment_prefetcher {
+public:
+
+    using CloudPtrT = typename CloudT::Ptr;
+
+    struct slot {
+        boost::filesystem::path segments_path;
+        size_t segment;
+        int store_sweep;
+        bool loading;
+        bool ready;
+        CloudPtrT cloud;
+    };
+
+protected:
+
+    std::vector<std::string> folder_xmls;
+    std::string folder_name;
+    std::string segment_name;
+    std::shared_ptr<const feature_store> store;
+    size_t nbr_prefetch;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::deque<std::shared_ptr<slot> > queue;
+    bool planned; // all of the segments have been queued
+    bool stopping;
+    std::vector<std::thread> threads;
+
+    void plan_segments()
+    {
+        for (const std::string& xml : folder_xmls) {
+            boost::filesystem::path segments_path = boost::filesystem::path(xml).parent_path() / folder_name;
+            sweep_summary summary;
+            summary.load(segments_path);
+            int store_sweep = find_store_sweep(store.get(), segments_path, summary.nbr_segments);
+            for (size_t i = 0; i < summary.nbr_segments; ++i) {
+                std::shared_ptr<slot> s = std::make_shared<slot>();
+                s->segments_path = segments_path;
+                s->segment = i;
+                s->store_sweep = store_sweep;
+                s->loading = false;
+                s->ready = false;
+                s->cloud = CloudPtrT(new CloudT);
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_changed.wait(lock, [this] { return stopping || queue.size() < nbr_prefetch; });
+                if (stopping) {
+                    return;
+                }
+                queue.push_back(s);
+                queue_changed.notify_all();
+            }
+        }
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        planned = true;
+        queue_changed.notify_all();
+    }
+
+    std::shared_ptr<slot> next_to_load()
+    {
+        for (std::shared_ptr<slot>& s : queue) {
+            if (!s->loading) {
+                return s;
+            }
+        }
+        return std::shared_ptr<slot>();
+    }
+
+    void load_segments()
+    {
+        while (true) {
+            std::shared_ptr<slot> s;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_changed.wait(lock, [&] { return stopping || planned || (s = next_to_load()); });
+                if (!s) {
+                    s = next_to_load();
+                }
+                if (!s) { // stopping, or planned and everything is loading
+                    return;
+                }
+                s->loading = true;
+            }
+            load_segment_cloud(*s->cloud, s->segments_path, segment_name, s->segment, store.get(), s->store_sweep);
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            s->ready = true;
+            queue_changed.notify_all();
+        }
+    }
+
+public:
+
+    // returns the next segment in order, or an empty pointer when there are no more segments
+    std::shared_ptr<slot> next()
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_changed.wait(lock, [this] { return (!queue.empty() && queue.front()->ready) || (planned && queue.empty()); });
+        if (queue.empty()) {
+            return std::shared_ptr<slot>();
+        }
+        std::shared_ptr<slot> s = queue.front();
+        queue.pop_front();
+        queue_changed.notify_all();
+        return s;
+    }
+
+    segment_prefetcher(const std::vector<std::string>& xmls, const std::string& folder_name, const std::string& segment_name,
+                       const std::shared_ptr<const feature_store>& store, size_t nbr_prefetch, size_t nbr_threads) :
+        folder_xmls(xmls), folder_name(folder_name), segment_name(segment_name), store(store),
+        nbr_prefetch(std::max(nbr_prefetch, size_t(1))), planned(false), stopping(false)
+    {
+        threads.push_back(std::thread(&segment_prefetcher::plan_segments, this));
+        for (size_t i = 0; i < std::max(nbr_threads, size_t(1)); ++i) {
+            threads.push_back(std::thread(&segment_prefetcher::load_segments, this));
+        }
+    }
+
+    ~segment_prefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+            queue_changed.notify_all();
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+};
+
+// same values as segment_cloud_iterator, but the clouds are loaded ahead in the background.
+// the copies of an iterator share the prefetcher, so only one of them should be incremented
+template <typename CloudT>
+struct prefetching_segment_cloud_iterator : public std::iterator<std::forward_iterator_tag, typename CloudT::Ptr> {
+
+    using CloudPtrT = typename CloudT::Ptr;
+    using prefetcher_type = segment_prefetcher<CloudT>;
+
+    std::shared_ptr<prefetcher_type> prefetcher;
+    std::shared_ptr<typename prefetcher_type::slot> current;
+
+    bool operator!= (const prefetching_segment_cloud_iterator& other) const { return current.get() != NULL; }
+    bool operator== (const prefetching_segment_cloud_iterator& other) const { return current.get() == NULL; }
+
+    CloudPtrT& operator* () const
+    {
+        return current->cloud;
+    }
+
+    void operator++ ()
+    {
+        current = prefetcher->next();
+    }
+
+    prefetching_segment_cloud_iterator(const std::vector<std::string>& xmls,
+                                       const std::string& folder_name,
+                                       const std::string& segment_name,
+                                       const std::shared_ptr<const feature_store>& store,
+                                       size_t nbr_prefetch, size_t nbr_threads) :
+        prefetcher(std::make_shared<prefetcher_type>(xmls, folder_name, segment_name, store, nbr_prefetch, nbr_threads))
+    {
+        current = prefetcher->next();
+    }
+    prefetching_segment_cloud_iterator() {} // for the end() method
+};
+
 struct islast_segment_iterator : public segment_iterator_base, public std::iterator<std::forward_iterator_tag, bool> {
 
     mutable bool current_value;
@@ -393,7 +600,8 @@ struct convex_feature_cloud_map {
 
     iterator begin()
     {
-        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "convex_segments", "pfhrgbfeature");
+        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "convex_segments", "pfhrgbfeature",
+                        get_feature_store(data_path, "convex_segments"));
     }
 
     iterator end()
@@ -412,7 +620,8 @@ struct convex_keypoint_cloud_map {
 
     iterator begin()
     {
-        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "convex_segments", "pfhrgbkeypoint");
+        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "convex_segments", "pfhrgbkeypoint",
+                        get_feature_store(data_path, "convex_segments"));
     }
 
     iterator end()
@@ -571,7 +780,8 @@ struct subsegment_feature_cloud_map {
 
     iterator begin()
     {
-        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "subsegments", "pfhrgbfeature");
+        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "subsegments", "pfhrgbfeature",
+                        get_feature_store(data_path, "subsegments"));
     }
 
     iterator end()
@@ -590,7 +800,8 @@ struct subsegment_keypoint_cloud_map {
 
     iterator begin()
     {
-        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "subsegments", "pfhrgbkeypoint");
+        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), "subsegments", "pfhrgbkeypoint",
+                        get_feature_store(data_path, "subsegments"));
     }
 
     iterator end()
@@ -601,6 +812,70 @@ struct subsegment_keypoint_cloud_map {
     subsegment_keypoint_cloud_map(const boost::filesystem::path& data_path) : data_path(data_path) {}
 };
 
+// prefetching variants of the cloud maps, for long passes over a data set where
+// the loading should overlap with the processing, e.g. when training a vocabulary
+
+template <typename CloudT>
+struct prefetching_cloud_map {
+
+    using iterator = prefetching_segment_cloud_iterator<CloudT>;
+
+    boost::filesystem::path data_path;
+    std::string folder_name;
+    std::string segment_name;
+    size_t nbr_prefetch;
+    size_t nbr_threads;
+
+    iterator begin()
+    {
+        std::shared_ptr<const feature_store> store;
+        if (segment_name != "segment") {
+            store = get_feature_store(data_path, folder_name);
+        }
+        return iterator(semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string()), folder_name, segment_name,
+                        store, nbr_prefetch, nbr_threads);
+    }
+
+    iterator end()
+    {
+        return iterator();
+    }
+
+    prefetching_cloud_map(const boost::filesystem::path& data_path, const std::string& folder_name, const std::string& segment_name,
+                          size_t nbr_prefetch, size_t nbr_threads) :
+        data_path(data_path), folder_name(folder_name), segment_name(segment_name), nbr_prefetch(nbr_prefetch), nbr_threads(nbr_threads) {}
+};
+
+struct prefetching_convex_segment_cloud_map : public prefetching_cloud_map<pcl::PointCloud<PointT> > {
+    prefetching_convex_segment_cloud_map(const boost::filesystem::path& data_path, size_t nbr_prefetch = 32, size_t nbr_threads = 2) :
+        prefetching_cloud_map(data_path, "convex_segments", "segment", nbr_prefetch, nbr_threads) {}
+};
+
+struct prefetching_convex_feature_cloud_map : public prefetching_cloud_map<pcl::PointCloud<HistT> > {
+    prefetching_convex_feature_cloud_map(const boost::filesystem::path& data_path, size_t nbr_prefetch = 32, size_t nbr_threads = 2) :
+        prefetching_cloud_map(data_path, "convex_segments", "pfhrgbfeature", nbr_prefetch, nbr_threads) {}
+};
+
+struct prefetching_convex_keypoint_cloud_map : public prefetching_cloud_map<pcl::PointCloud<PointT> > {
+    prefetching_convex_keypoint_cloud_map(const boost::filesystem::path& data_path, size_t nbr_prefetch = 32, size_t nbr_threads = 2) :
+        prefetching_cloud_map(data_path, "convex_segments", "pfhrgbkeypoint", nbr_prefetch, nbr_threads) {}
+};
+
+struct prefetching_subsegment_cloud_map : public prefetching_cloud_map<pcl::PointCloud<PointT> > {
+    prefetching_subsegment_cloud_map(const boost::filesystem::path& data_path, size_t nbr_prefetch = 32, size_t nbr_threads = 2) :
+        prefetching_cloud_map(data_path, "subsegments", "segment", nbr_prefetch, nbr_threads) {}
+};
+
+struct prefetching_subsegment_feature_cloud_map : public prefetching_cloud_map<pcl::PointCloud<HistT> > {
+    prefetching_subsegment_feature_cloud_map(const boost::filesystem::path& data_path, size_t nbr_prefetch = 32, size_t nbr_threads = 2) :
+        prefetching_cloud_map(data_path, "subsegments", "pfhrgbfeature", nbr_prefetch, nbr_threads) {}
+};
+
+struct prefetching_subsegment_keypoint_cloud_map : public prefetching_cloud_map<pcl::PointCloud<PointT> > {
+    prefetching_subsegment_keypoint_cloud_map(const boost::filesystem::path& data_path, size_t nbr_prefetch = 32, size_t nbr_threads = 2) :
+        prefetching_cloud_map(data_path, "subsegments", "pfhrgbkeypoint", nbr_prefetch, nbr_threads) {}
+};
+
 // iterators over convex segments of one sweep
 
 struct sweep_convex_segment_map {
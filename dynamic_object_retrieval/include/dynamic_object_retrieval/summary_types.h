@@ -4,9 +4,10 @@
 /*
  *  This header describes the file structures that describe the folder
  * hierarchy. The files also describe the relations between the files
- * and the vocabulary tree representation. They correspond 1:1 with
- * the json file structure and one can be translated to the other
- * with e.g. the Ceral serialization library.
+ * and the vocabulary tree representation. They are saved in the binary
+ * format of summary_format.h, e.g. as segments.bin, with the same fields
+ * as the json files of older data sets, which can still be loaded. The
+ * binary summaries can be exported to json with dynamic_export_summary.
  */
 
 // for convenience
@@ -14,12 +15,69 @@
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
 
+#include "dynamic_object_retrieval/summary_format.h"
+
 // for convenience
 #include <boost/filesystem.hpp>
 #include <fstream>
 
 namespace dynamic_object_retrieval {
 
+// the summary file that is loaded, the binary one if there is one, otherwise the json one
+inline boost::filesystem::path summary_path(const boost::filesystem::path& folder, const std::string& name)
+{
+    boost::filesystem::path binary_path = folder / (name + ".bin");
+    if (boost::filesystem::exists(binary_path)) {
+        return binary_path;
+    }
+    return folder / (name + ".json");
+}
+
+inline bool has_summary(const boost::filesystem::path& folder, const std::string& name)
+{
+    return boost::filesystem::exists(summary_path(folder, name));
+}
+
+// modification time of the summary, -1 if there is none
+inline int64_t summary_version(const boost::filesystem::path& folder, const std::string& name)
+{
+    boost::filesystem::path path = summary_path(folder, name);
+    if (!boost::filesystem::exists(path)) {
+        return -1;
+    }
+    return int64_t(boost::filesystem::last_write_time(path));
+}
+
+template <typename SummaryT>
+void load_summary(SummaryT& summary, const boost::filesystem::path& folder, const std::string& name)
+{
+    boost::filesystem::path path = summary_path(folder, name);
+    if (path.extension() == ".bin") {
+        summary_reader reader;
+        if (!reader.open(path)) {
+            std::cout << "Could not read the summary " << path.string() << "..." << std::endl;
+            exit(-1);
+        }
+        summary.serialize(reader);
+        return;
+    }
+    std::ifstream in(path.string());
+    {
+        cereal::JSONInputArchive archive_i(in);
+        archive_i(summary);
+    }
+}
+
+// a json file left from before would not be loaded any more, so it is removed
+template <typename SummaryT>
+void save_summary(const SummaryT& summary, const boost::filesystem::path& folder, const std::string& name)
+{
+    summary_writer writer;
+    const_cast<SummaryT&>(summary).serialize(writer);
+    writer.save(folder / (name + ".bin"));
+    boost::filesystem::remove(folder / (name + ".json"));
+}
+
 struct vocabulary_summary {
 
     std::string vocabulary_type; // can be either "standard" or "incremental"
@@ -42,20 +100,12 @@ struct vocabulary_summary {
 
     void load(const boost::filesystem::path& data_path)
     {
-        std::ifstream in((data_path / boost::filesystem::path("vocabulary_summary.json")).string());
-        {
-            cereal::JSONInputArchive archive_i(in);
-            archive_i(*this);
-        }
+        load_summary(*this, data_path, "vocabulary_summary");
     }
 
     void save(const boost::filesystem::path& data_path) const
     {
-        std::ofstream out((data_path / boost::filesystem::path("vocabulary_summary.json")).string());
-        {
-            cereal::JSONOutputArchive archive_o(out);
-            archive_o(*this);
-        }
+        save_summary(*this, data_path, "vocabulary_summary");
     }
 
     template <class Archive>
@@ -90,26 +140,18 @@ struct data_summary {
     size_t nbr_subsegments; // = subsegment_index_map.size() if all have been added to vt
     std::string subsegment_type; // can be either "subsegment" or "supervoxel"
 
-    // maps indices in vt to convex segment ids
-    std::vector<std::string> index_convex_segment_paths;
-    std::vector<std::string> index_subsegment_paths;
+    // maps indices in vt to convex segment ids, the paths are read when they are asked for
+    lazy_string_list index_convex_segment_paths;
+    lazy_string_list index_subsegment_paths;
 
     void load(const boost::filesystem::path& data_path)
     {
-        std::ifstream in((data_path / boost::filesystem::path("segments_summary.json")).string());
-        {
-            cereal::JSONInputArchive archive_i(in);
-            archive_i(*this);
-        }
+        load_summary(*this, data_path, "segments_summary");
     }
 
     void save(const boost::filesystem::path& data_path) const
     {
-        std::ofstream out((data_path / boost::filesystem::path("segments_summary.json")).string());
-        {
-            cereal::JSONOutputArchive archive_o(out);
-            archive_o(*this);
-        }
+        save_summary(*this, data_path, "segments_summary");
     }
 
     template <class Archive>
@@ -136,20 +178,12 @@ struct sweep_summary {
 
     void load(const boost::filesystem::path& data_path)
     {
-        std::ifstream in((data_path / boost::filesystem::path("segments.json")).string());
-        {
-            cereal::JSONInputArchive archive_i(in);
-            archive_i(*this);
-        }
+        load_summary(*this, data_path, "segments");
     }
 
     void save(const boost::filesystem::path& data_path) const
     {
-        std::ofstream out((data_path / boost::filesystem::path("segments.json")).string());
-        {
-            cereal::JSONOutputArchive archive_o(out);
-            archive_o(*this);
-        }
+        save_summary(*this, data_path, "segments");
     }
 
     template <class Archive>
@@ -0,0 +1,224 @@
+#ifndef SWEEP_READER_H
+#define SWEEP_READER_H
+
+/*
+ *  Reads the segments of a data set in one pass. The sweeps are listed once
+ * and the summary of every sweep is read once, the segment records then load
+ * the clouds, features and keypoints of a segment when they are first asked
+ * for. Use this instead of zipping several of the maps in summary_iterators.h,
+ * since each of those lists the sweeps and reads all the summaries on its own.
+ */
+
+#include "dynamic_object_retrieval/summary_iterators.h"
+
+#include <boost/filesystem.hpp>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace dynamic_object_retrieval {
+
+// one sweep of the data set, with the summary of its segment folder
+struct sweep_record {
+
+    size_t sweep_index; // in the order of getSweepXmls
+    boost::filesystem::path sweep_path;
+    boost::filesystem::path segments_path; // sweep_path / folder_name
+    sweep_summary summary;
+    std::shared_ptr<const feature_store> store;
+    int store_sweep; // -1 if the features are read from the pcd files
+
+    size_t nbr_segments() const { return summary.nbr_segments; }
+};
+
+// one segment of a sweep, the clouds are loaded on first access and then kept
+class segment_record {
+protected:
+
+    using CloudT = pcl::PointCloud<PointT>;
+    using HistCloudT = pcl::PointCloud<HistT>;
+
+    std::shared_ptr<const sweep_record> sweep;
+    size_t segment;
+
+    mutable CloudT::Ptr segment_cloud;
+    mutable HistCloudT::Ptr segment_features;
+    mutable CloudT::Ptr segment_keypoints;
+
+public:
+
+    const sweep_record& get_sweep() const { return *sweep; }
+    size_t sweep_index() const { return sweep->sweep_index; }
+    const boost::filesystem::path& sweep_path() const { return sweep->sweep_path; }
+    size_t segment_index() const { return segment; } // within the sweep
+    bool is_last() const { return segment + 1 == sweep->nbr_segments(); }
+
+    // the global index in the vocabulary, -1 if the segment has not been added
+    int vt_index() const
+    {
+        if (segment >= sweep->summary.segment_indices.size()) {
+            return -1;
+        }
+        return sweep->summary.segment_indices[segment];
+    }
+
+    // the path of one of the segment files, e.g. "segment", "pfhrgbfeature" or "pfhrgbkeypoint"
+    boost::filesystem::path segment_path(const std::string& segment_name = "segment") const
+    {
+        std::stringstream ss;
+        ss << segment_name << std::setw(4) << std::setfill('0') << segment;
+        return sweep->segments_path / (ss.str() + ".pcd");
+    }
+
+    const CloudT::Ptr& cloud() const
+    {
+        if (!segment_cloud) {
+            segment_cloud = CloudT::Ptr(new CloudT);
+            load_segment_cloud(*segment_cloud, sweep->segments_path, "segment", segment, NULL, -1);
+        }
+        return segment_cloud;
+    }
+
+    const HistCloudT::Ptr& features() const
+    {
+        if (!segment_features) {
+            segment_features = HistCloudT::Ptr(new HistCloudT);
+            load_segment_cloud(*segment_features, sweep->segments_path, "pfhrgbfeature", segment,
+                               sweep->store.get(), sweep->store_sweep);
+        }
+        return segment_features;
+    }
+
+    const CloudT::Ptr& keypoints() const
+    {
+        if (!segment_keypoints) {
+            segment_keypoints = CloudT::Ptr(new CloudT);
+            load_segment_cloud(*segment_keypoints, sweep->segments_path, "pfhrgbkeypoint", segment,
+                               sweep->store.get(), sweep->store_sweep);
+        }
+        return segment_keypoints;
+    }
+
+    segment_record(const std::shared_ptr<const sweep_record>& sweep, size_t segment) : sweep(sweep), segment(segment) {}
+    segment_record() : segment(0) {}
+};
+
+class sweep_reader {
+protected:
+
+    boost::filesystem::path data_path;
+    std::string folder_name;
+    std::vector<boost::filesystem::path> sweep_paths;
+    std::shared_ptr<const feature_store> store;
+
+public:
+
+    struct iterator : public std::iterator<std::forward_iterator_tag, segment_record> {
+
+        const sweep_reader* reader;
+        size_t sweep_pos;
+        size_t segment;
+        segment_record current;
+
+        bool operator!= (const iterator& other) const { return sweep_pos != other.sweep_pos || segment != other.segment; }
+        bool operator== (const iterator& other) const { return !(*this != other); }
+
+        const segment_record& operator* () const { return current; }
+        const segment_record* operator-> () const { return &current; }
+
+        void operator++ ()
+        {
+            ++segment;
+            if (segment >= sweep->nbr_segments()) {
+                ++sweep_pos;
+                segment = 0;
+                find_segment();
+            }
+            else {
+                current = segment_record(sweep, segment);
+            }
+        }
+
+        iterator(const sweep_reader* reader, size_t sweep_pos) : reader(reader), sweep_pos(sweep_pos), segment(0)
+        {
+            find_segment();
+        }
+
+    protected:
+
+        std::shared_ptr<const sweep_record> sweep;
+
+        // moves on to the first sweep from sweep_pos that has any segments
+        void find_segment()
+        {
+            for (; sweep_pos < reader->nbr_sweeps(); ++sweep_pos) {
+                sweep = reader->read_sweep(sweep_pos);
+                if (sweep->nbr_segments() > 0) {
+                    current = segment_record(sweep, 0);
+                    return;
+                }
+            }
+            sweep.reset();
+            current = segment_record();
+        }
+    };
+
+    size_t nbr_sweeps() const { return sweep_paths.size(); }
+    const boost::filesystem::path& get_sweep_path(size_t sweep_index) const { return sweep_paths[sweep_index]; }
+
+    // reads the summary of one sweep
+    std::shared_ptr<const sweep_record> read_sweep(size_t sweep_index) const
+    {
+        std::shared_ptr<sweep_record> sweep = std::make_shared<sweep_record>();
+        sweep->sweep_index = sweep_index;
+        sweep->sweep_path = sweep_paths[sweep_index];
+        sweep->segments_path = sweep->sweep_path / folder_name;
+        sweep->summary.load(sweep->segments_path);
+        sweep->store = store;
+        sweep->store_sweep = find_store_sweep(store.get(), sweep->segments_path, sweep->summary.nbr_segments);
+        return sweep;
+    }
+
+    // all of the segments of one sweep
+    void read_segments(std::vector<segment_record>& segments, const std::shared_ptr<const sweep_record>& sweep) const
+    {
+        segments.clear();
+        segments.reserve(sweep->nbr_segments());
+        for (size_t i = 0; i < sweep->nbr_segments(); ++i) {
+            segments.push_back(segment_record(sweep, i));
+        }
+    }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, nbr_sweeps()); }
+
+    // calls f(sweep, segments) for every sweep, with the sweeps processed in parallel.
+    // f may be called from several threads at once but only once per sweep
+    template <typename Function>
+    void for_each_sweep(Function f) const
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < int(nbr_sweeps()); ++i) {
+            std::shared_ptr<const sweep_record> sweep = read_sweep(i);
+            std::vector<segment_record> segments;
+            read_segments(segments, sweep);
+            f(*sweep, segments);
+        }
+    }
+
+    // folder_name is either "convex_segments" or "subsegments"
+    sweep_reader(const boost::filesystem::path& data_path, const std::string& folder_name) :
+        data_path(data_path), folder_name(folder_name), store(get_feature_store(data_path, folder_name))
+    {
+        std::vector<std::string> folder_xmls = semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string());
+        sweep_paths.reserve(folder_xmls.size());
+        for (const std::string& xml : folder_xmls) {
+            sweep_paths.push_back(boost::filesystem::path(xml).parent_path());
+        }
+    }
+};
+
+} // namespace dynamic_object_retrieval
+
+#endif // SWEEP_READER_H
@@ -13,15 +13,18 @@ using PointT = pcl::PointXYZRGB;
 using CloudT = pcl::PointCloud<PointT>;
 using HistT = pcl::Histogram<N>;
 using HistCloudT = pcl::PointCloud<HistT>;
+using ProjectedHistT = pcl::Histogram<PROJECTED_N>;
 
 namespace dynamic_object_retrieval {
 
 void visualize(CloudT::Ptr& cloud);
 void visualize(CloudT::Ptr& cloud, float subsample_size);
-void save_vocabulary(vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
-void load_vocabulary(vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
-void save_vocabulary(grouped_vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
-void load_vocabulary(grouped_vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+// instantiated for the vocabulary_tree and grouped_vocabulary_tree of HistT and ProjectedHistT
+template <typename VocabularyT>
+void save_vocabulary(VocabularyT& vt, const boost::filesystem::path& vocabulary_path);
+// exits if the folder has a descriptor projection and VocabularyT is not of ProjectedHistT, or the other way around
+template <typename VocabularyT>
+void load_vocabulary(VocabularyT& vt, const boost::filesystem::path& vocabulary_path);
 
 }
 
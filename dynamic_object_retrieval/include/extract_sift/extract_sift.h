@@ -5,6 +5,9 @@
 #include <pcl/point_cloud.h>
 #include <boost/filesystem.hpp>
 #include <opencv2/core/core.hpp>
+#include <object_3d_retrieval/register_objects.h>
+
+#include <memory>
 
 using PointT = pcl::PointXYZRGB;
 using CloudT = pcl::PointCloud<PointT>;
@@ -21,6 +24,25 @@ std::tuple<SiftCloudT::Ptr, CloudT::Ptr, CloudT::Ptr> get_sift_for_cloud_path(co
 std::pair<SiftCloudT::Ptr, CloudT::Ptr> get_sift_for_cloud_path(const boost::filesystem::path& cloud_path, CloudT::Ptr& cloud);
 std::tuple<SiftCloudT::Ptr, CloudT::Ptr, CloudT::Ptr> get_sift_for_cloud_path(const std::vector<boost::filesystem::path>& cloud_path);
 
+// store the sift features of every segment and subsegment of a sweep, extract_sift_for_sweep does this as well
+void save_segment_sift_for_sweep(const boost::filesystem::path& sweep_path);
+// same as get_sift_for_cloud_path but reads the stored features of the segment and does not load the cloud,
+// falls back to get_sift_for_cloud_path if the sweep does not have any stored segment features
+std::pair<SiftCloudT::Ptr, CloudT::Ptr> get_sift_for_segment_path(const boost::filesystem::path& segment_path);
+std::pair<SiftCloudT::Ptr, CloudT::Ptr> get_sift_for_segment_path(const std::vector<boost::filesystem::path>& segment_paths);
+
+// the sift features of a segment with an index of the features for registration,
+// the clouds may be shared with the segment cache and must not be modified
+struct indexed_sift {
+    SiftCloudT::Ptr features;
+    CloudT::Ptr keypoints;
+    std::shared_ptr<const sift_descriptor_index> index;
+};
+
+// same as get_sift_for_segment_path, the index of a stored segment is only built once and kept in the cache
+indexed_sift get_indexed_sift_for_segment_path(const boost::filesystem::path& segment_path);
+indexed_sift get_indexed_sift_for_segment_path(const std::vector<boost::filesystem::path>& segment_paths);
+
 } // namespace extract_sift
 
 #endif // EXTRACT_SIFT_H
@@ -0,0 +1,97 @@
+#ifndef FEATURE_PIPELINE_H
+#define FEATURE_PIPELINE_H
+
+#include "object_3d_retrieval/pfhrgb_estimation.h"
+
+#include <vector>
+
+namespace pfhrgb_estimation {
+
+// the radius neighborhoods of all the points in a cloud, computed once at the
+// largest radius used by any stage and sorted by distance. the neighborhood
+// at a smaller radius is then just a prefix of the cached one. the neighbors
+// of point i are indices[offsets[i]] to indices[offsets[i+1]], and include i
+class neighborhood_cache {
+protected:
+
+    double radius;
+    std::vector<size_t> offsets;
+    std::vector<int> indices;
+    std::vector<float> sqr_distances;
+
+    void compute(const CloudT::Ptr& cloud, const std::vector<int>& point_indices);
+
+public:
+
+    double max_radius() const { return radius; }
+    size_t size() const { return offsets.empty()? 0 : offsets.size() - 1; }
+
+    const int* neighbors_begin(int i) const { return indices.data() + offsets[i]; }
+    const int* neighbors_end(int i, double r) const;
+    size_t nbr_neighbors(int i, double r) const { return neighbors_end(i, r) - neighbors_begin(i); }
+    void get_neighbors(std::vector<int>& neighbors, int i, double r) const;
+
+    neighborhood_cache(const CloudT::Ptr& cloud, double radius);
+    // only the neighborhoods of point_indices are computed, the others are empty.
+    // the indices may not contain duplicates
+    neighborhood_cache(const CloudT::Ptr& cloud, double radius, const std::vector<int>& point_indices);
+};
+
+//  ISS3D parameters, the radii are given in multiples of the model resolution
+struct iss_parameters {
+    double salient_radius;
+    double non_max_radius;
+    double normal_radius;
+    double border_radius;
+    double gamma_21;
+    double gamma_32;
+    int min_neighbors;
+
+    iss_parameters(double model_resolution, double gamma = 0.975) :
+        salient_radius(6 * model_resolution), non_max_radius(4 * model_resolution),
+        normal_radius(4 * model_resolution), border_radius(0.5 * model_resolution), // 1
+        gamma_21(gamma), gamma_32(gamma), min_neighbors(5) {}
+};
+
+// normals, ISS keypoints and PFHRGB descriptors of one cloud,
+// all the stages get their neighborhoods from the same cache
+class feature_pipeline {
+protected:
+
+    CloudT::Ptr cloud;
+    neighborhood_cache neighborhoods;
+
+    void compute_pfhrgb_features(PfhRgbCloudT::Ptr& features, const std::vector<int>& keypoint_indices,
+                                 const NormalCloudT::Ptr& normals, const neighborhood_cache& neighborhoods,
+                                 double radius, size_t max_neighbors) const;
+
+public:
+
+    const neighborhood_cache& get_neighborhoods() const { return neighborhoods; }
+
+    NormalCloudT::Ptr compute_normals(double radius) const;
+    // returns the indices of the keypoints in the cloud, the normals are only
+    // used for removing the borders and are computed if they are not given
+    void compute_iss_keypoints(std::vector<int>& keypoint_indices, const iss_parameters& params,
+                               NormalCloudT::Ptr normals = NormalCloudT::Ptr()) const;
+    // also returns the saliency of the keypoints, max(e2/e1, e3/e2) of the scatter matrix
+    // eigenvalues. the keypoints pass any thresholds gamma_21, gamma_32 above this value
+    void compute_iss_keypoints(std::vector<int>& keypoint_indices, std::vector<float>& saliencies,
+                               const iss_parameters& params, NormalCloudT::Ptr normals = NormalCloudT::Ptr()) const;
+    // the descriptors are computed in parallel over the keypoints, if max_neighbors is
+    // set, larger neighborhoods are subsampled since the cost is quadratic in their size.
+    // if radius is larger than the cache, the neighborhoods of the keypoints are searched again
+    void compute_pfhrgb_features(PfhRgbCloudT::Ptr& features, const std::vector<int>& keypoint_indices,
+                                 const NormalCloudT::Ptr& normals, double radius, size_t max_neighbors = 0) const;
+
+    // max_radius only has to cover the normals and keypoints, which need all of the points
+    feature_pipeline(const CloudT::Ptr& cloud, double max_radius) : cloud(cloud), neighborhoods(cloud, max_radius) {}
+    // if the keypoints are already known, only their neighborhoods are needed for the
+    // descriptors. compute_normals and compute_iss_keypoints need all of the points
+    feature_pipeline(const CloudT::Ptr& cloud, double max_radius, const std::vector<int>& keypoint_indices) :
+        cloud(cloud), neighborhoods(cloud, max_radius, keypoint_indices) {}
+};
+
+}
+
+#endif // FEATURE_PIPELINE_H
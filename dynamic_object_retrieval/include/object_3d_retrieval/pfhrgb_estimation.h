@@ -4,6 +4,8 @@
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
+#include <vector>
+
 namespace pfhrgb_estimation {
 
 using PointT = pcl::PointXYZRGB;
@@ -14,6 +16,7 @@ using NormalT = pcl::Normal;
 using NormalCloudT = pcl::PointCloud<NormalT>;
 
 void visualize_keypoints(CloudT::Ptr& cloud, CloudT::Ptr& keypoints);
+void compute_uniform_keypoints(std::vector<int>& indices, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, double radius);
 void compute_query_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, bool visualize_features = false);
 void compute_regularized_query_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, bool visualize_features = false);
 void compute_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, bool visualize_features = false);
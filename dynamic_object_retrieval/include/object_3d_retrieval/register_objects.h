@@ -3,10 +3,44 @@
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
+#include <pcl/correspondence.h>
 #include <Eigen/Dense>
 #include <opencv2/opencv.hpp>
 #include <dynamic_object_retrieval/definitions.h>
 
+#include <memory>
+
+// a flann index over a cloud of sift features, the features are used in place
+// without copying. searching does not modify the index so it can be shared by
+// several registrations at the same time
+class sift_descriptor_index
+{
+public:
+
+    using SiftT = pcl::Histogram<128>;
+    using SiftCloudT = pcl::PointCloud<SiftT>;
+
+protected:
+
+    SiftCloudT::Ptr features; // keeps the memory of the descriptor view alive
+    cv::Mat descriptors;
+    std::shared_ptr<cv::flann::Index> index;
+
+public:
+
+    // a cv::Mat with one row per feature, pointing into the cloud
+    static cv::Mat descriptor_view(const SiftCloudT::Ptr& cloud);
+
+    bool empty() const { return !index; }
+    size_t size() const { return descriptors.rows; }
+    // one match per row in query_descriptors, the trainIdx refers to the indexed features
+    void match(std::vector<cv::DMatch>& matches, const cv::Mat& query_descriptors) const;
+    // only keeps the matches that are clearly closer than the second closest feature (Lowe's ratio test)
+    void match(std::vector<cv::DMatch>& matches, const cv::Mat& query_descriptors, float max_ratio) const;
+
+    explicit sift_descriptor_index(const SiftCloudT::Ptr& features);
+};
+
 class register_objects
 {
 protected:
@@ -29,23 +63,33 @@ protected:
     Eigen::Matrix3f k1;
     Eigen::Matrix3f k2;
     Eigen::Matrix4f T;
+    size_t nbr_correspondences; // sift matches in the last registration
     static float sRGB_LUT[256];
     static float sXYZ_LUT[4000];
 
 protected:
 
     void initial_alignment();
+    void estimate_transformation(pcl::CorrespondencesPtr& correspondences,
+                                 CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2);
+    size_t estimate_transformation_adaptive(std::vector<int>& inliers, const pcl::Correspondences& correspondences,
+                                            CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2);
     void RGB2CIELAB(unsigned char R, unsigned char G, unsigned char B, float &L, float &A, float &B2);
 
 public:
 
     double compute_overlap(CloudT::Ptr& A, CloudT::Ptr& B);
+    double compute_overlap(CloudT::Ptr& A, CloudT::Ptr& B, const Eigen::Matrix4f& TB);
     void visualize_cloud(CloudT::Ptr& cloud);
     void set_input_clouds(CloudPtrT& t1, CloudPtrT& t2);
     void set_input_clouds(CloudPtrT& t1, const Eigen::Matrix3f& tk1, CloudPtrT& t2, const Eigen::Matrix3f& tk2);
     void do_registration();
     void do_registration(SiftCloudT::Ptr& sift_cloud1, SiftCloudT::Ptr& sift_cloud2,
                          CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2);
+    // same as above but with a prebuilt index of sift_cloud2, use this when registering many clouds to the same one
+    void do_registration(SiftCloudT::Ptr& sift_cloud1, const sift_descriptor_index& sift_index2,
+                         CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2);
+    size_t get_nbr_correspondences() const { return nbr_correspondences; }
     void get_transformation(Eigen::Matrix4f& trans);
     std::pair<int, int> calculate_image_for_cloud(cv::Mat& image, cv::Mat& depth, CloudPtrT& cloud, const Eigen::Matrix3f &K);
     void calculate_features_for_image(cv::Mat& descriptors, std::vector<cv::KeyPoint>& keypoints, CloudPtrT& cloud, cv::Mat& image,
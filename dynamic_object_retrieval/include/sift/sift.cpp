@@ -964,10 +964,9 @@ static struct feature* clone_feature( struct feature* feat )
   @param mag_thr new features are added for entries in hist greater than this
   @param feat new features are clones of this with different orientations
 */
-static void add_good_ori_features( CvSeq* features, double* hist, int n,
-                                   double mag_thr, struct feature* feat )
+static void good_oris( std::vector<double>& oris, double* hist, int n,
+                       double mag_thr )
 {
-  struct feature* new_feat;
   double bin, PI2 = CV_PI * 2.0;
   int l, r, i;
 
@@ -980,14 +979,54 @@ static void add_good_ori_features( CvSeq* features, double* hist, int n,
         {
           bin = i + interp_hist_peak( hist[l], hist[i], hist[r] );
           bin = ( bin < 0 )? n + bin : ( bin >= n )? bin - n : bin;
-          new_feat = clone_feature( feat );
-          new_feat->ori = ( ( PI2 * bin ) / n ) - CV_PI;
-          cvSeqPush( features, new_feat );
-          free( new_feat );
+          oris.push_back( ( ( PI2 * bin ) / n ) - CV_PI );
         }
     }
 }
 
+static void add_good_ori_features( CvSeq* features, double* hist, int n,
+                                   double mag_thr, struct feature* feat )
+{
+  struct feature* new_feat;
+  std::vector<double> oris;
+
+  good_oris( oris, hist, n, mag_thr );
+  for( size_t i = 0; i < oris.size(); i++ )
+    {
+      new_feat = clone_feature( feat );
+      new_feat->ori = oris[i];
+      cvSeqPush( features, new_feat );
+      free( new_feat );
+    }
+}
+
+/*
+  Computes the dominant orientations of a single feature, same as
+  calc_feature_oris but without modifying a shared array of features,
+  so that it can be called for several features in parallel.
+
+  @param oris the orientations are appended to this
+  @param ddata detection data of the feature
+  @param gauss_pyr Gaussian scale space pyramid
+*/
+static void calc_feature_oris( std::vector<double>& oris, const detection_data* ddata,
+                               IplImage*** gauss_pyr )
+{
+  double* hist;
+  double omax;
+  int j;
+
+  hist = ori_hist( gauss_pyr[ddata->octv][ddata->intvl],
+                   ddata->r, ddata->c, SIFT_ORI_HIST_BINS,
+                   cvRound( SIFT_ORI_RADIUS * ddata->scl_octv ),
+                   SIFT_ORI_SIG_FCTR * ddata->scl_octv );
+  for( j = 0; j < SIFT_ORI_SMOOTH_PASSES; j++ )
+    smooth_ori_hist( hist, SIFT_ORI_HIST_BINS );
+  omax = dominant_ori( hist, SIFT_ORI_HIST_BINS );
+  good_oris( oris, hist, SIFT_ORI_HIST_BINS, omax * SIFT_ORI_PEAK_RATIO );
+  free( hist );
+}
+
 /*
   Computes a canonical orientation for each image feature in an array.  Based
   on Section 5 of Lowe's paper.  This function adds features to the array when
@@ -1028,7 +1067,7 @@ static void calc_feature_oris( CvSeq* features, IplImage*** gauss_pyr )
   Interpolates an entry into the array of orientation histograms that form
   the feature descriptor.
 
-  @param hist 2D array of orientation histograms
+  @param hist 2D array of orientation histograms, stored row by row in one array
   @param rbin sub-bin row coordinate of entry
   @param cbin sub-bin column coordinate of entry
   @param obin sub-bin orientation coordinate of entry
@@ -1036,11 +1075,11 @@ static void calc_feature_oris( CvSeq* features, IplImage*** gauss_pyr )
   @param d width of 2D array of orientation histograms
   @param n number of bins per orientation histogram
 */
-static void interp_hist_entry( double*** hist, double rbin, double cbin,
+static void interp_hist_entry( double* hist, double rbin, double cbin,
                                double obin, double mag, int d, int n )
 {
   double d_r, d_c, d_o, v_r, v_c, v_o;
-  double** row, * h;
+  double* row, * h;
   int r0, c0, o0, rb, cb, ob, r, c, o;
 
   r0 = cvFloor( rbin );
@@ -1061,14 +1100,14 @@ static void interp_hist_entry( double*** hist, double rbin, double cbin,
       if( rb >= 0  &&  rb < d )
         {
           v_r = mag * ( ( r == 0 )? 1.0 - d_r : d_r );
-          row = hist[rb];
+          row = hist + rb * d * n;
           for( c = 0; c <= 1; c++ )
             {
               cb = c0 + c;
               if( cb >= 0  &&  cb < d )
                 {
                   v_c = v_r * ( ( c == 0 )? 1.0 - d_c : d_c );
-                  h = row[cb];
+                  h = row + cb * n;
                   for( o = 0; o <= 1; o++ )
                     {
                       ob = ( o0 + o ) % n;
@@ -1092,24 +1131,17 @@ static void interp_hist_entry( double*** hist, double rbin, double cbin,
   @param scl scale relative to img of feature whose descr is being computed
   @param d width of 2d array of orientation histograms
   @param n bins per orientation histogram
-
-  @return Returns a d x d array of n-bin orientation histograms.
+  @param hist output d x d array of n-bin orientation histograms, stored
+    row by row, of size d * d * n
 */
-static double*** descr_hist( IplImage* img, int r, int c, double ori,
-                             double scl, int d, int n )
+static void descr_hist( IplImage* img, int r, int c, double ori,
+                        double scl, int d, int n, double* hist )
 {
-  double*** hist;
   double cos_t, sin_t, hist_width, exp_denom, r_rot, c_rot, grad_mag,
     grad_ori, w, rbin, cbin, obin, bins_per_rad, PI2 = 2.0 * CV_PI;
   int radius, i, j;
 
-  hist = (double***) calloc( d, sizeof( double** ) );
-  for( i = 0; i < d; i++ )
-    {
-      hist[i] = (double**) calloc( d, sizeof( double* ) );
-      for( j = 0; j < d; j++ )
-        hist[i][j] = (double*) calloc( n, sizeof( double ) );
-    }
+  std::fill( hist, hist + d * d * n, 0.0 );
 
   cos_t = cos( ori );
   sin_t = sin( ori );
@@ -1144,8 +1176,6 @@ static double*** descr_hist( IplImage* img, int r, int c, double ori,
               interp_hist_entry( hist, rbin, cbin, obin, grad_mag * w, d, n );
             }
       }
-
-  return hist;
 }
 
 /*
@@ -1172,19 +1202,17 @@ static void normalize_descr( struct feature* feat )
   Converts the 2D array of orientation histograms into a feature's descriptor
   vector.
 
-  @param hist 2D array of orientation histograms
+  @param hist 2D array of orientation histograms, stored row by row
   @param d width of hist
   @param n bins per histogram
   @param feat feature into which to store descriptor
 */
-static void hist_to_descr( double*** hist, int d, int n, struct feature* feat )
+static void hist_to_descr( const double* hist, int d, int n, struct feature* feat )
 {
-  int int_val, i, r, c, o, k = 0;
+  int int_val, i, k;
 
-  for( r = 0; r < d; r++ )
-    for( c = 0; c < d; c++ )
-      for( o = 0; o < n; o++ )
-        feat->descr[k++] = hist[r][c][o];
+  for( k = 0; k < d * d * n; k++ )
+    feat->descr[k] = hist[k];
 
   feat->d = k;
   normalize_descr( feat );
@@ -1224,27 +1252,6 @@ static int feature_cmp( void* feat1, void* feat2, void* /*param*/ )
   return 0;
 }
 
-/*
-  De-allocates memory held by a descriptor histogram
-
-  @param hist pointer to a 2D array of orientation histograms
-  @param d width of hist
-*/
-static void release_descr_hist( double**** hist, int d )
-{
-  int i, j;
-
-  for( i = 0; i < d; i++)
-    {
-      for( j = 0; j < d; j++ )
-        free( (*hist)[i][j] );
-      free( (*hist)[i] );
-    }
-  free( *hist );
-  *hist = NULL;
-}
-
-
 /*
   De-allocates memory held by a scale space pyramid
 
@@ -1269,27 +1276,28 @@ static void release_pyr( IplImage**** pyr, int octvs, int n )
   Computes feature descriptors for features in an array.  Based on Section 6
   of Lowe's paper.
 
+  The features are independent, so they are computed in parallel.
+
   @param features array of features
+  @param k number of features
   @param gauss_pyr Gaussian scale space pyramid
   @param d width of 2D array of orientation histograms
   @param n number of bins per orientation histogram
 */
-static void compute_descriptors( CvSeq* features, IplImage*** gauss_pyr, int d,
+static void compute_descriptors( struct feature* features, int k, IplImage*** gauss_pyr, int d,
                                  int n )
 {
-  struct feature* feat;
-  struct detection_data* ddata;
-  double*** hist;
-  int i, k = features->total;
+  CV_Assert( d * d * n <= FEATURE_MAX_D );
 
-  for( i = 0; i < k; i++ )
+#pragma omp parallel for schedule(dynamic, 16)
+  for( int i = 0; i < k; i++ )
     {
-      feat = CV_GET_SEQ_ELEM( struct feature, features, i );
-      ddata = feat->feature_data;
-      hist = descr_hist( gauss_pyr[ddata->octv][ddata->intvl], ddata->r,
-                         ddata->c, feat->ori, ddata->scl_octv, d, n );
+      double hist[FEATURE_MAX_D];
+      struct feature* feat = features + i;
+      struct detection_data* ddata = feat->feature_data;
+      descr_hist( gauss_pyr[ddata->octv][ddata->intvl], ddata->r,
+                  ddata->c, feat->ori, ddata->scl_octv, d, n, hist );
       hist_to_descr( hist, d, n, feat );
-      release_descr_hist( &hist, d );
     }
 }
 
@@ -1297,7 +1305,8 @@ static void compute_descriptors( CvSeq* features, IplImage*** gauss_pyr, int d,
 
 struct ImagePyrData
 {
-    ImagePyrData( IplImage* img, int octvs, int intvls, double _sigma, int img_dbl )
+    // the difference of gaussians are only needed for detecting features
+    ImagePyrData( IplImage* img, int octvs, int intvls, double _sigma, int img_dbl, bool build_dog = true )
     {
         if( ! img )
           CV_Error( CV_StsBadArg, "NULL image pointer" );
@@ -1309,7 +1318,7 @@ struct ImagePyrData
         octvs = std::max( std::min( octvs, max_octvs ), 1 );
 
         gauss_pyr = build_gauss_pyr( init_img, octvs, intvls, _sigma );
-        dog_pyr = build_dog_pyr( gauss_pyr, octvs, intvls );
+        dog_pyr = build_dog ? build_dog_pyr( gauss_pyr, octvs, intvls ) : NULL;
 
         octaves = octvs;
         intervals = intvls;
@@ -1321,7 +1330,8 @@ struct ImagePyrData
     {
         cvReleaseImage( &init_img );
         release_pyr( &gauss_pyr, octaves, intervals + 3 );
-        release_pyr( &dog_pyr, octaves, intervals + 2 );
+        if( dog_pyr )
+          release_pyr( &dog_pyr, octaves, intervals + 2 );
     }
 
     IplImage* init_img;
@@ -1675,46 +1685,38 @@ void SIFT::operator()(const Mat& image, const Mat& mask,
     }
 }
 
-void release_features_data( CvSeq* featuresSeq )
-{
-    for( int i = 0; i < featuresSeq->total; i++ )
-    {
-        feature * ft = CV_GET_SEQ_ELEM( feature, featuresSeq, i );
-        free( ft->feature_data );
-    }
-}
-
 // Calculate orientation of features.
 // Note: calc_feature_oris() duplicates the points with several dominant orientations.
 // So if keypoints was detected by Sift feature detector then some points will be
-// duplicated twice.
+// duplicated twice. The keypoints are handled in parallel, the orientations of
+// each keypoint are then put after each other in the original order.
 void recalculateAngles( vector<KeyPoint>& keypoints, IplImage*** gauss_pyr,
                         int nOctaves, int nOctaveLayers )
 {
-    CvMemStorage* storage = cvCreateMemStorage( 0 );
-    CvSeq* featuresSeq = cvCreateSeq( 0, sizeof(CvSeq), sizeof(struct feature), storage );
+    SiftParams params( nOctaves, nOctaveLayers );
+    vector<vector<KeyPoint> > oriented( keypoints.size() );
 
-    for( size_t i = 0; i < keypoints.size(); i++ )
+#pragma omp parallel for schedule(dynamic, 16)
+    for( int i = 0; i < (int)keypoints.size(); i++ )
     {
         feature ft;
-        keyPointToFeature( keypoints[i], ft, SiftParams( nOctaves, nOctaveLayers ) );
-        cvSeqPush( featuresSeq, &ft );
+        keyPointToFeature( keypoints[i], ft, params );
+        vector<double> oris;
+        calc_feature_oris( oris, ft.feature_data, gauss_pyr );
+        for( size_t j = 0; j < oris.size(); j++ )
+        {
+            ft.ori = oris[j];
+            oriented[i].push_back( featureToKeyPoint( ft ) );
+        }
+        free( ft.feature_data );
     }
 
-    calc_feature_oris( featuresSeq, gauss_pyr );
-
-    keypoints.resize( featuresSeq->total );
-    for( int i = 0; i < featuresSeq->total; i++ )
-    {
-        feature * ft = CV_GET_SEQ_ELEM( feature, featuresSeq, i );
-        keypoints[i] = featureToKeyPoint( *ft );
-    }
+    keypoints.clear();
+    for( size_t i = 0; i < oriented.size(); i++ )
+        keypoints.insert( keypoints.end(), oriented[i].begin(), oriented[i].end() );
 
     // Remove duplicated keypoints.
     KeyPointsFilter::removeDuplicated( keypoints );
-
-    release_features_data( featuresSeq );
-    cvReleaseMemStorage( &storage );
 }
 
 // descriptors
@@ -1738,39 +1740,30 @@ void SIFT::operator()(const Mat& image, const Mat& mask,
     }
 
     IplImage img = fimg;
-    ImagePyrData pyrImages( &img, commParams.nOctaves, commParams.nOctaveLayers, SIFT_SIGMA, SIFT_IMG_DBL );
+    ImagePyrData pyrImages( &img, commParams.nOctaves, commParams.nOctaveLayers, SIFT_SIGMA, SIFT_IMG_DBL, false );
 
     if( descriptorParams.recalculateAngles )
         recalculateAngles( keypoints, pyrImages.gauss_pyr, commParams.nOctaves, commParams.nOctaveLayers );
 
-    CvMemStorage* storage = cvCreateMemStorage( 0 );
-    CvSeq* featuresSeq = cvCreateSeq( 0, sizeof(CvSeq), sizeof(struct feature), storage );
-
+    SiftParams params( commParams.nOctaves, commParams.nOctaveLayers );
+    vector<feature> features( keypoints.size() );
     for( size_t i = 0; i < keypoints.size(); i++ )
     {
-        feature ft;
-        keyPointToFeature( keypoints[i], ft, SiftParams( commParams.nOctaves, commParams.nOctaveLayers ) );
-        cvSeqPush( featuresSeq, &ft );
+        keyPointToFeature( keypoints[i], features[i], params );
     }
-    compute_descriptors( featuresSeq, pyrImages.gauss_pyr, SIFT_DESCR_WIDTH, SIFT_DESCR_HIST_BINS );
-    CV_DbgAssert( (int)keypoints.size() == featuresSeq->total );
-    // TODO check that keypoint fiels is the same as before compute_descriptors()
+    compute_descriptors( features.data(), (int)features.size(), pyrImages.gauss_pyr, SIFT_DESCR_WIDTH, SIFT_DESCR_HIST_BINS );
 
-    descriptors.create( featuresSeq->total, SIFT::DescriptorParams::DESCRIPTOR_SIZE, CV_32FC1 );
-    for( int i = 0; i < featuresSeq->total; i++ )
+    descriptors.create( (int)features.size(), SIFT::DescriptorParams::DESCRIPTOR_SIZE, CV_32FC1 );
+    for( int i = 0; i < descriptors.rows; i++ )
     {
         float* rowPtr = descriptors.ptr<float>(i);
-        feature * featurePtr = CV_GET_SEQ_ELEM( feature, featuresSeq, i );
-        CV_Assert( featurePtr );
-        double* desc = featurePtr->descr;
+        const double* desc = features[i].descr;
         for( int j = 0; j < descriptors.cols; j++ )
         {
             rowPtr[j] = (float)desc[j];
         }
+        free( features[i].feature_data );
     }
-
-    release_features_data( featuresSeq );
-    cvReleaseMemStorage( &storage );
 }
 
 using namespace std;
@@ -1 +1 @@
-rm -rf ./*/*/*/subsegments && rm -rf ./*/*/*/convex_segments && rm -rf ./*/*/*/sift_features.pcd && rm -rf ./*/*/*/sift_keypoints.pcd && rm segments_summary.json
+rm -rf ./*/*/*/subsegments && rm -rf ./*/*/*/convex_segments && rm -rf ./*/*/*/sift_features.pcd && rm -rf ./*/*/*/sift_keypoints.pcd && rm -f segments_summary.json segments_summary.bin segments_catalog.bin ./*_features.store
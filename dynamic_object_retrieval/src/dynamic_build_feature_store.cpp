@@ -0,0 +1,76 @@
+#include "dynamic_object_retrieval/summary_types.h"
+#include "dynamic_object_retrieval/sweep_reader.h"
+#include "dynamic_object_retrieval/feature_store.h"
+#include "dynamic_object_retrieval/definitions.h"
+
+using namespace std;
+
+using PointT = pcl::PointXYZRGB;
+using CloudT = pcl::PointCloud<PointT>;
+using HistT = pcl::Histogram<N>;
+using HistCloudT = pcl::PointCloud<HistT>;
+
+POINT_CLOUD_REGISTER_POINT_STRUCT (HistT,
+                                   (float[N], histogram, histogram)
+)
+
+void build_feature_store(const boost::filesystem::path& data_path, const string& folder_name,
+                         const boost::filesystem::path& store_path, dynamic_object_retrieval::feature_store_encoding encoding)
+{
+    dynamic_object_retrieval::feature_store_writer writer(store_path, encoding);
+
+    size_t nbr_features = 0;
+    dynamic_object_retrieval::sweep_reader reader(data_path, folder_name);
+    for (const dynamic_object_retrieval::segment_record& segment : reader) {
+        if (segment.segment_index() == 0) {
+            writer.add_sweep(segment.sweep_path(), dynamic_object_retrieval::summary_version(segment.get_sweep().segments_path, "segments"));
+        }
+        writer.add_segment(*segment.features(), *segment.keypoints());
+        nbr_features += segment.features()->size();
+    }
+
+    writer.close();
+
+    cout << "Stored " << nbr_features << " features of " << writer.get_table().segment_sizes.size() << " segments in "
+         << writer.get_table().sweep_paths.size() << " sweeps, " << boost::filesystem::file_size(store_path) << " bytes" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        cout << "Usage: ./dynamic_build_feature_store /path/to/data (convex_segments/subsegments) (float/half/uint8)" << endl;
+        return 0;
+    }
+
+    boost::filesystem::path data_path(argv[1]);
+    string folder_name = argc > 2? string(argv[2]) : string("convex_segments");
+    string encoding_name = argc > 3? string(argv[3]) : string("float");
+
+    dynamic_object_retrieval::feature_store_encoding encoding;
+    if (encoding_name == "float") {
+        encoding = dynamic_object_retrieval::float32_encoding;
+    }
+    else if (encoding_name == "half") {
+        encoding = dynamic_object_retrieval::float16_encoding;
+    }
+    else if (encoding_name == "uint8") {
+        encoding = dynamic_object_retrieval::uint8_encoding;
+    }
+    else {
+        cout << encoding_name << " not a valid encoding..." << endl;
+        return -1;
+    }
+
+    if (folder_name != "convex_segments" && folder_name != "subsegments") {
+        cout << folder_name << " not a valid segment folder..." << endl;
+        return -1;
+    }
+
+    // the reader reads from the store if there is one, so remove it to read the pcd files
+    boost::filesystem::path store_path = dynamic_object_retrieval::feature_store_path(data_path, folder_name);
+    boost::filesystem::remove(store_path);
+
+    build_feature_store(data_path, folder_name, store_path, encoding);
+
+    return 0;
+}
@@ -92,7 +92,7 @@ int main(int argc, char** argv)
     for (const string& xml : folder_xmls) {
         vector<string> segment_paths;
         tie(counter, segment_paths) = convex_segment_cloud(counter, boost::filesystem::path(xml));
-        summary.index_convex_segment_paths.insert(summary.index_convex_segment_paths.end(), segment_paths.begin(), segment_paths.end());
+        summary.index_convex_segment_paths.append(segment_paths.begin(), segment_paths.end());
         summary.nbr_convex_segments = counter;
     }
 
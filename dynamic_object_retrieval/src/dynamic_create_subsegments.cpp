@@ -26,8 +26,12 @@ int main(int argc, char** argv)
 
     boost::filesystem::path data_path(argv[1]);
 
-    dynamic_object_retrieval::convex_feature_cloud_map segment_features(data_path);
-    dynamic_object_retrieval::convex_keypoint_cloud_map segment_keypoints(data_path);
+    // the feature store would be out of date, it has to be built again from the new features
+    boost::filesystem::remove(dynamic_object_retrieval::feature_store_path(data_path, "subsegments"));
+
+    // the segments of the following sweeps are loaded while we split the current ones
+    dynamic_object_retrieval::prefetching_convex_feature_cloud_map segment_features(data_path);
+    dynamic_object_retrieval::prefetching_convex_keypoint_cloud_map segment_keypoints(data_path);
     dynamic_object_retrieval::convex_segment_sweep_path_map segment_sweep_paths(data_path);
 
     // DEBUG
@@ -117,7 +121,7 @@ int main(int argc, char** argv)
         sweep_data.save(current_path / "subsegments");
     }
 
-    summary.index_subsegment_paths.insert(summary.index_subsegment_paths.end(), segment_paths.begin(), segment_paths.end());
+    summary.index_subsegment_paths.append(segment_paths.begin(), segment_paths.end());
     summary.nbr_subsegments = vt_index;
 
     summary.save(data_path);
@@ -0,0 +1,37 @@
+#include "dynamic_object_retrieval/summary_format.h"
+
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        cout << "Usage: ./dynamic_export_summary /path/to/summary.bin (/path/to/summary.json)" << endl;
+        return 0;
+    }
+
+    boost::filesystem::path summary_path(argv[1]);
+
+    dynamic_object_retrieval::summary_reader reader;
+    if (!reader.open(summary_path)) {
+        cout << "Could not read the summary " << summary_path.string() << "..." << endl;
+        return -1;
+    }
+
+    // write to stdout if no output file is given
+    if (argc < 3) {
+        reader.export_json(cout);
+        cout << endl;
+        return 0;
+    }
+
+    ofstream out(argv[2]);
+    if (!out.is_open()) {
+        cout << "Could not write to " << argv[2] << "..." << endl;
+        return -1;
+    }
+    reader.export_json(out);
+
+    return 0;
+}
@@ -18,42 +18,38 @@ POINT_CLOUD_REGISTER_POINT_STRUCT (HistT,
                                    (float[N], histogram, histogram)
 )
 
-int main(int argc, char** argv)
+// the segments of a sweep are independent, so their features are computed in parallel.
+// every segment writes its own files as soon as it is done, so only the segments
+// that are being processed are kept in memory
+void extract_features_for_sweep(const boost::filesystem::path& sweep_path)
 {
-    if (argc < 2) {
-        cout << "Please supply the path containing the sweeps..." << endl;
-        return -1;
-    }
+    boost::filesystem::path segments_path = sweep_path / "convex_segments";
+    dynamic_object_retrieval::sweep_summary summary;
+    summary.load(segments_path);
 
-    boost::filesystem::path data_path(argv[1]);
+#if WITH_SURFEL_NORMALS
+    // the surfel map and its index are shared by all segments of the sweep
+    SurfelCloudT::Ptr surfel_map(new SurfelCloudT);
+    pcl::io::loadPCDFile((sweep_path / "surfel_map.pcd").string(), *surfel_map);
+    dynamic_object_retrieval::surfel_normal_index surfel_index(surfel_map);
+#endif
 
-    dynamic_object_retrieval::convex_segment_cloud_map segment_clouds(data_path);
-    dynamic_object_retrieval::convex_feature_map segment_features(data_path);
-    dynamic_object_retrieval::convex_keypoint_map segment_keypoints(data_path);
-    dynamic_object_retrieval::convex_segment_sweep_path_map sweep_paths(data_path);
+    auto segment_file = [&](const string& name, size_t i) {
+        stringstream ss;
+        ss << name << std::setw(4) << std::setfill('0') << i;
+        return segments_path / (ss.str() + ".pcd");
+    };
 
-    string last_sweep;
-    SurfelCloudT::Ptr surfel_map(new SurfelCloudT);
-    for (auto tup : dynamic_object_retrieval::zip(segment_clouds, segment_features, segment_keypoints, sweep_paths)) {
-        CloudT::Ptr segment;
-        boost::filesystem::path feature_path;
-        boost::filesystem::path keypoint_path;
-        boost::filesystem::path sweep_path;
-        tie(segment, feature_path, keypoint_path, sweep_path) = tup;
-        cout << "Found cloud of size: " << segment->size() << endl;
-        cout << "Found feature path: " << feature_path.string() << endl;
-        cout << "Sweep path: " << sweep_path.string() << endl;
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < int(summary.nbr_segments); ++i) {
+        CloudT::Ptr segment(new CloudT);
+        pcl::io::loadPCDFile(segment_file("segment", i).string(), *segment);
 
         HistCloudT::Ptr desc_cloud(new HistCloudT);
         CloudT::Ptr kp_cloud(new CloudT);
 
 #if WITH_SURFEL_NORMALS
-        if (sweep_path.string() != last_sweep) {
-            surfel_map->clear();
-            pcl::io::loadPCDFile((sweep_path / "surfel_map.pcd").string(), *surfel_map);
-            last_sweep = sweep_path.string();
-        }
-        dynamic_object_retrieval::compute_features(desc_cloud, kp_cloud, segment, surfel_map);
+        dynamic_object_retrieval::compute_features(desc_cloud, kp_cloud, segment, surfel_index);
 #else
         pfhrgb_estimation::compute_surfel_features(desc_cloud, kp_cloud, segment, false);
         //pfhrgb_estimation::compute_features(desc_cloud, kp_cloud, segment, false);
@@ -63,8 +59,8 @@ int main(int argc, char** argv)
         if (desc_cloud->empty()) {
             // push back one inf point on descriptors and keypoints
             HistT sp;
-            for (int i = 0; i < N; ++i) {
-                sp.histogram[i] = std::numeric_limits<float>::infinity();
+            for (int j = 0; j < N; ++j) {
+                sp.histogram[j] = std::numeric_limits<float>::infinity();
             }
             desc_cloud->push_back(sp);
             PointT p;
@@ -72,8 +68,33 @@ int main(int argc, char** argv)
             kp_cloud->push_back(p);
         }
 
+        boost::filesystem::path feature_path = segment_file("pfhrgbfeature", i);
         pcl::io::savePCDFileBinary(feature_path.string(), *desc_cloud);
-        pcl::io::savePCDFileBinary(keypoint_path.string(), *kp_cloud);
+        pcl::io::savePCDFileBinary(segment_file("pfhrgbkeypoint", i).string(), *kp_cloud);
+#pragma omp critical
+        {
+            cout << "Found feature path: " << feature_path.string() << endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        cout << "Please supply the path containing the sweeps..." << endl;
+        return -1;
+    }
+
+    boost::filesystem::path data_path(argv[1]);
+
+    // the feature store would be out of date, it has to be built again from the new features
+    boost::filesystem::remove(dynamic_object_retrieval::feature_store_path(data_path, "convex_segments"));
+
+    vector<string> folder_xmls = semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string());
+    for (const string& xml : folder_xmls) {
+        boost::filesystem::path sweep_path = boost::filesystem::path(xml).parent_path();
+        cout << "Sweep path: " << sweep_path.string() << endl;
+        extract_features_for_sweep(sweep_path);
     }
 
     return 0;
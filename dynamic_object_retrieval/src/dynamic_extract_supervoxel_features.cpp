@@ -1,5 +1,6 @@
 #include <dynamic_object_retrieval/summary_types.h>
 #include <dynamic_object_retrieval/summary_iterators.h>
+#include <dynamic_object_retrieval/sweep_reader.h>
 #include <dynamic_object_retrieval/visualize.h>
 
 #include <cereal/archives/binary.hpp>
@@ -40,135 +41,146 @@ int main(int argc, char** argv)
 
     boost::filesystem::path data_path(argv[1]);
 
-    dynamic_object_retrieval::convex_feature_cloud_map convex_features(data_path);
-    dynamic_object_retrieval::convex_keypoint_cloud_map convex_keypoints(data_path);
-    dynamic_object_retrieval::convex_segment_sweep_path_map sweep_paths(data_path);
-    dynamic_object_retrieval::convex_segment_index_map indices(data_path);
-
-    // DEBUG
-    dynamic_object_retrieval::convex_segment_cloud_map convex_clouds(data_path);
-    // /DEBUG
-
-    map<size_t, size_t> convex_segment_indices;
-    vector<CloudT::Ptr> supervoxels;
-    for (auto tup : dynamic_object_retrieval::zip(convex_features, convex_keypoints, sweep_paths, indices, convex_clouds)) {
-        HistCloudT::Ptr features;
-        CloudT::Ptr keypoints;
-        boost::filesystem::path sweep_path;
-        size_t convex_index;
-        CloudT::Ptr cloud;
-        tie(features, keypoints, sweep_path, convex_index, cloud) = tup;
-
-        if (convex_index == 0) {
-            convex_segment_indices.clear();
-            supervoxels.clear();
-            convex_segment_indices = load_convex_segment_indices(sweep_path);
-            dynamic_object_retrieval::sweep_subsegment_cloud_map sweep_supervoxels(sweep_path);
-            for (CloudT::Ptr& s : sweep_supervoxels) {
-                supervoxels.push_back(CloudT::Ptr(new CloudT(*s)));
-                //supervoxels.push_back(s);
-                //supervoxels.push_back(CloudT::Ptr(new CloudT));
-                //*supervoxels.back() += *s;
-            }
-            cout << "New sweep!" << endl;
+    // the sweeps are independent, each one only writes to its own subsegments folder.
+    // the viewer can not be opened from the worker threads, so the empty supervoxels are shown
+    // afterwards, with one cloud per convex segment. the output of a sweep is printed at once
+    vector<CloudT::Ptr> empty_supervoxel_clouds;
+    dynamic_object_retrieval::sweep_reader reader(data_path, "convex_segments");
+    reader.for_each_sweep([&empty_supervoxel_clouds](const dynamic_object_retrieval::sweep_record& sweep,
+                                                     const vector<dynamic_object_retrieval::segment_record>& segments) {
+        boost::filesystem::path sweep_path = sweep.sweep_path;
+        map<size_t, size_t> convex_segment_indices = load_convex_segment_indices(sweep_path);
+        vector<CloudT::Ptr> supervoxels;
+        dynamic_object_retrieval::sweep_subsegment_cloud_map sweep_supervoxels(sweep_path);
+        for (CloudT::Ptr& s : sweep_supervoxels) {
+            supervoxels.push_back(CloudT::Ptr(new CloudT(*s)));
         }
+        stringstream log;
+        log << "New sweep!" << endl;
 
-        cout << "New convex segment!" << endl;
-        cout << "Size of convex keypoints: " << keypoints->size() << endl;
+        for (const dynamic_object_retrieval::segment_record& segment : segments) {
+            HistCloudT::Ptr features = segment.features();
+            CloudT::Ptr keypoints = segment.keypoints();
+            size_t convex_index = segment.segment_index();
+            CloudT::Ptr empty_supervoxel_cloud; // the convex segment with its empty supervoxels in red
 
-        // now we need to iterate through the supervoxels of one sweep and get the keypoint intersection
-        for (const pair<size_t, size_t>& ind : convex_segment_indices) {
+            log << "New convex segment!" << endl;
+            log << "Size of convex keypoints: " << keypoints->size() << endl;
 
-            // so the problem is that there is garbage attached to ind.second == 0
-            // i.e. to the 0:th supervoxel. It seems there are valid points also?
-            // Or are they attached to another convex segment (the same) as well?
-            /*if (ind.second == 0) {
-                continue;
-            }*/
+            // now we need to iterate through the supervoxels of one sweep and get the keypoint intersection
+            for (const pair<size_t, size_t>& ind : convex_segment_indices) {
 
-            cout << ind.first << " belongs to convex segment " << ind.second << endl;
+                // so the problem is that there is garbage attached to ind.second == 0
+                // i.e. to the 0:th supervoxel. It seems there are valid points also?
+                // Or are they attached to another convex segment (the same) as well?
+                /*if (ind.second == 0) {
+                    continue;
+                }*/
 
-            if (ind.second == convex_index) {
+                log << ind.first << " belongs to convex segment " << ind.second << endl;
 
-                //dynamic_object_retrieval::visualize(supervoxels[ind.first]);
+                if (ind.second == convex_index) {
 
-                HistCloudT::Ptr supervoxel_features(new HistCloudT);
-                CloudT::Ptr supervoxel_keypoints(new CloudT);
+                    //dynamic_object_retrieval::visualize(supervoxels[ind.first]);
 
-                std::stringstream ss;
-                ss << std::setw(4) << std::setfill('0') << ind.first;
+                    HistCloudT::Ptr supervoxel_features(new HistCloudT);
+                    CloudT::Ptr supervoxel_keypoints(new CloudT);
 
-                boost::filesystem::path subsegment_path = sweep_path / "subsegments";
-                boost::filesystem::path feature_path = subsegment_path / (string("feature") + ss.str() + ".pcd");
-                boost::filesystem::path keypoint_path = subsegment_path / (string("keypoint") + ss.str() + ".pcd");
+                    std::stringstream ss;
+                    ss << std::setw(4) << std::setfill('0') << ind.first;
 
-                cout << "Size of supervoxel cloud: " << supervoxels[ind.first]->size() << endl;
-                cout << "Size of convex keypoints: " << keypoints->size() << endl;
-                cout << "Sweep path: " << sweep_path.string() << endl;
+                    boost::filesystem::path subsegment_path = sweep_path / "subsegments";
+                    boost::filesystem::path feature_path = subsegment_path / (string("feature") + ss.str() + ".pcd");
+                    boost::filesystem::path keypoint_path = subsegment_path / (string("keypoint") + ss.str() + ".pcd");
 
-                // probably use a kd tree or an octree for this
-                pcl::KdTreeFLANN<PointT> kdtree;
-                if (supervoxels[ind.first]->size() == 1 && !pcl::isFinite(supervoxels[ind.first]->at(0))) {
-                    supervoxel_keypoints->push_back(supervoxels[ind.first]->at(0));
-                    HistT h;
-                    for (float& f : h.histogram) {
-                        f = std::numeric_limits<float>::infinity();
-                    }
+                    log << "Size of supervoxel cloud: " << supervoxels[ind.first]->size() << endl;
+                    log << "Size of convex keypoints: " << keypoints->size() << endl;
+                    log << "Sweep path: " << sweep_path.string() << endl;
 
-                    pcl::io::savePCDFileBinary(feature_path.string(), *supervoxel_features);
-                    pcl::io::savePCDFileBinary(keypoint_path.string(), *supervoxel_keypoints);
+                    // probably use a kd tree or an octree for this
+                    pcl::KdTreeFLANN<PointT> kdtree;
+                    if (supervoxels[ind.first]->size() == 1 && !pcl::isFinite(supervoxels[ind.first]->at(0))) {
+                        supervoxel_keypoints->push_back(supervoxels[ind.first]->at(0));
+                        HistT h;
+                        for (float& f : h.histogram) {
+                            f = std::numeric_limits<float>::infinity();
+                        }
+
+                        pcl::io::savePCDFileBinary(feature_path.string(), *supervoxel_features);
+                        pcl::io::savePCDFileBinary(keypoint_path.string(), *supervoxel_keypoints);
 
-                    continue;
-                }
-                kdtree.setInputCloud(supervoxels[ind.first]);
-                size_t feature_ind = 0;
-                for (const PointT& p : keypoints->points) {
-                    if (!pcl::isFinite(p)) {
-                        ++feature_ind;
                         continue;
                     }
-                    vector<int> indices(1);
-                    vector<float> distances(1);
-                    kdtree.nearestKSearchT(p, 1, indices, distances);
-                    if (distances.empty()) {
-                        cout << "Distances empty, wtf??" << endl;
-                        exit(0);
-                    }
-                    //cout << "Distance: " << distances[0] << endl;
-                    if (sqrt(distances[0]) < 0.05) {
-                        supervoxel_features->push_back(features->at(feature_ind));
-                        supervoxel_keypoints->push_back(p);
+                    kdtree.setInputCloud(supervoxels[ind.first]);
+                    size_t feature_ind = 0;
+                    for (const PointT& p : keypoints->points) {
+                        if (!pcl::isFinite(p)) {
+                            ++feature_ind;
+                            continue;
+                        }
+                        vector<int> indices(1);
+                        vector<float> distances(1);
+                        kdtree.nearestKSearchT(p, 1, indices, distances);
+                        if (distances.empty()) {
+                            cout << "Distances empty, wtf??" << endl;
+                            exit(0);
+                        }
+                        //cout << "Distance: " << distances[0] << endl;
+                        if (sqrt(distances[0]) < 0.05) {
+                            supervoxel_features->push_back(features->at(feature_ind));
+                            supervoxel_keypoints->push_back(p);
+                        }
+                        ++feature_ind;
                     }
-                    ++feature_ind;
-                }
 
-                // save the resulting features and keypoints
-                cout << "Size of keypoints: " << supervoxel_keypoints->size() << endl;
-                cout << "Size of features: " << supervoxel_features->size() << endl;
-                cout << "Keypoint path: " << keypoint_path.string() << endl;
-                cout << "Feature path: " << feature_path.string() << endl;
-
-                if (supervoxel_keypoints->empty()) {
-                    for (PointT p : supervoxels[ind.first]->points) {
-                        p.r = 255;
-                        p.g = 0;
-                        p.b = 0;
-                        cloud->push_back(p);
-                        HistT h;
-                        for (float& f : h.histogram) {
-                            f = std::numeric_limits<float>::infinity();
+                    // save the resulting features and keypoints
+                    log << "Size of keypoints: " << supervoxel_keypoints->size() << endl;
+                    log << "Size of features: " << supervoxel_features->size() << endl;
+                    log << "Keypoint path: " << keypoint_path.string() << endl;
+                    log << "Feature path: " << feature_path.string() << endl;
+
+                    if (supervoxel_keypoints->empty()) {
+                        // the convex segment cloud is only loaded for showing these, the copy
+                        // keeps the cached cloud of the segment as it is
+                        if (!empty_supervoxel_cloud) {
+                            empty_supervoxel_cloud = CloudT::Ptr(new CloudT(*segment.cloud()));
+                        }
+                        for (PointT p : supervoxels[ind.first]->points) {
+                            p.r = 255;
+                            p.g = 0;
+                            p.b = 0;
+                            empty_supervoxel_cloud->push_back(p);
+                            HistT h;
+                            for (float& f : h.histogram) {
+                                f = std::numeric_limits<float>::infinity();
+                            }
+                            supervoxel_features->push_back(h);
+                            p.x = p.y = p.z = std::numeric_limits<float>::infinity();
+                            supervoxel_keypoints->push_back(p);
                         }
-                        supervoxel_features->push_back(h);
-                        p.x = p.y = p.z = std::numeric_limits<float>::infinity();
-                        supervoxel_keypoints->push_back(p);
                     }
-                    dynamic_object_retrieval::visualize(cloud);
+
+                    pcl::io::savePCDFileBinary(feature_path.string(), *supervoxel_features);
+                    pcl::io::savePCDFileBinary(keypoint_path.string(), *supervoxel_keypoints);
                 }
+            }
 
-                pcl::io::savePCDFileBinary(feature_path.string(), *supervoxel_features);
-                pcl::io::savePCDFileBinary(keypoint_path.string(), *supervoxel_keypoints);
+            if (empty_supervoxel_cloud) {
+#pragma omp critical
+                {
+                    empty_supervoxel_clouds.push_back(empty_supervoxel_cloud);
+                }
             }
         }
+
+#pragma omp critical
+        {
+            cout << log.str();
+        }
+    });
+
+    for (CloudT::Ptr& cloud : empty_supervoxel_clouds) {
+        dynamic_object_retrieval::visualize(cloud);
     }
 
     return 0;
@@ -28,11 +28,11 @@ void init_folders(const boost::filesystem::path& data_path)
         boost::filesystem::create_directory(subsegment_path);
 
         sweep_summary convex_summary;
-        if (!boost::filesystem::exists(convex_path / "segments.json")) {
+        if (!has_summary(convex_path, "segments")) {
             convex_summary.save(convex_path);
         }
         sweep_summary subsegment_summary;
-        if (!boost::filesystem::exists(subsegment_path / "segments.json")) {
+        if (!has_summary(subsegment_path, "segments")) {
             subsegment_summary.save(subsegment_path);
         }
     }
@@ -90,9 +90,17 @@ int main(int argc, char** argv)
     pcl::io::loadPCDFile(cloud_path.string(), *query_cloud);
     dynamic_object_retrieval::visualize(query_cloud);
 
-    if (summary.vocabulary_type == "standard") {
+    // vocabularies trained with a descriptor projection contain the projected descriptors
+    bool projected = dynamic_object_retrieval::has_descriptor_projection(vocabulary_path);
+    if (summary.vocabulary_type == "standard" && projected) {
+        query_and_visualize<vocabulary_tree<ProjectedHistT, 8> >(feature_path, vocabulary_path, summary, do_reweighting);
+    }
+    else if (summary.vocabulary_type == "standard") {
         query_and_visualize<vocabulary_tree<HistT, 8> >(feature_path, vocabulary_path, summary, do_reweighting);
     }
+    else if (summary.vocabulary_type == "incremental" && projected) {
+        query_and_visualize<grouped_vocabulary_tree<ProjectedHistT, 8> >(feature_path, vocabulary_path, summary, do_reweighting);
+    }
     else if (summary.vocabulary_type == "incremental") {
         query_and_visualize<grouped_vocabulary_tree<HistT, 8> >(feature_path, vocabulary_path, summary, do_reweighting);
     }
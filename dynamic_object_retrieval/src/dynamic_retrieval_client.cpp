@@ -0,0 +1,54 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// sends one request to a running dynamic_retrieval_server and prints the reply
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cout << "Usage: ./dynamic_retrieval_client /path/to/socket features|cloud K /path/to/cloud.pcd" << endl;
+        cout << "       ./dynamic_retrieval_client /path/to/socket reload (/path/to/vocabulary)" << endl;
+        return 0;
+    }
+
+    string request;
+    for (int i = 2; i < argc; ++i) {
+        request += string(i > 2? " " : "") + argv[i];
+    }
+    request += '\n';
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+    if (fd == -1 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        cout << "Could not connect to " << argv[1] << ": " << strerror(errno) << endl;
+        return -1;
+    }
+
+    if (send(fd, request.data(), request.size(), 0) != ssize_t(request.size())) {
+        cout << "Could not send request: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    // the reply ends with an empty line
+    string reply;
+    char chunk[4096];
+    ssize_t nbr_read;
+    while (reply.find("\n\n") == string::npos && (nbr_read = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+        reply.append(chunk, nbr_read);
+    }
+    close(fd);
+
+    cout << reply.substr(0, reply.find("\n\n") + 1);
+
+    return reply.compare(0, 6, "error ") == 0? -1 : 0;
+}
@@ -0,0 +1,371 @@
+#include "dynamic_object_retrieval/dynamic_retrieval.h"
+#include "dynamic_object_retrieval/visualize.h"
+
+#include <vocabulary_tree/vocabulary_tree.h>
+#include <grouped_vocabulary_tree/grouped_vocabulary_tree.h>
+#include <object_3d_retrieval/pfhrgb_estimation.h>
+
+#include <cereal/archives/binary.hpp>
+#include <pcl/io/pcd_io.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <sstream>
+
+#include "dynamic_object_retrieval/definitions.h"
+
+POINT_CLOUD_REGISTER_POINT_STRUCT (HistT,
+                                   (float[N], histogram, histogram)
+)
+
+using namespace std;
+
+/**
+ * Keeps a vocabulary loaded and answers queries over a local unix socket,
+ * so that every object query does not have to load the vocabulary again.
+ * A client writes one request per line:
+ *
+ *   features <K> /path/to/features.pcd  - query with an already computed feature cloud
+ *   cloud <K> /path/to/cloud.pcd        - compute the features of a point cloud and query with those
+ *   reload [/path/to/vocabulary]        - load the vocabulary again, or switch to another one
+ *                                         in the same folder as the one the server was started with
+ *
+ * and gets one line per result back, the score followed by the paths of
+ * the result, separated by tabs. The reply is terminated by an empty line
+ * and errors are returned as a single "error <message>" line.
+ *
+ * The vocabulary is also reloaded in the background whenever its files change,
+ * the old vocabulary keeps answering queries until the new one is ready.
+ *
+ * The server reads any pcd file that a client names, so the socket should
+ * only be accessible to trusted users.
+ */
+
+// changes whenever the vocabulary is retrained or the summary is updated
+time_t vocabulary_version(const boost::filesystem::path& vocabulary_path)
+{
+    time_t version = 0;
+    for (const char* name : { "vocabulary_summary.bin", "vocabulary_summary.json", "vocabulary.cereal", "grouped_vocabulary.cereal", "descriptor_projection.cereal" }) {
+        boost::filesystem::path file_path = vocabulary_path / name;
+        if (boost::filesystem::exists(file_path)) {
+            version = std::max(version, boost::filesystem::last_write_time(file_path));
+        }
+    }
+    return version;
+}
+
+void write_paths(ostream& out, const boost::filesystem::path& path)
+{
+    out << '\t' << path.string();
+}
+
+void write_paths(ostream& out, const vector<boost::filesystem::path>& paths)
+{
+    for (const boost::filesystem::path& path : paths) {
+        out << '\t' << path.string();
+    }
+}
+
+template <typename VocabularyT>
+struct vocabulary_state {
+    boost::filesystem::path vocabulary_path;
+    dynamic_object_retrieval::vocabulary_summary summary;
+    time_t version;
+    VocabularyT vt;
+    mutex vt_mutex; // querying reads group caches and re-weighting changes the weights, one query at a time
+};
+
+template <typename VocabularyT>
+class retrieval_server {
+public:
+
+    using state_type = vocabulary_state<VocabularyT>;
+    using result_type = vector<pair<typename dynamic_object_retrieval::path_result<VocabularyT>::type, typename VocabularyT::result_type> >;
+
+protected:
+
+    shared_ptr<state_type> state;
+    mutex state_mutex; // only guards swapping the state, queries keep their own reference
+    mutex reload_mutex; // at most one vocabulary is being loaded at a time
+    boost::filesystem::path vocabulary_folder; // clients can only switch to vocabularies in here
+
+public:
+
+    // the vocabulary the server was started with or one next to it
+    bool allowed_vocabulary_path(const boost::filesystem::path& vocabulary_path) const
+    {
+        boost::system::error_code ec;
+        boost::filesystem::path canonical_path = boost::filesystem::canonical(vocabulary_path, ec);
+        return !ec && canonical_path.parent_path() == vocabulary_folder;
+    }
+
+    shared_ptr<state_type> current_state()
+    {
+        lock_guard<mutex> lock(state_mutex);
+        return state;
+    }
+
+    bool reload(const boost::filesystem::path& vocabulary_path, string& error)
+    {
+        lock_guard<mutex> lock(reload_mutex);
+
+        if (!dynamic_object_retrieval::has_summary(vocabulary_path, "vocabulary_summary")) {
+            error = vocabulary_path.string() + " does not contain a vocabulary";
+            return false;
+        }
+
+        shared_ptr<state_type> new_state = make_shared<state_type>();
+        new_state->vocabulary_path = vocabulary_path;
+        new_state->version = vocabulary_version(vocabulary_path);
+        new_state->summary.load(vocabulary_path);
+        shared_ptr<state_type> old_state = current_state();
+        if (old_state && new_state->summary.vocabulary_type != old_state->summary.vocabulary_type) {
+            error = "can not switch from a " + old_state->summary.vocabulary_type + " to a "
+                    + new_state->summary.vocabulary_type + " vocabulary";
+            return false;
+        }
+        // the descriptor type of the vocabulary is fixed when the server starts
+        if (dynamic_object_retrieval::has_descriptor_projection(vocabulary_path) != std::is_same<typename VocabularyT::point_type, ProjectedHistT>::value) {
+            error = "can not switch between vocabularies of projected and full descriptors";
+            return false;
+        }
+
+        cout << "Loading vocabulary " << vocabulary_path.string() << "..." << endl;
+        dynamic_object_retrieval::load_vocabulary(new_state->vt, vocabulary_path);
+        new_state->vt.set_min_match_depth(3);
+        new_state->vt.compute_normalizing_constants();
+        cout << "Finished loading vocabulary " << vocabulary_path.string() << endl;
+
+        lock_guard<mutex> swap_lock(state_mutex);
+        state = new_state;
+        return true;
+    }
+
+    string handle_request(const string& line)
+    {
+        stringstream request(line);
+        string command;
+        request >> command;
+
+        if (command == "reload") {
+            string vocabulary_path;
+            request >> vocabulary_path;
+            if (!vocabulary_path.empty() && !allowed_vocabulary_path(vocabulary_path)) {
+                return "error can only switch to vocabularies in " + vocabulary_folder.string() + "\n\n";
+            }
+            string error;
+            if (!reload(vocabulary_path.empty()? current_state()->vocabulary_path : boost::filesystem::path(vocabulary_path), error)) {
+                return "error " + error + "\n\n";
+            }
+            return "ok\n\n";
+        }
+
+        size_t nbr_query;
+        string cloud_path;
+        if ((command != "features" && command != "cloud") || !(request >> nbr_query >> cloud_path)) {
+            return "error malformed request: " + line + "\n\n";
+        }
+
+        // computing the features does not touch the vocabulary so several clients can do that at once
+        HistCloudT::Ptr features(new HistCloudT);
+        if (command == "features") {
+            if (pcl::io::loadPCDFile(cloud_path, *features) == -1) {
+                return "error could not read " + cloud_path + "\n\n";
+            }
+        }
+        else {
+            CloudT::Ptr query_cloud(new CloudT);
+            if (pcl::io::loadPCDFile(cloud_path, *query_cloud) == -1) {
+                return "error could not read " + cloud_path + "\n\n";
+            }
+            CloudT::Ptr keypoints(new CloudT);
+            pfhrgb_estimation::compute_surfel_features(features, keypoints, query_cloud, false, true);
+        }
+
+        if (features->empty()) {
+            return "error no features in " + cloud_path + "\n\n";
+        }
+
+        shared_ptr<state_type> query_state = current_state();
+        result_type results;
+        {
+            lock_guard<mutex> lock(query_state->vt_mutex);
+            results = dynamic_object_retrieval::query_vocabulary(features, nbr_query, query_state->vt,
+                                                                 query_state->vocabulary_path, query_state->summary);
+        }
+
+        stringstream reply;
+        for (const auto& r : results) {
+            reply << r.second.score;
+            write_paths(reply, r.first);
+            reply << '\n';
+        }
+        reply << '\n';
+        return reply.str();
+    }
+
+    void serve_client(int client_fd)
+    {
+        string buffer;
+        char chunk[4096];
+        ssize_t nbr_read;
+        while ((nbr_read = recv(client_fd, chunk, sizeof(chunk), 0)) > 0) {
+            buffer.append(chunk, nbr_read);
+            size_t line_end;
+            while ((line_end = buffer.find('\n')) != string::npos) {
+                string line = buffer.substr(0, line_end);
+                buffer.erase(0, line_end + 1);
+                if (line.empty()) {
+                    continue;
+                }
+                string reply = handle_request(line);
+                size_t nbr_sent = 0;
+                while (nbr_sent < reply.size()) {
+                    ssize_t sent = send(client_fd, reply.data() + nbr_sent, reply.size() - nbr_sent, MSG_NOSIGNAL);
+                    if (sent <= 0) {
+                        close(client_fd);
+                        return;
+                    }
+                    nbr_sent += sent;
+                }
+            }
+        }
+        close(client_fd);
+    }
+
+    // reload when the vocabulary files change, wait until they have
+    // been left alone for one poll so that we do not read half written files.
+    // if the files can not be loaded, we wait until they change again
+    void watch_vocabulary(int poll_seconds)
+    {
+        time_t last_seen = current_state()->version;
+        boost::filesystem::path failed_path;
+        time_t failed_version = 0;
+        while (true) {
+            this_thread::sleep_for(chrono::seconds(poll_seconds));
+            shared_ptr<state_type> watched = current_state();
+            time_t version = vocabulary_version(watched->vocabulary_path);
+            bool failed_before = watched->vocabulary_path == failed_path && version == failed_version;
+            if (version != watched->version && version == last_seen && !failed_before) {
+                string error;
+                if (!reload(watched->vocabulary_path, error)) {
+                    cout << "Could not reload vocabulary: " << error << endl;
+                    failed_path = watched->vocabulary_path;
+                    failed_version = version;
+                }
+            }
+            last_seen = version;
+        }
+    }
+
+    void run(const string& socket_path, int poll_seconds)
+    {
+        int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server_fd == -1) {
+            cout << "Could not create socket: " << strerror(errno) << endl;
+            exit(-1);
+        }
+
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            cout << "Socket path " << socket_path << " is too long..." << endl;
+            exit(-1);
+        }
+        strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+        unlink(socket_path.c_str());
+
+        if (::bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 || listen(server_fd, 16) == -1) {
+            cout << "Could not listen on " << socket_path << ": " << strerror(errno) << endl;
+            exit(-1);
+        }
+
+        if (poll_seconds > 0) {
+            thread(&retrieval_server::watch_vocabulary, this, poll_seconds).detach();
+        }
+
+        cout << "Listening for queries on " << socket_path << endl;
+        while (true) {
+            int client_fd = accept(server_fd, NULL, NULL);
+            if (client_fd == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                cout << "Could not accept client: " << strerror(errno) << endl;
+                break;
+            }
+            thread(&retrieval_server::serve_client, this, client_fd).detach();
+        }
+
+        close(server_fd);
+        unlink(socket_path.c_str());
+    }
+
+    retrieval_server(const boost::filesystem::path& vocabulary_folder) : vocabulary_folder(vocabulary_folder) {}
+};
+
+template <typename VocabularyT>
+void run_server(const boost::filesystem::path& vocabulary_path, const string& socket_path, int poll_seconds)
+{
+    boost::system::error_code ec;
+    boost::filesystem::path canonical_path = boost::filesystem::canonical(vocabulary_path, ec);
+    if (ec) {
+        cout << "Could not find vocabulary " << vocabulary_path.string() << "..." << endl;
+        exit(-1);
+    }
+    retrieval_server<VocabularyT> server(canonical_path.parent_path());
+    string error;
+    if (!server.reload(vocabulary_path, error)) {
+        cout << "Could not load vocabulary: " << error << endl;
+        exit(-1);
+    }
+    server.run(socket_path, poll_seconds);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cout << "Usage: ./dynamic_retrieval_server /path/to/vocabulary /path/to/socket (poll seconds, 0 = no reload)" << endl;
+        return 0;
+    }
+
+    boost::filesystem::path vocabulary_path(argv[1]);
+    string socket_path(argv[2]);
+    int poll_seconds = argc > 3? atoi(argv[3]) : 5;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    dynamic_object_retrieval::vocabulary_summary summary;
+    summary.load(vocabulary_path);
+
+    bool projected = dynamic_object_retrieval::has_descriptor_projection(vocabulary_path);
+    if (summary.vocabulary_type == "standard" && projected) {
+        run_server<vocabulary_tree<ProjectedHistT, 8> >(vocabulary_path, socket_path, poll_seconds);
+    }
+    else if (summary.vocabulary_type == "standard") {
+        run_server<vocabulary_tree<HistT, 8> >(vocabulary_path, socket_path, poll_seconds);
+    }
+    else if (summary.vocabulary_type == "incremental" && projected) {
+        run_server<grouped_vocabulary_tree<ProjectedHistT, 8> >(vocabulary_path, socket_path, poll_seconds);
+    }
+    else if (summary.vocabulary_type == "incremental") {
+        run_server<grouped_vocabulary_tree<HistT, 8> >(vocabulary_path, socket_path, poll_seconds);
+    }
+    else {
+        cout << summary.vocabulary_type << " not a valid vocabulary type..." << endl;
+        return -1;
+    }
+
+    return 0;
+}
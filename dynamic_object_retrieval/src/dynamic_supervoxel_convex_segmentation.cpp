@@ -137,6 +137,7 @@ int main(int argc, char** argv)
     summary.subsegment_type = "supervoxel";
 
     summary.index_convex_segment_paths.clear();
+    summary.index_subsegment_paths.clear();
     int convex_counter = 0;
     int supervoxel_counter = 0;
     for (const string& xml : folder_xmls) {
@@ -144,8 +145,8 @@ int main(int argc, char** argv)
         vector<string> supervoxel_paths;
         tie(convex_counter, supervoxel_counter, segment_paths, supervoxel_paths) =
                 supervoxel_convex_segment_cloud(convex_counter, supervoxel_counter, boost::filesystem::path(xml));
-        summary.index_convex_segment_paths.insert(summary.index_convex_segment_paths.end(), segment_paths.begin(), segment_paths.end());
-        summary.index_subsegment_paths.insert(summary.index_subsegment_paths.begin(), supervoxel_paths.begin(), supervoxel_paths.end());
+        summary.index_convex_segment_paths.append(segment_paths.begin(), segment_paths.end());
+        summary.index_subsegment_paths.append(supervoxel_paths.begin(), supervoxel_paths.end());
         summary.nbr_convex_segments = convex_counter;
         summary.nbr_subsegments = supervoxel_counter;
     }
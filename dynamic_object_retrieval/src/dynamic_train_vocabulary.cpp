@@ -1,6 +1,8 @@
 #include "dynamic_object_retrieval/summary_types.h"
 #include "dynamic_object_retrieval/summary_iterators.h"
+#include "dynamic_object_retrieval/sweep_reader.h"
 #include "dynamic_object_retrieval/visualize.h"
+#include "dynamic_object_retrieval/descriptor_projection.h"
 
 #include <object_3d_retrieval/supervoxel_segmentation.h>
 
@@ -26,25 +28,26 @@ POINT_CLOUD_REGISTER_POINT_STRUCT (HistT,
 )
 
 // TODO: finish this
-set<pair<int, int> > compute_group_adjacencies_subsegments(CloudT::Ptr& centroids, float adj_dist)
+subgroup_adjacencies compute_group_adjacencies_subsegments(CloudT::Ptr& centroids, float adj_dist)
 {
-    set<pair<int, int> > adjacencies;
+    vector<pair<int, int> > edges;
 
     for (int i = 0; i < centroids->size(); ++i) {
         for (int j = 0; j < i; ++j) {
             if ((centroids->at(i).getVector3fMap()-centroids->at(j).getVector3fMap()).norm() < adj_dist) {
-                adjacencies.insert(make_pair(i, j));
-                // adjacencies.insert(make_pair(j, i));
+                edges.push_back(make_pair(i, j));
             }
         }
     }
 
+    subgroup_adjacencies adjacencies;
+    adjacencies.assign(edges, centroids->size());
     return adjacencies;
 }
 
-set<pair<int, int> > compute_group_adjacencies_supervoxels(const boost::filesystem::path& segment_path)
+subgroup_adjacencies compute_group_adjacencies_supervoxels(const boost::filesystem::path& segment_path)
 {
-    set<pair<int, int> > adjacencies;
+    vector<pair<int, int> > edges;
 
     boost::filesystem::path graph_path = segment_path / "graph.cereal";
     supervoxel_segmentation ss;
@@ -53,7 +56,7 @@ set<pair<int, int> > compute_group_adjacencies_supervoxels(const boost::filesyst
 
     typename boost::property_map<supervoxel_segmentation::Graph, boost::vertex_name_t>::type vertex_name = boost::get(boost::vertex_name, g);
 
-    // now iterate over all of the adjacencies in the original graph and add them to the set data structure
+    // now iterate over all of the adjacencies in the original graph and add them to the adjacency graph
     using edge_iterator = boost::graph_traits<supervoxel_segmentation::Graph>::edge_iterator;
     edge_iterator edge_it, edge_end;
     for (tie(edge_it, edge_end) = boost::edges(g); edge_it != edge_end; ++edge_it) {
@@ -61,24 +64,43 @@ set<pair<int, int> > compute_group_adjacencies_supervoxels(const boost::filesyst
         supervoxel_segmentation::Vertex v = target(*edge_it, g);
         supervoxel_segmentation::vertex_name_property from = boost::get(vertex_name, u);
         supervoxel_segmentation::vertex_name_property to = boost::get(vertex_name, v);
-        adjacencies.insert(make_pair(from.m_value, to.m_value));
+        edges.push_back(make_pair(from.m_value, to.m_value));
     }
 
+    subgroup_adjacencies adjacencies;
+    adjacencies.assign(edges, boost::num_vertices(g));
     return adjacencies;
 }
 
-template <typename SegmentMapT>
+// the projection is fit on the features that the vocabulary is trained on and
+// saved with the vocabulary, it is the identity for vocabularies of the full descriptors
+template <typename VocabularyT>
+typename VocabularyT::cloud_ptr_type project_training_features(HistCloudT::Ptr& features, descriptor_projection<HistT, typename VocabularyT::point_type>& projection,
+                                                               const boost::filesystem::path& vocabulary_path, bool training, bool whiten)
+{
+    if (training) {
+        projection.fit(features, whiten);
+        projection.save(vocabulary_path);
+    }
+    typename VocabularyT::cloud_ptr_type projected;
+    projection.project(projected, features);
+    return projected;
+}
+
+template <typename VocabularyT, typename SegmentMapT>
 size_t add_segments(SegmentMapT& segment_features, const boost::filesystem::path& vocabulary_path,
-                    const vocabulary_summary& summary, bool training, size_t offset)
+                    const vocabulary_summary& summary, bool training, size_t offset, bool whiten)
 {
     size_t min_segment_features = summary.min_segment_features;
     size_t max_training_features = summary.max_training_features;
     size_t max_append_features = summary.max_append_features;
 
-    vocabulary_tree<HistT, 8> vt;
+    VocabularyT vt;
+    descriptor_projection<HistT, typename VocabularyT::point_type> projection;
 
     if (!training) {
         load_vocabulary(vt, vocabulary_path);
+        projection.load(vocabulary_path);
     }
 
     HistCloudT::Ptr features(new HistCloudT);
@@ -90,7 +112,8 @@ size_t add_segments(SegmentMapT& segment_features, const boost::filesystem::path
 
         // train on a subset of the provided features
         if (training && features->size() > max_training_features) {
-            vt.set_input_cloud(features, indices);
+            typename VocabularyT::cloud_ptr_type vocabulary_features = project_training_features<VocabularyT>(features, projection, vocabulary_path, true, whiten);
+            vt.set_input_cloud(vocabulary_features, indices);
             vt.add_points_from_input_cloud(false);
             features->clear();
             indices.clear();
@@ -98,7 +121,8 @@ size_t add_segments(SegmentMapT& segment_features, const boost::filesystem::path
         }
 
         if (!training && features->size() > max_append_features) {
-            vt.append_cloud(features, indices, false);
+            typename VocabularyT::cloud_ptr_type vocabulary_features = project_training_features<VocabularyT>(features, projection, vocabulary_path, false, whiten);
+            vt.append_cloud(vocabulary_features, indices, false);
             features->clear();
             indices.clear();
         }
@@ -117,7 +141,8 @@ size_t add_segments(SegmentMapT& segment_features, const boost::filesystem::path
 
     // append the rest
     if (features->size() > 0) {
-        vt.append_cloud(features, indices, false);
+        typename VocabularyT::cloud_ptr_type vocabulary_features = project_training_features<VocabularyT>(features, projection, vocabulary_path, false, whiten);
+        vt.append_cloud(vocabulary_features, indices, false);
     }
 
     save_vocabulary(vt, vocabulary_path);
@@ -125,15 +150,11 @@ size_t add_segments(SegmentMapT& segment_features, const boost::filesystem::path
     return counter;
 }
 
-// with some small differences, this could be used instead of the first one
-// add VocabularyT::index_type in the classes
-// also, add an iterator that returns segment and sweep index for segments
-// TODO: we really just need the sweep path map, could use that instead of sweep index map
-template <typename VocabularyT, typename SegmentMapT, typename KeypointMapT, typename SweepIndexMapT, typename SegmentPathMapT>
-pair<size_t, size_t> add_segments_grouped(SegmentMapT& segment_features, KeypointMapT& segment_keypoints,
-                                          SweepIndexMapT& sweep_indices, SegmentPathMapT& segment_paths,
+// the sweeps are read in order with a sweep_reader, all segments of one sweep form one group
+template <typename VocabularyT>
+pair<size_t, size_t> add_segments_grouped(const boost::filesystem::path& data_path, const string& folder_name,
                                           const boost::filesystem::path& vocabulary_path, const vocabulary_summary& summary,
-                                          bool training, const size_t sweep_offset, size_t offset)
+                                          bool training, const size_t sweep_offset, size_t offset, bool whiten)
 {
     size_t min_segment_features = summary.min_segment_features;
     size_t max_training_features = summary.max_training_features;
@@ -141,110 +162,107 @@ pair<size_t, size_t> add_segments_grouped(SegmentMapT& segment_features, Keypoin
 
     VocabularyT vt(vocabulary_path.string());
     vt.set_min_match_depth(3);
+    descriptor_projection<HistT, typename VocabularyT::point_type> projection;
 
     if (!training) {
         load_vocabulary(vt, vocabulary_path);
+        projection.load(vocabulary_path);
     }
 
     HistCloudT::Ptr features(new HistCloudT);
     CloudT::Ptr centroids(new CloudT);
-    vector<set<pair<int, int> > > adjacencies;
-    //vector<pair<int, int> > indices;
+    vector<subgroup_adjacencies> adjacencies;
     vector<typename VocabularyT::index_type> indices;
 
     size_t counter = 0;
-    size_t sweep_i;
     size_t last_sweep = 0;
-    size_t sweep_counter = 0;
-    boost::filesystem::path segment_path;
-    // add an iterator with the segment nbr??? maybe not
-    // but! add an iterator with the sweep nbr!
-    for (auto tup : zip(segment_features, segment_keypoints, sweep_indices, segment_paths)) {
+    sweep_reader reader(data_path, folder_name);
+    vector<segment_record> segments;
+    for (size_t sweep_i = 0; sweep_i < reader.nbr_sweeps(); ++sweep_i) {
 
-        HistCloudT::Ptr features_i;
-        CloudT::Ptr keypoints_i;
-        boost::filesystem::path last_segment = segment_path;
-        tie(features_i, keypoints_i, sweep_i, segment_path) = tup;
+        std::shared_ptr<const sweep_record> sweep = reader.read_sweep(sweep_i);
+        if (sweep->nbr_segments() == 0) {
+            continue;
+        }
+        reader.read_segments(segments, sweep);
 
-        //cout << "Sweep: " << sweep_i << endl;
+        // load the clouds of the sweep in parallel, they are then added in order
+#pragma omp parallel for schedule(dynamic)
+        for (int j = 0; j < int(segments.size()); ++j) {
+            segments[j].features();
+            segments[j].keypoints();
+        }
 
-        // train on a subset of the provided features
-        if (sweep_i != last_sweep) {
+        for (const segment_record& segment : segments) {
+            HistCloudT::Ptr features_i = segment.features();
+            CloudT::Ptr keypoints_i = segment.keypoints();
 
-            if (summary.subsegment_type == "supervoxel" || summary.subsegment_type == "convex_segment") {
-                // is the "segment_path" here actually the new segment, not the last one that we're interested in?
-                adjacencies.push_back(compute_group_adjacencies_supervoxels(last_segment.parent_path()));
-            }
-            else {
-                adjacencies.push_back(compute_group_adjacencies_subsegments(centroids, 0.3f));
-            }
-            centroids->clear();
-
-            if (training && features->size() > max_training_features) {
-                vt.set_input_cloud(features, indices);
-                vt.add_points_from_input_cloud(adjacencies, false);
-                features->clear();
-                indices.clear();
-                adjacencies.clear();
-                training = false;
+            if (features_i->size() < min_segment_features) {
+                ++counter;
+                continue;
             }
 
-            if (!training && features->size() > max_append_features) {
-                cout << "Appending " << features->size() << " points in " << adjacencies.size() << " groups" << endl;
+            Eigen::Vector4f point;
+            pcl::compute3DCentroid(*keypoints_i, point);
+            centroids->push_back(PointT());
+            centroids->back().getVector4fMap() = point;
+            features->insert(features->end(), features_i->begin(), features_i->end());
 
-                cout << adjacencies.size() << endl;
-                cout << features->size() << endl;
-                vt.append_cloud(features, indices, adjacencies, false);
-                features->clear();
-                indices.clear();
-                adjacencies.clear();
+            typename VocabularyT::index_type index(sweep_offset + sweep_i, offset + counter, segment.segment_index());
+            for (size_t i = 0; i < features_i->size(); ++i) {
+                indices.push_back(index);
             }
 
-            last_sweep = sweep_i;
-            sweep_counter = 0;
-        }
-
-        if (features_i->size() < min_segment_features) {
             ++counter;
-            ++sweep_counter;
-            continue;
         }
 
-        Eigen::Vector4f point;
-        pcl::compute3DCentroid(*keypoints_i, point);
-        centroids->push_back(PointT());
-        centroids->back().getVector4fMap() = point;
-        features->insert(features->end(), features_i->begin(), features_i->end());
+        if (summary.subsegment_type == "supervoxel" || summary.subsegment_type == "convex_segment") {
+            adjacencies.push_back(compute_group_adjacencies_supervoxels(sweep->segments_path));
+        }
+        else {
+            adjacencies.push_back(compute_group_adjacencies_subsegments(centroids, 0.3f));
+        }
+        centroids->clear();
+        last_sweep = sweep_i;
 
-        //pair<int, int> index(sweep_offset + sweep_i, offset + counter);
-        typename VocabularyT::index_type index(sweep_offset + sweep_i, offset + counter, sweep_counter);
-        for (size_t i = 0; i < features_i->size(); ++i) {
-            indices.push_back(index);
+        // train on a subset of the provided features
+        if (training && features->size() > max_training_features) {
+            typename VocabularyT::cloud_ptr_type vocabulary_features = project_training_features<VocabularyT>(features, projection, vocabulary_path, true, whiten);
+            vt.set_input_cloud(vocabulary_features, indices);
+            vt.add_points_from_input_cloud(adjacencies, false);
+            features->clear();
+            indices.clear();
+            adjacencies.clear();
+            training = false;
         }
 
-        ++counter;
-        ++sweep_counter;
+        if (!training && features->size() > max_append_features) {
+            cout << "Appending " << features->size() << " points in " << adjacencies.size() << " groups" << endl;
+            typename VocabularyT::cloud_ptr_type vocabulary_features = project_training_features<VocabularyT>(features, projection, vocabulary_path, false, whiten);
+            vt.append_cloud(vocabulary_features, indices, adjacencies, false);
+            features->clear();
+            indices.clear();
+            adjacencies.clear();
+        }
     }
 
     // append the rest
     cout << "Appending " << features->size() << " points in " << adjacencies.size() << " groups" << endl;
 
     if (features->size() > 0) {
-        if (summary.subsegment_type == "supervoxel" || summary.subsegment_type == "convex_segment") {
-            adjacencies.push_back(compute_group_adjacencies_supervoxels(segment_path.parent_path()));
-        }
-        else {
-            adjacencies.push_back(compute_group_adjacencies_subsegments(centroids, 0.3f));
-        }
-        vt.append_cloud(features, indices, adjacencies, false);
+        typename VocabularyT::cloud_ptr_type vocabulary_features = project_training_features<VocabularyT>(features, projection, vocabulary_path, false, whiten);
+        vt.append_cloud(vocabulary_features, indices, adjacencies, false);
     }
 
     save_vocabulary(vt, vocabulary_path);
 
-    return make_pair(counter, sweep_i + 1);
+    return make_pair(counter, last_sweep + 1);
 }
 
-void train_vocabulary(const boost::filesystem::path& vocabulary_path)
+// PointT is the descriptor type of the vocabulary, features are projected
+// into it with a projection fit on the training features if it is not HistT
+template <typename PointT>
+void train_vocabulary(const boost::filesystem::path& vocabulary_path, bool whiten)
 {
     vocabulary_summary summary;
     summary.load(vocabulary_path);
@@ -259,51 +277,31 @@ void train_vocabulary(const boost::filesystem::path& vocabulary_path)
 #endif
 
     if (summary.vocabulary_type == "standard") {
-        convex_feature_cloud_map noise_segment_features(noise_data_path);
-        summary.nbr_noise_segments = add_segments(noise_segment_features, vocabulary_path, summary, true, 0);
+        prefetching_convex_feature_cloud_map noise_segment_features(noise_data_path);
+        summary.nbr_noise_segments = add_segments<vocabulary_tree<PointT, 8> >(noise_segment_features, vocabulary_path, summary, true, 0, whiten);
 #if WITH_NOISE_SET
-        convex_feature_cloud_map annotated_segment_features(annotated_data_path);
-        summary.nbr_annotated_segments = add_segments(annotated_segment_features, vocabulary_path, summary, false, summary.nbr_noise_segments);
+        prefetching_convex_feature_cloud_map annotated_segment_features(annotated_data_path);
+        summary.nbr_annotated_segments = add_segments<vocabulary_tree<PointT, 8> >(annotated_segment_features, vocabulary_path, summary, false, summary.nbr_noise_segments, whiten);
 #endif
     }
     else if (summary.vocabulary_type == "incremental" && summary.subsegment_type == "convex_segment") {
-        convex_feature_cloud_map noise_segment_features(noise_data_path);
-        convex_keypoint_cloud_map noise_segment_keypoints(noise_data_path);
-        convex_sweep_index_map noise_sweep_indices(noise_data_path);
-        convex_segment_map noise_segment_paths(noise_data_path);
         tie(summary.nbr_noise_segments, summary.nbr_noise_sweeps) =
-                add_segments_grouped<grouped_vocabulary_tree<HistT, 8> >(
-                    noise_segment_features, noise_segment_keypoints, noise_sweep_indices,
-                    noise_segment_paths, vocabulary_path, summary, true, 0, 0);
+                add_segments_grouped<grouped_vocabulary_tree<PointT, 8> >(
+                    noise_data_path, "convex_segments", vocabulary_path, summary, true, 0, 0, whiten);
 #if WITH_NOISE_SET
-        convex_feature_cloud_map annotated_segment_features(annotated_data_path);
-        convex_keypoint_cloud_map annotated_segment_keypoints(annotated_data_path);
-        convex_sweep_index_map annotated_sweep_indices(annotated_data_path);
-        convex_segment_map annotated_segment_paths(annotated_data_path);
         tie(summary.nbr_annotated_segments, summary.nbr_annotated_sweeps) =
-                add_segments_grouped<grouped_vocabulary_tree<HistT, 8> >(
-                    annotated_segment_features, annotated_segment_keypoints, annotated_sweep_indices,
-                    annotated_segment_paths, vocabulary_path, summary, false, summary.nbr_noise_sweeps, summary.nbr_noise_segments);
+                add_segments_grouped<grouped_vocabulary_tree<PointT, 8> >(
+                    annotated_data_path, "convex_segments", vocabulary_path, summary, false, summary.nbr_noise_sweeps, summary.nbr_noise_segments, whiten);
 #endif
     }
     else if (summary.vocabulary_type == "incremental") {
-        subsegment_feature_cloud_map noise_segment_features(noise_data_path);
-        subsegment_keypoint_cloud_map noise_segment_keypoints(noise_data_path);
-        subsegment_sweep_index_map noise_sweep_indices(noise_data_path);
-        subsegment_map noise_segment_paths(noise_data_path);
         tie(summary.nbr_noise_segments, summary.nbr_noise_sweeps) =
-                add_segments_grouped<grouped_vocabulary_tree<HistT, 8> >(
-                    noise_segment_features, noise_segment_keypoints, noise_sweep_indices,
-                    noise_segment_paths, vocabulary_path, summary, true, 0, 0);
+                add_segments_grouped<grouped_vocabulary_tree<PointT, 8> >(
+                    noise_data_path, "subsegments", vocabulary_path, summary, true, 0, 0, whiten);
 #if WITH_NOISE_SET
-        subsegment_feature_cloud_map annotated_segment_features(annotated_data_path);
-        subsegment_keypoint_cloud_map annotated_segment_keypoints(annotated_data_path);
-        subsegment_sweep_index_map annotated_sweep_indices(annotated_data_path);
-        subsegment_map annotated_segment_paths(annotated_data_path);
         tie(summary.nbr_annotated_segments, summary.nbr_annotated_sweeps) =
-                add_segments_grouped<grouped_vocabulary_tree<HistT, 8> >(
-                    annotated_segment_features, annotated_segment_keypoints, annotated_sweep_indices,
-                    annotated_segment_paths, vocabulary_path, summary, false, summary.nbr_noise_sweeps, summary.nbr_noise_segments);
+                add_segments_grouped<grouped_vocabulary_tree<PointT, 8> >(
+                    annotated_data_path, "subsegments", vocabulary_path, summary, false, summary.nbr_noise_sweeps, summary.nbr_noise_segments, whiten);
 #endif
     }
 
@@ -313,11 +311,22 @@ void train_vocabulary(const boost::filesystem::path& vocabulary_path)
 int main(int argc, char** argv)
 {
     if (argc < 2) {
-        cout << "Please supply the path containing the vocabulary..." << endl;
+        cout << "Usage: ./dynamic_train_vocabulary /path/to/vocabulary (pca/whiten)" << endl;
         return 0;
     }
 
-    train_vocabulary(boost::filesystem::path(argv[1]));
+    // optionally train on the descriptors projected to PROJECTED_N dimensions
+    string projection_type = argc > 2? string(argv[2]) : string("");
+    if (projection_type == "") {
+        train_vocabulary<HistT>(boost::filesystem::path(argv[1]), false);
+    }
+    else if (projection_type == "pca" || projection_type == "whiten") {
+        train_vocabulary<ProjectedHistT>(boost::filesystem::path(argv[1]), projection_type == "whiten");
+    }
+    else {
+        cout << projection_type << " not a valid projection type..." << endl;
+        return -1;
+    }
 
     return 0;
 }
@@ -12,6 +12,17 @@
 #include <Eigen/Dense>
 #include <Eigen/SVD>
 
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+
 using namespace std;
 
 POINT_CLOUD_REGISTER_POINT_STRUCT (SiftT,
@@ -24,8 +35,9 @@ void crop_cloud(CloudT::Ptr& cloud, const Eigen::Matrix4f& T, const Eigen::Vecto
 {
     // for now, just replace all other points with inf
     // this keeps the structure of the points, which lets us extract sift features later
+    Eigen::RowVector4f plane = p.transpose()*T; // the plane in the frame of the cloud
     for (PointT& point : cloud->points) {
-        if (p.transpose()*T*point.getVector4fMap() > 0.0f) {
+        if (plane.dot(point.getVector4fMap()) > 0.0f) {
             point.x = std::numeric_limits<float>::infinity();
             point.y = std::numeric_limits<float>::infinity();
             point.z = std::numeric_limits<float>::infinity();
@@ -109,18 +121,23 @@ void extract_nonoverlapping_sift(SiftCloudT::Ptr& sweep_features, CloudT::Ptr& s
         {255,237,111}
     };
 
+    // the images are independent, so they are processed in parallel and then added in order
+    vector<SiftCloudT::Ptr> feature_clouds(17);
+    vector<CloudT::Ptr> keypoint_clouds(17);
+
+#pragma omp parallel for schedule(dynamic)
     for (int i = 0; i < 17; ++i) {
         Eigen::Affine3d e;
         tf::transformTFToEigen(transforms[i], e);
 
         cv::Mat img(480, 640, CV_8UC3);
         for (int y = 0; y < 480; ++y) {
+            cv::Vec3b* row = img.ptr<cv::Vec3b>(y);
+            const PointT* points = &cropped_clouds[i]->points[y*640];
             for (int x = 0; x < 640; ++x) {
-                int ind = y*640+x;
-                cv::Vec3b& c = img.at<cv::Vec3b>(y, x);
-                c[2] = cropped_clouds[i]->at(ind).r;
-                c[1] = cropped_clouds[i]->at(ind).g;
-                c[0] = cropped_clouds[i]->at(ind).b;
+                row[x][2] = points[x].r;
+                row[x][1] = points[x].g;
+                row[x][0] = points[x].b;
             }
         }
         cv::FastFeatureDetector detector;
@@ -136,6 +153,8 @@ void extract_nonoverlapping_sift(SiftCloudT::Ptr& sweep_features, CloudT::Ptr& s
 
         SiftCloudT::Ptr feature_cloud(new SiftCloudT);
         CloudT::Ptr keypoint_cloud(new CloudT);
+        feature_cloud->reserve(keypoints.size());
+        keypoint_cloud->reserve(keypoints.size());
         int j = 0;
         for (cv::KeyPoint k : keypoints) {
             const cv::Point2f& p2 = k.pt;
@@ -148,16 +167,20 @@ void extract_nonoverlapping_sift(SiftCloudT::Ptr& sweep_features, CloudT::Ptr& s
                 newp.b = colormap[i%24][2];
                 keypoint_cloud->push_back(newp);
                 SiftT sp;
-                for (int k = 0; k < 128; ++k) {
-                    sp.histogram[k] = descriptors.at<float>(j, k);
-                }
+                const float* descriptor = descriptors.ptr<float>(j);
+                std::copy(descriptor, descriptor + 128, sp.histogram);
                 feature_cloud->push_back(sp);
             }
             ++j;
         }
 
-        *sweep_features += *feature_cloud;
-        *sweep_keypoints += *keypoint_cloud;
+        feature_clouds[i] = feature_cloud;
+        keypoint_clouds[i] = keypoint_cloud;
+    }
+
+    for (int i = 0; i < 17; ++i) {
+        *sweep_features += *feature_clouds[i];
+        *sweep_keypoints += *keypoint_clouds[i];
     }
 }
 
@@ -174,6 +197,9 @@ void extract_sift_for_sweep(const boost::filesystem::path& xml_path, bool visual
         cropped_clouds.push_back(CloudT::Ptr(new CloudT(*c)));
     }
 
+    // the cutting planes between all neighbouring scans, plane i is between scan i and i+1
+    vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f> > planes(17);
+    vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > scan_transforms(17);
     for (int i = 0; i < 17; ++i) {
         // check overlap with i+1 mod size, also cut based on previous comparison
         int next = (i+1)%17;
@@ -203,8 +229,16 @@ void extract_sift_for_sweep(const boost::filesystem::path& xml_path, bool visual
         p.head<3>() = normal;
         p(3) = d;
 
-        crop_cloud(cropped_clouds[i], current_transform, p);
-        crop_cloud(cropped_clouds[next], next_transform, -p);
+        planes[i] = p;
+        scan_transforms[i] = current_transform;
+    }
+
+    // every scan is cut by the planes towards both of its neighbours, the scans can be cut in parallel
+#pragma omp parallel for
+    for (int i = 0; i < 17; ++i) {
+        int previous = (i+16)%17;
+        crop_cloud(cropped_clouds[i], scan_transforms[i], planes[i]);
+        crop_cloud(cropped_clouds[i], scan_transforms[i], -planes[previous]);
     }
 
     //visualize_nonoverlapping(cropped_clouds, data.vIntermediateRoomCloudTransforms);
@@ -219,6 +253,8 @@ void extract_sift_for_sweep(const boost::filesystem::path& xml_path, bool visual
 
     pcl::io::savePCDFileBinary((xml_path.parent_path() / "sift_features.pcd").string(), *sweep_features);
     pcl::io::savePCDFileBinary((xml_path.parent_path() / "sift_keypoints.pcd").string(), *sweep_keypoints);
+
+    save_segment_sift_for_sweep(xml_path.parent_path());
 }
 
 tuple<cv::Mat, cv::Mat, int, int> compute_image_for_cloud(CloudT::Ptr& cloud, const Eigen::Matrix3f& K)
@@ -419,6 +455,27 @@ tuple<SiftCloudT::Ptr, CloudT::Ptr, CloudT::Ptr> get_sift_for_cloud_path(const v
     return make_tuple(tup.first, tup.second, cloud);
 }
 
+// the indices of the sweep sift keypoints that are close enough to a point in cloud
+vector<uint32_t> overlapping_sift_indices(CloudT::Ptr& keypoints, CloudT::Ptr& cloud)
+{
+    // now we should check the intersection using e.g. an octree
+    // pick all the sift keypoints close enough to a point in keypoints
+    pcl::octree::OctreePointCloudSearch<PointT> octree(0.1f);
+    octree.setInputCloud(cloud);
+    octree.addPointsFromInputCloud();
+
+    vector<uint32_t> indices;
+    uint32_t counter = 0;
+    for (const PointT& p : keypoints->points) {
+        if (octree.isVoxelOccupiedAtPoint(p)) {
+            indices.push_back(counter);
+        }
+        ++counter;
+    }
+
+    return indices;
+}
+
 pair<SiftCloudT::Ptr, CloudT::Ptr> get_sift_for_cloud_path(const boost::filesystem::path& cloud_path, CloudT::Ptr& cloud)
 {
     boost::filesystem::path sweep_path = cloud_path.parent_path().parent_path();
@@ -432,24 +489,299 @@ pair<SiftCloudT::Ptr, CloudT::Ptr> get_sift_for_cloud_path(const boost::filesyst
     *vis_cloud += *cloud;
     //dynamic_object_retrieval::visualize(vis_cloud);
 
-    // now we should check the intersection using e.g. an octree
-    // pick all the sift keypoints close enough to a point in keypoints
-    pcl::octree::OctreePointCloudSearch<PointT> octree(0.1f);
-    octree.setInputCloud(cloud);
-    octree.addPointsFromInputCloud();
-
     SiftCloudT::Ptr overlapping_features(new SiftCloudT);
     CloudT::Ptr overlapping_keypoints(new CloudT);
-    int counter = 0;
-    for (const PointT& p : keypoints->points) {
-        if (octree.isVoxelOccupiedAtPoint(p)) {
-            overlapping_features->push_back(features->at(counter));
-            overlapping_keypoints->push_back(p);
-        }
-        ++counter;
+    for (uint32_t i : overlapping_sift_indices(keypoints, cloud)) {
+        overlapping_features->push_back(features->at(i));
+        overlapping_keypoints->push_back(keypoints->at(i));
     }
 
     return make_pair(overlapping_features, overlapping_keypoints);
 }
 
+// the sift features of all segments and subsegments of a sweep are stored after each other in
+// sift_segments.cereal, and sift_segments.index maps the segments to where they start in that file.
+// this way, re-weighting only needs to read the features of the segments that were retrieved
+struct segment_sift {
+    vector<uint32_t> indices; // indices of the keypoints in sift_keypoints.pcd, sorted
+    vector<float> features; // 128 values per keypoint
+    vector<float> keypoints; // x, y, z, rgb per keypoint
+
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+        archive(indices, features, keypoints);
+    }
+};
+
+// keys are the segment paths relative to the sweep folder, e.g. convex_segments/segment0000.pcd
+using segment_sift_index = map<string, uint64_t>;
+
+string segment_sift_key(const boost::filesystem::path& segment_path)
+{
+    return (segment_path.parent_path().filename() / segment_path.filename()).string();
+}
+
+void save_segment_sift_for_sweep(const boost::filesystem::path& sweep_path)
+{
+    SiftCloudT::Ptr features(new SiftCloudT);
+    CloudT::Ptr keypoints(new CloudT);
+    if (pcl::io::loadPCDFile((sweep_path / "sift_features.pcd").string(), *features) == -1 ||
+        pcl::io::loadPCDFile((sweep_path / "sift_keypoints.pcd").string(), *keypoints) == -1) {
+        cout << "Could not find the sift features of " << sweep_path.string() << ", not storing segment features" << endl;
+        return;
+    }
+
+    segment_sift_index index;
+    ofstream outd((sweep_path / "sift_segments.cereal").string(), ios::binary);
+    for (const pair<string, string>& folder : { make_pair(string("convex_segments"), string("segment")),
+                                                make_pair(string("subsegments"), string("pfhrgbkeypoint")) }) {
+        boost::filesystem::path segments_path = sweep_path / folder.first;
+        if (!boost::filesystem::is_directory(segments_path)) {
+            continue;
+        }
+        for (boost::filesystem::directory_iterator it(segments_path), end; it != end; ++it) {
+            boost::filesystem::path segment_path = it->path();
+            if (segment_path.extension() != ".pcd" || segment_path.stem().string().compare(0, folder.second.size(), folder.second) != 0) {
+                continue;
+            }
+            CloudT::Ptr cloud(new CloudT);
+            if (pcl::io::loadPCDFile(segment_path.string(), *cloud) == -1 || cloud->empty()) {
+                continue;
+            }
+
+            segment_sift data;
+            data.indices = overlapping_sift_indices(keypoints, cloud);
+            data.features.reserve(128*data.indices.size());
+            data.keypoints.reserve(4*data.indices.size());
+            for (uint32_t i : data.indices) {
+                const SiftT& f = features->at(i);
+                data.features.insert(data.features.end(), f.histogram, f.histogram + 128);
+                const PointT& p = keypoints->at(i);
+                data.keypoints.insert(data.keypoints.end(), { p.x, p.y, p.z, p.rgb });
+            }
+
+            index[segment_sift_key(segment_path)] = uint64_t(outd.tellp());
+            cereal::BinaryOutputArchive archive_o(outd);
+            archive_o(data);
+        }
+    }
+    outd.close();
+
+    // the index is written last, so an interrupted extraction leaves no index and the features are cropped at query time
+    ofstream outi((sweep_path / "sift_segments.index").string(), ios::binary);
+    {
+        cereal::BinaryOutputArchive archive_o(outi);
+        archive_o(index);
+    }
+    cout << "Stored sift features of " << index.size() << " segments in " << sweep_path.string() << endl;
+}
+
+// merges the stored features of several segments into one cloud, the segments may share
+// keypoints so they are merged by their index in the sweep
+pair<SiftCloudT::Ptr, CloudT::Ptr> merge_segment_sift(const vector<shared_ptr<const segment_sift> >& segments)
+{
+    vector<tuple<uint32_t, size_t, size_t> > keypoint_segments; // sweep index, segment, position in segment
+    for (size_t i = 0; i < segments.size(); ++i) {
+        for (size_t j = 0; j < segments[i]->indices.size(); ++j) {
+            keypoint_segments.push_back(make_tuple(segments[i]->indices[j], i, j));
+        }
+    }
+    std::sort(keypoint_segments.begin(), keypoint_segments.end());
+
+    SiftCloudT::Ptr features(new SiftCloudT);
+    CloudT::Ptr keypoints(new CloudT);
+    features->reserve(keypoint_segments.size());
+    keypoints->reserve(keypoint_segments.size());
+    for (size_t k = 0; k < keypoint_segments.size(); ++k) {
+        uint32_t index;
+        size_t i, j;
+        tie(index, i, j) = keypoint_segments[k];
+        if (k > 0 && get<0>(keypoint_segments[k-1]) == index) {
+            continue;
+        }
+        SiftT f;
+        std::copy(segments[i]->features.begin() + 128*j, segments[i]->features.begin() + 128*(j+1), f.histogram);
+        features->push_back(f);
+        PointT p;
+        p.x = segments[i]->keypoints[4*j];
+        p.y = segments[i]->keypoints[4*j+1];
+        p.z = segments[i]->keypoints[4*j+2];
+        p.rgb = segments[i]->keypoints[4*j+3];
+        keypoints->push_back(p);
+    }
+
+    return make_pair(features, keypoints);
+}
+
+indexed_sift make_indexed_sift(const pair<SiftCloudT::Ptr, CloudT::Ptr>& sift)
+{
+    indexed_sift indexed;
+    tie(indexed.features, indexed.keypoints) = sift;
+    indexed.index = make_shared<const sift_descriptor_index>(indexed.features);
+    return indexed;
+}
+
+// the stored features of a segment, the clouds and the index are only built
+// the first time the segment is registered on its own
+struct cached_segment_sift {
+    shared_ptr<const segment_sift> data;
+    once_flag indexed_flag;
+    indexed_sift indexed;
+
+    const indexed_sift& get_indexed()
+    {
+        call_once(indexed_flag, [this]() {
+            indexed = make_indexed_sift(merge_segment_sift({ data }));
+        });
+        return indexed;
+    }
+};
+
+// keeps the indices of the sweeps and the most recently used segment features in memory,
+// since the same segments are often retrieved by consecutive queries
+class segment_sift_cache {
+protected:
+
+    struct sweep_index {
+        time_t version; // modification time of the index file
+        segment_sift_index offsets;
+    };
+
+    using entry = pair<string, pair<time_t, shared_ptr<cached_segment_sift> > >;
+
+    size_t capacity;
+    mutex cache_mutex;
+    unordered_map<string, shared_ptr<const sweep_index> > sweep_indices;
+    list<entry> entries; // most recently used first
+    unordered_map<string, list<entry>::iterator> entry_lookup;
+
+    shared_ptr<const sweep_index> get_sweep_index(const boost::filesystem::path& sweep_path)
+    {
+        boost::filesystem::path index_path = sweep_path / "sift_segments.index";
+        if (!boost::filesystem::exists(index_path)) {
+            return shared_ptr<const sweep_index>();
+        }
+        time_t version = boost::filesystem::last_write_time(index_path);
+
+        lock_guard<mutex> lock(cache_mutex);
+        shared_ptr<const sweep_index>& cached = sweep_indices[sweep_path.string()];
+        if (!cached || cached->version != version) {
+            shared_ptr<sweep_index> loaded = make_shared<sweep_index>();
+            loaded->version = version;
+            ifstream in(index_path.string(), ios::binary);
+            {
+                cereal::BinaryInputArchive archive_i(in);
+                archive_i(loaded->offsets);
+            }
+            cached = loaded;
+        }
+        return cached;
+    }
+
+public:
+
+    // returns null if the segment is not in the store
+    shared_ptr<cached_segment_sift> get(const boost::filesystem::path& segment_path)
+    {
+        boost::filesystem::path sweep_path = segment_path.parent_path().parent_path();
+        shared_ptr<const sweep_index> index = get_sweep_index(sweep_path);
+        if (!index) {
+            return shared_ptr<cached_segment_sift>();
+        }
+        segment_sift_index::const_iterator offset = index->offsets.find(segment_sift_key(segment_path));
+        if (offset == index->offsets.end()) {
+            return shared_ptr<cached_segment_sift>();
+        }
+
+        string key = segment_path.string();
+        {
+            lock_guard<mutex> lock(cache_mutex);
+            auto iter = entry_lookup.find(key);
+            if (iter != entry_lookup.end() && iter->second->second.first == index->version) {
+                entries.splice(entries.begin(), entries, iter->second);
+                return iter->second->second.second;
+            }
+        }
+
+        // read outside the lock, several threads may be loading different segments
+        shared_ptr<segment_sift> data = make_shared<segment_sift>();
+        ifstream in((sweep_path / "sift_segments.cereal").string(), ios::binary);
+        in.seekg(offset->second);
+        {
+            cereal::BinaryInputArchive archive_i(in);
+            archive_i(*data);
+        }
+        shared_ptr<cached_segment_sift> cached = make_shared<cached_segment_sift>();
+        cached->data = data;
+
+        lock_guard<mutex> lock(cache_mutex);
+        auto iter = entry_lookup.find(key);
+        if (iter != entry_lookup.end()) {
+            entries.erase(iter->second);
+        }
+        entries.push_front(make_pair(key, make_pair(index->version, cached)));
+        entry_lookup[key] = entries.begin();
+        if (entries.size() > capacity) {
+            entry_lookup.erase(entries.back().first);
+            entries.pop_back();
+        }
+        return cached;
+    }
+
+    segment_sift_cache(size_t capacity) : capacity(capacity) {}
+};
+
+segment_sift_cache& get_segment_sift_cache()
+{
+    static segment_sift_cache cache(512);
+    return cache;
+}
+
+pair<SiftCloudT::Ptr, CloudT::Ptr> get_sift_for_segment_path(const vector<boost::filesystem::path>& segment_paths)
+{
+    vector<shared_ptr<const segment_sift> > segments;
+    for (const boost::filesystem::path& segment_path : segment_paths) {
+        shared_ptr<cached_segment_sift> cached = get_segment_sift_cache().get(segment_path);
+        if (!cached) {
+            SiftCloudT::Ptr features;
+            CloudT::Ptr keypoints;
+            CloudT::Ptr cloud;
+            if (segment_paths.size() == 1) {
+                tie(features, keypoints, cloud) = get_sift_for_cloud_path(segment_paths[0]);
+            }
+            else {
+                tie(features, keypoints, cloud) = get_sift_for_cloud_path(segment_paths);
+            }
+            return make_pair(features, keypoints);
+        }
+        segments.push_back(cached->data);
+    }
+
+    return merge_segment_sift(segments);
+}
+
+pair<SiftCloudT::Ptr, CloudT::Ptr> get_sift_for_segment_path(const boost::filesystem::path& segment_path)
+{
+    return get_sift_for_segment_path(vector<boost::filesystem::path>{ segment_path });
+}
+
+indexed_sift get_indexed_sift_for_segment_path(const boost::filesystem::path& segment_path)
+{
+    shared_ptr<cached_segment_sift> cached = get_segment_sift_cache().get(segment_path);
+    if (!cached) {
+        return make_indexed_sift(get_sift_for_segment_path(segment_path));
+    }
+    return cached->get_indexed();
+}
+
+indexed_sift get_indexed_sift_for_segment_path(const vector<boost::filesystem::path>& segment_paths)
+{
+    if (segment_paths.size() == 1) {
+        return get_indexed_sift_for_segment_path(segment_paths[0]);
+    }
+    // a group of segments is merged for every query, so its index is not kept
+    return make_indexed_sift(get_sift_for_segment_path(segment_paths));
+}
+
 } // namespace extract_sift
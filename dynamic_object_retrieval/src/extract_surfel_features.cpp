@@ -1,15 +1,15 @@
 #include "dynamic_object_retrieval/extract_surfel_features.h"
+#include "object_3d_retrieval/feature_pipeline.h"
 
 #include <pcl/kdtree/impl/kdtree_flann.hpp>
-#include <pcl/features/pfhrgb.h>
-#include <pcl/features/normal_3d_omp.h>
 #include <pcl/visualization/pcl_visualizer.h>
 
-#include <pcl/keypoints/iss_3d.h>
-#include <pcl/keypoints/uniform_sampling.h>
-
 #include <pcl/octree/octree.h>
 
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
 using namespace std;
 
 namespace dynamic_object_retrieval {
@@ -46,74 +46,28 @@ float compute_cloud_volume_features(CloudT::Ptr& cloud)
 void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud,
                       NormalCloudT::Ptr& normals, bool do_visualize, bool is_query)
 {
-    pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>);
-
-    //  ISS3D parameters
-    double iss_salient_radius_;
-    double iss_non_max_radius_;
-    double iss_normal_radius_;
-    double iss_border_radius_;
-    double iss_gamma_21_ (saliency_threshold); // 0.975 orig
-    double iss_gamma_32_ (saliency_threshold); // 0.975 orig
-    double iss_min_neighbors_ (5);
-    int iss_threads_ (3);
-
-    pcl::IndicesPtr indices(new std::vector<int>);
-
     double volume = compute_cloud_volume_features(cloud);
+    bool use_iss = is_query || volume < density_threshold_volume;
 
-    if (is_query || volume < density_threshold_volume) {
-
-        // Fill in the model cloud
-        double model_resolution = 0.007; // 0.003 before
-
-        // Compute model_resolution
-        iss_salient_radius_ = 6 * model_resolution;
-        iss_non_max_radius_ = 4 * model_resolution;
-        iss_normal_radius_ = 4 * model_resolution;
-        iss_border_radius_ = 0.5 * model_resolution; // 1
-
-        //
-        // Compute keypoints
-        //
-        pcl::ISSKeypoint3D<PointT, PointT> iss_detector;
-        iss_detector.setSearchMethod(tree);
-        iss_detector.setSalientRadius(iss_salient_radius_);
-        iss_detector.setNonMaxRadius(iss_non_max_radius_);
-
-        iss_detector.setNormalRadius(iss_normal_radius_); // comment these two if not to use border removal
-        iss_detector.setBorderRadius(iss_border_radius_); // comment these two if not to use border removal
-
-        iss_detector.setThreshold21(iss_gamma_21_);
-        iss_detector.setThreshold32(iss_gamma_32_);
-        iss_detector.setMinNeighbors(iss_min_neighbors_);
-        iss_detector.setNumberOfThreads(iss_threads_);
-        iss_detector.setInputCloud(cloud);
-        iss_detector.setNormals(normals);
-        iss_detector.compute(*keypoints);
-
-        pcl::KdTreeFLANN<PointT> kdtree; // might be possible to just use the other tree here
-        kdtree.setInputCloud(cloud);
-        for (const PointT& k : keypoints->points) {
-            std::vector<int> ind;
-            std::vector<float> dist;
-            kdtree.nearestKSearchT(k, 1, ind, dist);
-            //cout << "Keypoint threshold: " << k.rgb << endl;
-            indices->push_back(ind[0]);
+    //  ISS3D parameters
+    double model_resolution = 0.007; // 0.003 before
+    pfhrgb_estimation::iss_parameters iss_params(model_resolution, saliency_threshold);
+
+    std::vector<int> indices;
+    std::unique_ptr<pfhrgb_estimation::feature_pipeline> pipeline;
+    if (use_iss) {
+        // the normals come from the surfels, so only ISS needs the neighborhoods of all the points,
+        // the descriptors search their keypoints again if their radius is larger
+        pipeline.reset(new pfhrgb_estimation::feature_pipeline(cloud, iss_params.salient_radius));
+        pipeline->compute_iss_keypoints(indices, iss_params, normals);
+        for (int ind : indices) {
+            keypoints->push_back(cloud->at(ind));
         }
     }
     else {
-        pcl::PointCloud<int>::Ptr keypoints_ind(new pcl::PointCloud<int>);
-        pcl::UniformSampling<PointT> us_detector;
-        us_detector.setRadiusSearch(0.04);
-        us_detector.setSearchMethod(tree);
-        us_detector.setInputCloud(cloud);
-        us_detector.compute(*keypoints_ind);
-
-        for (int ind : keypoints_ind->points) {
-            keypoints->push_back(cloud->at(ind));
-            indices->push_back(ind);
-        }
+        // the normals come from the surfels, so we only need the neighborhoods of the keypoints
+        pfhrgb_estimation::compute_uniform_keypoints(indices, keypoints, cloud, 0.04);
+        pipeline.reset(new pfhrgb_estimation::feature_pipeline(cloud, 0.04, indices));
     }
 
     if (do_visualize) {
@@ -127,57 +81,127 @@ void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT:
     }
     // ISS3D
 
-    // PFHRGB
-    pcl::PFHRGBEstimation<PointT, NormalT> se;
-    se.setSearchMethod(tree);
-    //se.setKSearch(100);
-    se.setIndices(indices); //keypoints
-    se.setInputCloud(cloud);
-    se.setInputNormals(normals);
-    se.setRadiusSearch(0.04); //support 0.06 orig, 0.04 still seems too big, takes time
-
-    pcl::PointCloud<pcl::PFHRGBSignature250> pfhrgb_cloud;
-    se.compute(pfhrgb_cloud); //descriptors
-
-    const int N = 250;
-    features->resize(pfhrgb_cloud.size());
-    for (size_t i = 0; i < pfhrgb_cloud.size(); ++i) {
-        std::copy(pfhrgb_cloud.at(i).histogram, pfhrgb_cloud.at(i).histogram+N, features->at(i).histogram);
+    // PFHRGB, the features have the same layout as the pfhrgb histograms
+    pipeline->compute_pfhrgb_features(features, indices, normals, 0.04); //support 0.06 orig, 0.04 still seems too big, takes time
+
+    std::cout << "Number of features: " << features->size() << std::endl;
+}
+
+surfel_normal_index::surfel_normal_index(const SurfelCloudT::Ptr& surfel_map, float voxel_size) :
+    surfel_map(surfel_map), voxel_size(voxel_size)
+{
+    vector<pair<uint64_t, uint32_t> > keyed;
+    keyed.reserve(surfel_map->size());
+    for (size_t i = 0; i < surfel_map->size(); ++i) {
+        const SurfelT& s = surfel_map->points[i];
+        if (!pcl::isFinite(s)) {
+            continue;
+        }
+        keyed.push_back(make_pair(voxel_key(int(floor(s.x/voxel_size)), int(floor(s.y/voxel_size)),
+                                            int(floor(s.z/voxel_size))), uint32_t(i)));
+    }
+    sort(keyed.begin(), keyed.end());
+
+    sorted_indices.resize(keyed.size());
+    voxels.reserve(keyed.size() / 4);
+    for (size_t i = 0; i < keyed.size(); ) {
+        size_t j = i;
+        for (; j < keyed.size() && keyed[j].first == keyed[i].first; ++j) {
+            sorted_indices[j] = keyed[j].second;
+        }
+        voxels[keyed[i].first] = make_pair(uint32_t(i), uint32_t(j));
+        i = j;
     }
+}
 
-    std::cout << "Number of features: " << pfhrgb_cloud.size() << std::endl;
+// 21 bits per axis, the keys are unique within +-2^20 voxels, i.e. +-20km with the default 2cm voxels.
+// further out two voxels may share a key, the distance check in nearest_surfel skips the wrong surfels then
+uint64_t surfel_normal_index::voxel_key(int x, int y, int z) const
+{
+    const uint64_t mask = (uint64_t(1) << 21) - 1;
+    return (uint64_t(x) & mask) | ((uint64_t(y) & mask) << 21) | ((uint64_t(z) & mask) << 42);
 }
 
-NormalCloudT::Ptr compute_surfel_normals(SurfelCloudT::Ptr& surfel_cloud, CloudT::Ptr& segment)
+int surfel_normal_index::nearest_surfel(const PointT& p) const
 {
-    pcl::KdTreeFLANN<SurfelT> kdtree;
-    kdtree.setInputCloud(surfel_cloud);
+    int vx = int(floor(p.x/voxel_size));
+    int vy = int(floor(p.y/voxel_size));
+    int vz = int(floor(p.z/voxel_size));
+
+    int best = -1;
+    float best_dist = voxel_size*voxel_size;
+    for (int dx = -1; dx <= 1; ++dx) {
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dz = -1; dz <= 1; ++dz) {
+                auto it = voxels.find(voxel_key(vx+dx, vy+dy, vz+dz));
+                if (it == voxels.end()) {
+                    continue;
+                }
+                for (uint32_t k = it->second.first; k < it->second.second; ++k) {
+                    const SurfelT& s = surfel_map->points[sorted_indices[k]];
+                    float dist = (s.x-p.x)*(s.x-p.x) + (s.y-p.y)*(s.y-p.y) + (s.z-p.z)*(s.z-p.z);
+                    if (dist <= best_dist) {
+                        best_dist = dist;
+                        best = sorted_indices[k];
+                    }
+                }
+            }
+        }
+    }
+
+    // anything within one voxel is in the neighbouring voxels, so this is the nearest surfel
+    if (best != -1) {
+        return best;
+    }
+
+    call_once(kdtree_flag, [this] { kdtree.setInputCloud(surfel_map); });
+    vector<int> indices;
+    vector<float> distances;
+    SurfelT s; s.x = p.x; s.y = p.y; s.z = p.z;
+    kdtree.nearestKSearchT(s, 1, indices, distances);
+    if (distances.empty()) {
+        cout << "Distances empty, wtf??" << endl;
+        exit(0);
+    }
+    return indices[0];
+}
 
+NormalCloudT::Ptr surfel_normal_index::compute_normals(const CloudT& segment) const
+{
     NormalCloudT::Ptr normals(new NormalCloudT);
-    normals->reserve(segment->size());
-    for (const PointT& p : segment->points) {
+    normals->reserve(segment.size());
+    for (const PointT& p : segment.points) {
         if (!pcl::isFinite(p)) {
             NormalT crap; crap.normal_x = 0; crap.normal_y = 0; crap.normal_z = 0;
             normals->push_back(crap);
             continue;
         }
-        vector<int> indices;
-        vector<float> distances;
-        SurfelT s; s.x = p.x; s.y = p.y; s.z = p.z;
-        kdtree.nearestKSearchT(s, 1, indices, distances);
-        if (distances.empty()) {
-            cout << "Distances empty, wtf??" << endl;
-            exit(0);
-        }
-        SurfelT q = surfel_cloud->at(indices[0]);
+        const SurfelT& q = surfel_map->points[nearest_surfel(p)];
         NormalT n; n.normal_x = q.normal_x; n.normal_y = q.normal_y; n.normal_z = q.normal_z;
         normals->push_back(n);
-
     }
 
     return normals;
 }
 
+NormalCloudT::Ptr compute_surfel_normals(const surfel_normal_index& surfel_index, CloudT::Ptr& segment)
+{
+    return surfel_index.compute_normals(*segment);
+}
+
+NormalCloudT::Ptr compute_surfel_normals(SurfelCloudT::Ptr& surfel_cloud, CloudT::Ptr& segment)
+{
+    surfel_normal_index surfel_index(surfel_cloud);
+    return surfel_index.compute_normals(*segment);
+}
+
+void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
+                      CloudT::Ptr& cloud, const surfel_normal_index& surfel_index, bool visualize_features)
+{
+    NormalCloudT::Ptr normals = surfel_index.compute_normals(*cloud);
+    compute_features(features, keypoints, cloud, normals, visualize_features);
+}
+
 void compute_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
                       CloudT::Ptr& cloud, SurfelCloudT::Ptr& surfel_map, bool visualize_features)
 {
@@ -192,6 +216,13 @@ void compute_query_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
     compute_features(features, keypoints, cloud, normals, visualize_features, true);
 }
 
+void compute_query_features(HistCloudT::Ptr& features, CloudT::Ptr& keypoints,
+                            CloudT::Ptr& cloud, const surfel_normal_index& surfel_index, bool visualize_features)
+{
+    NormalCloudT::Ptr normals = surfel_index.compute_normals(*cloud);
+    compute_features(features, keypoints, cloud, normals, visualize_features, true);
+}
+
 // this is only for the querying
 /*
 pair<CloudT::Ptr, NormalCloudT::Ptr>
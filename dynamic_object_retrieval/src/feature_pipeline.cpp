@@ -0,0 +1,456 @@
+#include "object_3d_retrieval/feature_pipeline.h"
+
+#include <pcl/search/kdtree.h>
+#include <pcl/common/centroid.h>
+#include <pcl/features/normal_3d.h>
+#include <Eigen/Eigenvalues>
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+#include <numeric>
+
+namespace pfhrgb_estimation {
+
+using namespace std;
+
+void neighborhood_cache::compute(const CloudT::Ptr& cloud, const vector<int>& point_indices)
+{
+    pcl::search::KdTree<PointT> tree;
+    tree.setSortedResults(true);
+    tree.setInputCloud(cloud);
+
+    // first pass, the points are searched in chunks and the neighborhoods of a chunk
+    // are appended to one buffer, so we only need the sizes to know where they go
+    const int chunk_size = 256;
+    const int nbr_chunks = (int(point_indices.size()) + chunk_size - 1) / chunk_size;
+    vector<vector<int> > chunk_indices(nbr_chunks);
+    vector<vector<float> > chunk_distances(nbr_chunks);
+    vector<size_t> counts(cloud->size(), 0);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < nbr_chunks; ++c) {
+        vector<int> neighbors;
+        vector<float> distances;
+        int last = std::min(int(point_indices.size()), (c + 1)*chunk_size);
+        for (int j = c*chunk_size; j < last; ++j) {
+            int i = point_indices[j];
+            if (!pcl::isFinite(cloud->points[i])) {
+                continue;
+            }
+            tree.radiusSearch(cloud->points[i], radius, neighbors, distances);
+            counts[i] = neighbors.size();
+            chunk_indices[c].insert(chunk_indices[c].end(), neighbors.begin(), neighbors.end());
+            chunk_distances[c].insert(chunk_distances[c].end(), distances.begin(), distances.end());
+        }
+    }
+
+    offsets.resize(cloud->size() + 1);
+    offsets[0] = 0;
+    for (size_t i = 0; i < cloud->size(); ++i) {
+        offsets[i+1] = offsets[i] + counts[i];
+    }
+
+    // second pass, the buffers of the chunks are copied into place
+    indices.resize(offsets.back());
+    sqr_distances.resize(offsets.back());
+#pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < nbr_chunks; ++c) {
+        size_t pos = 0;
+        int last = std::min(int(point_indices.size()), (c + 1)*chunk_size);
+        for (int j = c*chunk_size; j < last; ++j) {
+            int i = point_indices[j];
+            copy(chunk_indices[c].begin() + pos, chunk_indices[c].begin() + pos + counts[i], indices.begin() + offsets[i]);
+            copy(chunk_distances[c].begin() + pos, chunk_distances[c].begin() + pos + counts[i], sqr_distances.begin() + offsets[i]);
+            pos += counts[i];
+        }
+        vector<int>().swap(chunk_indices[c]);
+        vector<float>().swap(chunk_distances[c]);
+    }
+}
+
+neighborhood_cache::neighborhood_cache(const CloudT::Ptr& cloud, double radius) : radius(radius)
+{
+    vector<int> point_indices(cloud->size());
+    iota(point_indices.begin(), point_indices.end(), 0);
+    compute(cloud, point_indices);
+}
+
+neighborhood_cache::neighborhood_cache(const CloudT::Ptr& cloud, double radius, const vector<int>& point_indices) : radius(radius)
+{
+    compute(cloud, point_indices);
+}
+
+const int* neighborhood_cache::neighbors_end(int i, double r) const
+{
+    if (r >= radius) {
+        return indices.data() + offsets[i+1];
+    }
+    // same as the kd-tree, only points strictly within the radius
+    const float* first = sqr_distances.data() + offsets[i];
+    const float* last = sqr_distances.data() + offsets[i+1];
+    return indices.data() + (lower_bound(first, last, float(r*r)) - sqr_distances.data());
+}
+
+void neighborhood_cache::get_neighbors(vector<int>& neighbors, int i, double r) const
+{
+    neighbors.assign(neighbors_begin(i), neighbors_end(i, r));
+}
+
+NormalCloudT::Ptr feature_pipeline::compute_normals(double radius) const
+{
+    NormalCloudT::Ptr normals(new NormalCloudT);
+    normals->resize(cloud->size());
+    normals->is_dense = true;
+
+    // the same as NormalEstimation, which flips the normals towards the sensor origin
+    const Eigen::Vector4f& vp = cloud->sensor_origin_;
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < int(cloud->size()); ++i) {
+        NormalT& n = normals->points[i];
+        vector<int> nn_indices;
+        neighborhoods.get_neighbors(nn_indices, i, radius);
+
+        Eigen::Matrix3f covariance;
+        Eigen::Vector4f centroid;
+        if (nn_indices.size() < 3 || pcl::computeMeanAndCovarianceMatrix(*cloud, nn_indices, covariance, centroid) == 0) {
+            n.normal_x = n.normal_y = n.normal_z = n.curvature = std::numeric_limits<float>::quiet_NaN();
+            normals->is_dense = false;
+            continue;
+        }
+        pcl::solvePlaneParameters(covariance, n.normal_x, n.normal_y, n.normal_z, n.curvature);
+        pcl::flipNormalTowardsViewpoint(cloud->points[i], vp(0), vp(1), vp(2), n.normal_x, n.normal_y, n.normal_z);
+    }
+
+    return normals;
+}
+
+// same as pcl::BoundaryEstimation, the point is on the border if there
+// is a large gap in the angles of the neighbors around the normal
+bool is_boundary_point(const CloudT& cloud, int i, const int* first, const int* last,
+                       const NormalT& normal, float angle_threshold)
+{
+    if (last - first < 3) {
+        return false;
+    }
+
+    Eigen::Vector4f n = normal.getNormalVector4fMap();
+    Eigen::Vector4f v = n.unitOrthogonal();
+    Eigen::Vector4f u = n.cross3(v);
+
+    vector<float> angles;
+    angles.reserve(last - first);
+    for (const int* j = first; j != last; ++j) {
+        Eigen::Vector4f delta = cloud.points[*j].getVector4fMap() - cloud.points[i].getVector4fMap();
+        if (delta == Eigen::Vector4f::Zero()) {
+            continue;
+        }
+        angles.push_back(atan2f(v.dot(delta), u.dot(delta)));
+    }
+    if (angles.empty()) {
+        return false;
+    }
+    sort(angles.begin(), angles.end());
+
+    float max_dif = FLT_MIN;
+    for (size_t j = 0; j + 1 < angles.size(); ++j) {
+        max_dif = std::max(max_dif, angles[j+1] - angles[j]);
+    }
+    max_dif = std::max(max_dif, 2.0f*float(M_PI) - angles.back() + angles.front());
+    return max_dif > angle_threshold;
+}
+
+// the scatter matrix of the neighbors around point i, not around their mean as for the normals
+Eigen::Matrix3d iss_scatter_matrix(const CloudT& cloud, int i, const int* first, const int* last)
+{
+    const double cx = cloud.points[i].x, cy = cloud.points[i].y, cz = cloud.points[i].z;
+    double sxx = 0.0, sxy = 0.0, sxz = 0.0, syy = 0.0, syz = 0.0, szz = 0.0;
+    const int k = last - first;
+
+#pragma omp simd reduction(+:sxx,sxy,sxz,syy,syz,szz)
+    for (int j = 0; j < k; ++j) {
+        const PointT& q = cloud.points[first[j]];
+        double dx = q.x - cx, dy = q.y - cy, dz = q.z - cz;
+        sxx += dx*dx; sxy += dx*dy; sxz += dx*dz;
+        syy += dy*dy; syz += dy*dz; szz += dz*dz;
+    }
+
+    Eigen::Matrix3d cov_m;
+    cov_m << sxx, sxy, sxz,
+             sxy, syy, syz,
+             sxz, syz, szz;
+    return cov_m;
+}
+
+void feature_pipeline::compute_iss_keypoints(vector<int>& keypoint_indices, const iss_parameters& params,
+                                             NormalCloudT::Ptr normals) const
+{
+    vector<float> saliencies;
+    compute_iss_keypoints(keypoint_indices, saliencies, params, normals);
+}
+
+// this follows pcl::ISSKeypoint3D but returns the indices of the keypoints
+void feature_pipeline::compute_iss_keypoints(vector<int>& keypoint_indices, vector<float>& saliencies,
+                                             const iss_parameters& params, NormalCloudT::Ptr normals) const
+{
+    const int nbr_points = cloud->size();
+
+    vector<char> borders(nbr_points, false);
+    if (params.border_radius > 0.0) {
+        if (!normals) {
+            normals = compute_normals(params.normal_radius);
+        }
+        vector<char> edge_points(nbr_points, false);
+#pragma omp parallel for schedule(dynamic, 64)
+        for (int i = 0; i < nbr_points; ++i) {
+            const int* first = neighborhoods.neighbors_begin(i);
+            const int* last = neighborhoods.neighbors_end(i, params.border_radius);
+            if (last - first >= params.min_neighbors) {
+                edge_points[i] = is_boundary_point(*cloud, i, first, last, normals->points[i], float(M_PI / 2.0));
+            }
+        }
+#pragma omp parallel for schedule(dynamic, 64)
+        for (int i = 0; i < nbr_points; ++i) {
+            const int* last = neighborhoods.neighbors_end(i, params.border_radius);
+            for (const int* j = neighborhoods.neighbors_begin(i); j != last; ++j) {
+                if (edge_points[*j]) {
+                    borders[i] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // the smallest eigenvalue of the scatter matrix around the points that are salient
+    vector<double> third_eigen_value(nbr_points, 0.0);
+    vector<float> point_saliencies(nbr_points, 0.0f);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < nbr_points; ++i) {
+        if (borders[i] || !pcl::isFinite(cloud->points[i])) {
+            continue;
+        }
+        const int* first = neighborhoods.neighbors_begin(i);
+        const int* last = neighborhoods.neighbors_end(i, params.salient_radius);
+        if (last - first < params.min_neighbors) {
+            continue;
+        }
+
+        // the closed form eigenvalues are much faster than the iterative ones for 3x3 matrices
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+        solver.computeDirect(iss_scatter_matrix(*cloud, i, first, last), Eigen::EigenvaluesOnly);
+        const double e1c = solver.eigenvalues()[2];
+        const double e2c = solver.eigenvalues()[1];
+        const double e3c = solver.eigenvalues()[0];
+        if (!std::isfinite(e1c) || !std::isfinite(e2c) || !std::isfinite(e3c) || e3c < 0) {
+            continue;
+        }
+        double ratio_21 = e2c / e1c;
+        double ratio_32 = e3c / e2c;
+        if (ratio_21 < params.gamma_21 && ratio_32 < params.gamma_32) {
+            third_eigen_value[i] = e3c;
+            point_saliencies[i] = std::max(ratio_21, ratio_32);
+        }
+    }
+
+    // non maximum suppression of the smallest eigenvalue
+    vector<char> feat_max(nbr_points, false);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < nbr_points; ++i) {
+        if (third_eigen_value[i] <= 0.0) {
+            continue;
+        }
+        const int* first = neighborhoods.neighbors_begin(i);
+        const int* last = neighborhoods.neighbors_end(i, params.non_max_radius);
+        if (last - first < params.min_neighbors) {
+            continue;
+        }
+        feat_max[i] = std::none_of(first, last, [&](int j) {
+            return third_eigen_value[i] < third_eigen_value[j];
+        });
+    }
+
+    keypoint_indices.clear();
+    saliencies.clear();
+    for (int i = 0; i < nbr_points; ++i) {
+        if (feat_max[i]) {
+            keypoint_indices.push_back(i);
+            saliencies.push_back(point_saliencies[i]);
+        }
+    }
+}
+
+// the neighborhood of one keypoint with one array per coordinate,
+// so that the pair features against one point can be vectorized
+struct pfhrgb_neighborhood {
+    Eigen::ArrayXf px, py, pz;
+    Eigen::ArrayXf nx, ny, nz;
+    Eigen::ArrayXf r, g, b;
+
+    // per pair temporaries
+    Eigen::ArrayXf dx, dy, dz, vx, vy, vz, inv_f4, inv_v, f1_x, f1_y;
+    Eigen::ArrayXi angle_bins, color_bins;
+
+    void resize(size_t k)
+    {
+        for (Eigen::ArrayXf* a : { &px, &py, &pz, &nx, &ny, &nz, &r, &g, &b,
+                                   &dx, &dy, &dz, &vx, &vy, &vz, &inv_f4, &inv_v, &f1_x, &f1_y }) {
+            a->resize(k);
+        }
+        angle_bins.resize(k);
+        color_bins.resize(k);
+    }
+};
+
+// the same binning as pfhrgb, the features are in [-1, 1]
+inline int pfhrgb_bin(float f)
+{
+    const int nr_split = 5;
+    int b = static_cast<int>(floor(nr_split * ((f + 1.0) * 0.5)));
+    return std::min(std::max(b, 0), nr_split - 1);
+}
+
+// the smallest value that is put in bin k or above by pfhrgb_bin, comparing
+// with these gives exactly the same bins without the floor and the conversion
+float pfhrgb_bin_threshold(int k)
+{
+    float t = -1.0f + 2.0f*float(k)/5.0f;
+    while (pfhrgb_bin(t) >= k) {
+        t = std::nextafter(t, -2.0f);
+    }
+    while (pfhrgb_bin(t) < k) {
+        t = std::nextafter(t, 2.0f);
+    }
+    return t;
+}
+
+// bins of an array of features, nan features end up in the first bin
+template <typename Derived>
+inline Eigen::ArrayXi pfhrgb_bins(const Eigen::ArrayBase<Derived>& f)
+{
+    static const float t1 = pfhrgb_bin_threshold(1), t2 = pfhrgb_bin_threshold(2);
+    static const float t3 = pfhrgb_bin_threshold(3), t4 = pfhrgb_bin_threshold(4);
+    return (f >= t1).template cast<int>() + (f >= t2).template cast<int>() +
+           (f >= t3).template cast<int>() + (f >= t4).template cast<int>();
+}
+
+// bins of atan2(y, x) in [-pi, pi] without computing the angles, the
+// bin borders are at +-0.2pi and +-0.6pi so we only compare with those
+Eigen::ArrayXi pfhrgb_angle_bins(const Eigen::ArrayXf& y, const Eigen::ArrayXf& x)
+{
+    const float c02 = 0.80901699f, s02 = 0.58778525f; // cos(0.2pi), sin(0.2pi)
+    const float c06 = -0.30901699f, s06 = 0.95105652f; // cos(0.6pi), sin(0.6pi)
+    // the number of borders between the angle and 0
+    Eigen::ArrayXi b = (x*s02 - y.abs()*c02 <= 0.0f).cast<int>() + (x*s06 - y.abs()*c06 <= 0.0f).cast<int>();
+    Eigen::ArrayXi bins = (y < 0.0f).select(2 - b, 2 + b);
+    return (x == x && y == y).select(bins, 0);
+}
+
+// bins of the color ratios, the ratios above 1 are inverted and negated
+Eigen::ArrayXi pfhrgb_color_bins(const Eigen::ArrayXf& ratios)
+{
+    Eigen::ArrayXf f = (ratios > 1.0f).select(-ratios.inverse(), ratios);
+    return pfhrgb_bins((f == f).select(f, 0.0f));
+}
+
+// same bins and normalization as pcl::PFHRGBEstimation with 5 subdivisions, the first
+// 125 bins are the angle features f1, f2, f3 and the last 125 the color ratios
+void compute_pfhrgb_signature(float* histogram, pfhrgb_neighborhood& nh, size_t k)
+{
+    std::fill(histogram, histogram + 250, 0.0f);
+    if (k < 2) {
+        return;
+    }
+    const float hist_incr = 100.0f / float(k * k - 1);
+
+    for (size_t i = 0; i < k; ++i) {
+        const float n1x = nh.nx(i), n1y = nh.ny(i), n1z = nh.nz(i);
+
+        nh.dx = nh.px - nh.px(i);
+        nh.dy = nh.py - nh.py(i);
+        nh.dz = nh.pz - nh.pz(i);
+
+        // v = dp x n1, w = n1 x v
+        nh.vx = nh.dy*n1z - nh.dz*n1y;
+        nh.vy = nh.dz*n1x - nh.dx*n1z;
+        nh.vz = nh.dx*n1y - nh.dy*n1x;
+
+        // pcl skips the pairs where dp is 0 or parallel to n1, this includes the pair (i, i)
+        nh.inv_f4 = (nh.dx.square() + nh.dy.square() + nh.dz.square()).sqrt();
+        nh.inv_v = (nh.vx.square() + nh.vy.square() + nh.vz.square()).sqrt();
+        Eigen::Array<bool, Eigen::Dynamic, 1> valid = nh.inv_f4 != 0.0f && nh.inv_v != 0.0f;
+        nh.inv_f4 = valid.select(nh.inv_f4.inverse(), 0.0f);
+        nh.inv_v = valid.select(nh.inv_v.inverse(), 0.0f);
+        nh.vx *= nh.inv_v;
+        nh.vy *= nh.inv_v;
+        nh.vz *= nh.inv_v;
+
+        nh.f1_y = (n1y*nh.vz - n1z*nh.vy)*nh.nx + (n1z*nh.vx - n1x*nh.vz)*nh.ny + (n1x*nh.vy - n1y*nh.vx)*nh.nz;
+        nh.f1_x = n1x*nh.nx + n1y*nh.ny + n1z*nh.nz;
+        nh.angle_bins = pfhrgb_angle_bins(nh.f1_y, nh.f1_x) +
+                        5*pfhrgb_bins(nh.vx*nh.nx + nh.vy*nh.ny + nh.vz*nh.nz) +
+                        25*pfhrgb_bins((n1x*nh.dx + n1y*nh.dy + n1z*nh.dz)*nh.inv_f4);
+
+        // the color ratios are mapped to [-1, 1], c/0 becomes -1/inf = -0 as in pcl
+        // and 0/0 is also put in the middle bin instead of being a nan
+        nh.dx = nh.r / nh.r(i);
+        nh.dy = nh.g / nh.g(i);
+        nh.dz = nh.b / nh.b(i);
+        nh.color_bins = 125 + pfhrgb_color_bins(nh.dx) + 5*pfhrgb_color_bins(nh.dy) + 25*pfhrgb_color_bins(nh.dz);
+
+        for (size_t j = 0; j < k; ++j) {
+            if (valid(j)) {
+                histogram[nh.angle_bins(j)] += hist_incr;
+                histogram[nh.color_bins(j)] += hist_incr;
+            }
+        }
+    }
+}
+
+void feature_pipeline::compute_pfhrgb_features(PfhRgbCloudT::Ptr& features, const vector<int>& keypoint_indices,
+                                               const NormalCloudT::Ptr& normals, double radius, size_t max_neighbors) const
+{
+    // if the descriptors need larger neighborhoods than the cache, they are only searched for the keypoints
+    if (radius > neighborhoods.max_radius()) {
+        neighborhood_cache keypoint_neighborhoods(cloud, radius, keypoint_indices);
+        compute_pfhrgb_features(features, keypoint_indices, normals, keypoint_neighborhoods, radius, max_neighbors);
+    }
+    else {
+        compute_pfhrgb_features(features, keypoint_indices, normals, neighborhoods, radius, max_neighbors);
+    }
+}
+
+void feature_pipeline::compute_pfhrgb_features(PfhRgbCloudT::Ptr& features, const vector<int>& keypoint_indices,
+                                               const NormalCloudT::Ptr& normals, const neighborhood_cache& neighborhoods,
+                                               double radius, size_t max_neighbors) const
+{
+    features->resize(keypoint_indices.size());
+
+#pragma omp parallel
+    {
+        pfhrgb_neighborhood nh;
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < int(keypoint_indices.size()); ++i) {
+            const int* first = neighborhoods.neighbors_begin(keypoint_indices[i]);
+            const int* last = neighborhoods.neighbors_end(keypoint_indices[i], radius);
+            size_t k = last - first;
+
+            // spread the subsampled neighbors evenly over the distances
+            size_t nbr_used = max_neighbors > 0? std::min(k, max_neighbors) : k;
+            nh.resize(nbr_used);
+            for (size_t j = 0; j < nbr_used; ++j) {
+                int ind = first[j*k/nbr_used];
+                const PointT& p = cloud->points[ind];
+                const NormalT& n = normals->points[ind];
+                nh.px(j) = p.x; nh.py(j) = p.y; nh.pz(j) = p.z;
+                nh.nx(j) = n.normal_x; nh.ny(j) = n.normal_y; nh.nz(j) = n.normal_z;
+                nh.r(j) = p.r; nh.g(j) = p.g; nh.b(j) = p.b;
+            }
+
+            compute_pfhrgb_signature(features->points[i].histogram, nh, nbr_used);
+        }
+    }
+}
+
+}
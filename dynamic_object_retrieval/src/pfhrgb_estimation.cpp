@@ -1,10 +1,8 @@
 #include "object_3d_retrieval/pfhrgb_estimation.h"
+#include "object_3d_retrieval/feature_pipeline.h"
 
-#include <pcl/keypoints/iss_3d.h>
 #include <pcl/keypoints/uniform_sampling.h>
-#include <pcl/features/pfhrgb.h>
-#include <pcl/features/normal_3d_omp.h>
-#include <pcl/features/shot_omp.h>
+#include <pcl/search/kdtree.h>
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/surface/mls.h>
 
@@ -12,6 +10,22 @@ namespace pfhrgb_estimation {
 
 using namespace std;
 
+void compute_uniform_keypoints(std::vector<int>& indices, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, double radius)
+{
+    pcl::PointCloud<int>::Ptr keypoints_ind(new pcl::PointCloud<int>);
+    pcl::UniformSampling<PointT> us_detector;
+    pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>);
+    us_detector.setRadiusSearch(radius);
+    us_detector.setSearchMethod(tree);
+    us_detector.setInputCloud(cloud);
+    us_detector.compute(*keypoints_ind); // this might actually be the indices directly
+
+    for (int ind : keypoints_ind->points) {
+        keypoints->push_back(cloud->at(ind));
+        indices.push_back(ind);
+    }
+}
+
 void visualize_keypoints(CloudT::Ptr& cloud, CloudT::Ptr& keypoints)
 {
     boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer(new pcl::visualization::PCLVisualizer ("3D Viewer"));
@@ -40,93 +54,35 @@ void visualize_keypoints(CloudT::Ptr& cloud, CloudT::Ptr& keypoints)
 
 void compute_query_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, bool visualize_features)
 {
+    // TODO: this used to be 0.1 !!!!!!!!!!!!!!!
+    double model_resolution = std::min(0.006, 0.003 + 0.003*float(cloud->size())/(0.1*480*640));
+    iss_parameters iss_params(model_resolution, 0.975);
+
+    double normal_radius = 0.04; // 0.02
+    double descriptor_radius = 0.04; //support 0.06 orig, 0.04 still seems too big, takes time
+
+    // the normals and ISS need the neighborhoods of all the points, the descriptors
+    // only those of the keypoints, which are searched again if the radius is larger
+    feature_pipeline pipeline(cloud, std::max(normal_radius, iss_params.salient_radius));
+
     // first, extract normals, if we don't use the lowres cloud
-    pcl::NormalEstimationOMP<PointT, NormalT> ne;
-    ne.setInputCloud(cloud);
-    pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>);
-    ne.setSearchMethod(tree);
-    NormalCloudT::Ptr normals(new NormalCloudT);
-    ne.setRadiusSearch(0.04); // 0.02
-    ne.compute(*normals);
+    NormalCloudT::Ptr normals = pipeline.compute_normals(normal_radius);
 
-    //float threshold = std::max(1.0-0.5*float(segment->size())/(0.3*480*640), 0.5);
-    //
-    //  ISS3D parameters
-    //
-    double iss_salient_radius_;
-    double iss_non_max_radius_;
-    double iss_normal_radius_;
-    double iss_border_radius_;
-    double iss_gamma_21_ (0.975); // 0.975 orig
-    double iss_gamma_32_ (0.975); // 0.975 orig
-    double iss_min_neighbors_ (5);
-    int iss_threads_ (4);
-
-    //CloudT::Ptr model_keypoints(new CloudT);
-    pcl::IndicesPtr indices(new std::vector<int>);
-
-    { // TODO: this used to be 0.1 !!!!!!!!!!!!!!!
-        // Fill in the model cloud
-        double model_resolution = std::min(0.006, 0.003 + 0.003*float(cloud->size())/(0.1*480*640));
-
-        // Compute model_resolution
-        iss_salient_radius_ = 6 * model_resolution;
-        iss_non_max_radius_ = 4 * model_resolution;
-        iss_normal_radius_ = 4 * model_resolution;
-        iss_border_radius_ = 0.5 * model_resolution; // 1
-
-        //
-        // Compute keypoints
-        //
-        pcl::ISSKeypoint3D<PointT, PointT> iss_detector;
-        iss_detector.setSearchMethod(tree);
-        iss_detector.setSalientRadius(iss_salient_radius_);
-        iss_detector.setNonMaxRadius(iss_non_max_radius_);
-
-        iss_detector.setNormalRadius(iss_normal_radius_); // comment these two if not to use border removal
-        iss_detector.setBorderRadius(iss_border_radius_); // comment these two if not to use border removal
-
-        iss_detector.setThreshold21(iss_gamma_21_);
-        iss_detector.setThreshold32(iss_gamma_32_);
-        iss_detector.setMinNeighbors(iss_min_neighbors_);
-        iss_detector.setNumberOfThreads(iss_threads_);
-        iss_detector.setInputCloud(cloud);
-        iss_detector.compute(*keypoints);
-
-        pcl::KdTreeFLANN<PointT> kdtree; // might be possible to just use the other tree here
-        kdtree.setInputCloud(cloud);
-        for (const PointT& k : keypoints->points) {
-            std::vector<int> ind;
-            std::vector<float> dist;
-            kdtree.nearestKSearchT(k, 1, ind, dist);
-            indices->push_back(ind[0]);
-        }
+    // ISS3D
+    std::vector<int> indices;
+    pipeline.compute_iss_keypoints(indices, iss_params);
+    for (int ind : indices) {
+        keypoints->push_back(cloud->at(ind));
     }
 
     if (visualize_features) {
         visualize_keypoints(cloud, keypoints);
     }
-    // ISS3D
 
     // PFHRGB
-    pcl::PFHRGBEstimation<PointT, NormalT> se;
-    se.setSearchMethod(tree);
-    //se.setKSearch(100);
-    se.setIndices(indices); //keypoints
-    se.setInputCloud(cloud);
-    se.setInputNormals(normals);
-    se.setRadiusSearch(0.04); //support 0.06 orig, 0.04 still seems too big, takes time
-
-    pcl::PointCloud<pcl::PFHRGBSignature250> pfhrgb_cloud;
-    se.compute(pfhrgb_cloud); //descriptors
-
-    const int N = 250;
-    features->resize(pfhrgb_cloud.size());
-    for (size_t i = 0; i < pfhrgb_cloud.size(); ++i) {
-        std::copy(pfhrgb_cloud.at(i).histogram, pfhrgb_cloud.at(i).histogram+N, features->at(i).histogram);
-    }
+    pipeline.compute_pfhrgb_features(features, indices, normals, descriptor_radius);
 
-    std::cout << "Number of features: " << pfhrgb_cloud.size() << std::endl;
+    std::cout << "Number of features: " << features->size() << std::endl;
 }
 
 void compute_regularized_query_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, bool visualize_features)
@@ -153,210 +109,77 @@ void compute_regularized_query_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr
 
 void compute_surfel_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, bool visualize_features, bool is_query)
 {
+    //float threshold = std::max(1.0-0.5*float(segment->size())/(0.3*480*640), 0.5);
+    bool use_iss = is_query || cloud->size() < 0.015*480*640; // TODO: this used to be 0.1 !!!!!!!!!!!!!!!
+    double model_resolution = std::min(0.006, 0.003 + 0.003*float(cloud->size())/(0.015*480*640));
+    iss_parameters iss_params(model_resolution, 0.975);
+
+    double normal_radius = 0.04; // 0.02, this is very large
+    double descriptor_radius = 0.04; //support 0.06 orig, 0.04 still seems too big, takes time
+
+    // the normals and ISS need the neighborhoods of all the points, the descriptors
+    // only those of the keypoints, which are searched again if the radius is larger
+    feature_pipeline pipeline(cloud, use_iss? std::max(normal_radius, iss_params.salient_radius) : normal_radius);
+
     // first, extract normals, if we don't use the lowres cloud
-    pcl::NormalEstimationOMP<PointT, NormalT> ne;
-    ne.setInputCloud(cloud);
-    pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>);
-    ne.setSearchMethod(tree);
-    NormalCloudT::Ptr normals(new NormalCloudT);
-    ne.setRadiusSearch(0.04); // 0.02, this is very large
-    ne.compute(*normals);
+    NormalCloudT::Ptr normals = pipeline.compute_normals(normal_radius);
 
-    //float threshold = std::max(1.0-0.5*float(segment->size())/(0.3*480*640), 0.5);
-    //
-    //  ISS3D parameters
-    //
-    double iss_salient_radius_;
-    double iss_non_max_radius_;
-    double iss_normal_radius_;
-    double iss_border_radius_;
-    double iss_gamma_21_ (0.975); // 0.975 orig
-    double iss_gamma_32_ (0.975); // 0.975 orig
-    double iss_min_neighbors_ (5);
-    int iss_threads_ (3);
-
-    //CloudT::Ptr model_keypoints(new CloudT);
-    pcl::PointCloud<int>::Ptr keypoints_ind(new pcl::PointCloud<int>);
-    pcl::IndicesPtr indices(new std::vector<int>);
-
-    if (is_query || cloud->size() < 0.015*480*640) { // TODO: this used to be 0.1 !!!!!!!!!!!!!!!
-        // Fill in the model cloud
-        double model_resolution = std::min(0.006, 0.003 + 0.003*float(cloud->size())/(0.015*480*640));
-
-        // Compute model_resolution
-        iss_salient_radius_ = 6 * model_resolution;
-        iss_non_max_radius_ = 4 * model_resolution;
-        iss_normal_radius_ = 4 * model_resolution;
-        iss_border_radius_ = 0.5 * model_resolution; // 1
-
-        //
-        // Compute keypoints
-        //
-        pcl::ISSKeypoint3D<PointT, PointT> iss_detector;
-        iss_detector.setSearchMethod(tree);
-        iss_detector.setSalientRadius(iss_salient_radius_);
-        iss_detector.setNonMaxRadius(iss_non_max_radius_);
-
-        iss_detector.setNormalRadius(iss_normal_radius_); // comment these two if not to use border removal
-        iss_detector.setBorderRadius(iss_border_radius_); // comment these two if not to use border removal
-
-        iss_detector.setThreshold21(iss_gamma_21_);
-        iss_detector.setThreshold32(iss_gamma_32_);
-        iss_detector.setMinNeighbors(iss_min_neighbors_);
-        iss_detector.setNumberOfThreads(iss_threads_);
-        iss_detector.setInputCloud(cloud);
-        iss_detector.compute(*keypoints);
-
-        pcl::KdTreeFLANN<PointT> kdtree; // might be possible to just use the other tree here
-        kdtree.setInputCloud(cloud);
-        for (const PointT& k : keypoints->points) {
-            std::vector<int> ind;
-            std::vector<float> dist;
-            kdtree.nearestKSearchT(k, 1, ind, dist);
-            indices->push_back(ind[0]);
+    std::vector<int> indices;
+    if (use_iss) {
+        pipeline.compute_iss_keypoints(indices, iss_params);
+        for (int ind : indices) {
+            keypoints->push_back(cloud->at(ind));
         }
     }
     else {
-        pcl::UniformSampling<PointT> us_detector;
-        us_detector.setRadiusSearch(0.1);
-        us_detector.setSearchMethod(tree);
-        us_detector.setInputCloud(cloud);
-        us_detector.compute(*keypoints_ind); // this might actually be the indices directly
-
-        for (int ind : keypoints_ind->points) {
-            keypoints->push_back(cloud->at(ind));
-            indices->push_back(ind);
-        }
+        compute_uniform_keypoints(indices, keypoints, cloud, 0.1);
     }
 
     if (visualize_features) {
         visualize_keypoints(cloud, keypoints);
     }
-    // ISS3D
 
     // PFHRGB
-    pcl::PFHRGBEstimation<PointT, NormalT> se;
-    se.setSearchMethod(tree);
-    //se.setKSearch(100);
-    se.setIndices(indices); //keypoints
-    se.setInputCloud(cloud);
-    se.setInputNormals(normals);
-    se.setRadiusSearch(0.04); //support 0.06 orig, 0.04 still seems too big, takes time
-
-    pcl::PointCloud<pcl::PFHRGBSignature250> pfhrgb_cloud;
-    se.compute(pfhrgb_cloud); //descriptors
-
-    const int N = 250;
-    features->resize(pfhrgb_cloud.size());
-    for (size_t i = 0; i < pfhrgb_cloud.size(); ++i) {
-        std::copy(pfhrgb_cloud.at(i).histogram, pfhrgb_cloud.at(i).histogram+N, features->at(i).histogram);
-    }
+    pipeline.compute_pfhrgb_features(features, indices, normals, descriptor_radius);
 
-    std::cout << "Number of features: " << pfhrgb_cloud.size() << std::endl;
+    std::cout << "Number of features: " << features->size() << std::endl;
 }
 
 void compute_features(PfhRgbCloudT::Ptr& features, CloudT::Ptr& keypoints, CloudT::Ptr& cloud, bool visualize_features)
 {
+    bool use_iss = cloud->size() < 0.3*480*640; // TODO: this used to be 0.1 !!!!!!!!!!!!!!!
+    double model_resolution = std::min(0.006, 0.003 + 0.003*float(cloud->size())/(0.1*480*640));
+    iss_parameters iss_params(model_resolution, 0.975);
+
+    double normal_radius = 0.02; // 0.02
+    double descriptor_radius = 0.02; //support 0.06 orig, 0.04 still seems too big, takes time
+
+    // the normals and ISS need the neighborhoods of all the points, the descriptors
+    // only those of the keypoints, which are searched again if the radius is larger
+    feature_pipeline pipeline(cloud, use_iss? std::max(normal_radius, iss_params.salient_radius) : normal_radius);
+
     // first, extract normals, if we don't use the lowres cloud
-    pcl::NormalEstimationOMP<PointT, NormalT> ne;
-    ne.setInputCloud(cloud);
-    pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>);
-    ne.setSearchMethod(tree);
-    NormalCloudT::Ptr normals(new NormalCloudT);
-    ne.setRadiusSearch(0.02); // 0.02
-    ne.compute(*normals);
+    NormalCloudT::Ptr normals = pipeline.compute_normals(normal_radius);
 
-    //float threshold = std::max(1.0-0.5*float(segment->size())/(0.3*480*640), 0.5);
-    //
-    //  ISS3D parameters
-    //
-    double iss_salient_radius_;
-    double iss_non_max_radius_;
-    double iss_normal_radius_;
-    double iss_border_radius_;
-    double iss_gamma_21_ (0.975); // 0.975 orig
-    double iss_gamma_32_ (0.975); // 0.975 orig
-    double iss_min_neighbors_ (5);
-    int iss_threads_ (4);
-
-    //CloudT::Ptr model_keypoints(new CloudT);
-    pcl::PointCloud<int>::Ptr keypoints_ind(new pcl::PointCloud<int>);
-    pcl::IndicesPtr indices(new std::vector<int>);
-
-    if (cloud->size() < 0.3*480*640) { // TODO: this used to be 0.1 !!!!!!!!!!!!!!!
-        // Fill in the model cloud
-        double model_resolution = std::min(0.006, 0.003 + 0.003*float(cloud->size())/(0.1*480*640));
-
-        // Compute model_resolution
-        iss_salient_radius_ = 6 * model_resolution;
-        iss_non_max_radius_ = 4 * model_resolution;
-        iss_normal_radius_ = 4 * model_resolution;
-        iss_border_radius_ = 0.5 * model_resolution; // 1
-
-        //
-        // Compute keypoints
-        //
-        pcl::ISSKeypoint3D<PointT, PointT> iss_detector;
-        iss_detector.setSearchMethod(tree);
-        iss_detector.setSalientRadius(iss_salient_radius_);
-        iss_detector.setNonMaxRadius(iss_non_max_radius_);
-
-        iss_detector.setNormalRadius(iss_normal_radius_); // comment these two if not to use border removal
-        iss_detector.setBorderRadius(iss_border_radius_); // comment these two if not to use border removal
-
-        iss_detector.setThreshold21(iss_gamma_21_);
-        iss_detector.setThreshold32(iss_gamma_32_);
-        iss_detector.setMinNeighbors(iss_min_neighbors_);
-        iss_detector.setNumberOfThreads(iss_threads_);
-        iss_detector.setInputCloud(cloud);
-        iss_detector.compute(*keypoints);
-
-        pcl::KdTreeFLANN<PointT> kdtree; // might be possible to just use the other tree here
-        kdtree.setInputCloud(cloud);
-        for (const PointT& k : keypoints->points) {
-            std::vector<int> ind;
-            std::vector<float> dist;
-            kdtree.nearestKSearchT(k, 1, ind, dist);
-            indices->push_back(ind[0]);
+    std::vector<int> indices;
+    if (use_iss) {
+        pipeline.compute_iss_keypoints(indices, iss_params);
+        for (int ind : indices) {
+            keypoints->push_back(cloud->at(ind));
         }
     }
     else {
-        pcl::UniformSampling<PointT> us_detector;
-        us_detector.setRadiusSearch(0.1);
-        us_detector.setSearchMethod(tree);
-        us_detector.setInputCloud(cloud);
-        us_detector.compute(*keypoints_ind); // this might actually be the indices directly
-
-        for (int ind : keypoints_ind->points) {
-            keypoints->push_back(cloud->at(ind));
-            indices->push_back(ind);
-        }
+        compute_uniform_keypoints(indices, keypoints, cloud, 0.1);
     }
 
     if (visualize_features) {
         visualize_keypoints(cloud, keypoints);
     }
-    // ISS3D
 
     // PFHRGB
-    pcl::PFHRGBEstimation<PointT, NormalT> se;
-    se.setSearchMethod(tree);
-    //se.setKSearch(100);
-    se.setIndices(indices); //keypoints
-    se.setInputCloud(cloud);
-    se.setInputNormals(normals);
-    se.setRadiusSearch(0.02); //support 0.06 orig, 0.04 still seems too big, takes time
-
-    pcl::PointCloud<pcl::PFHRGBSignature250> pfhrgb_cloud;
-    se.compute(pfhrgb_cloud); //descriptors
-
-    const int N = 250;
-    features->resize(pfhrgb_cloud.size());
-    for (size_t i = 0; i < pfhrgb_cloud.size(); ++i) {
-        std::copy(pfhrgb_cloud.at(i).histogram, pfhrgb_cloud.at(i).histogram+N, features->at(i).histogram);
-    }
+    pipeline.compute_pfhrgb_features(features, indices, normals, descriptor_radius);
 
-    std::cout << "Number of features: " << pfhrgb_cloud.size() << std::endl;
+    std::cout << "Number of features: " << features->size() << std::endl;
 }
 
 void visualize_split_keypoints(vector<CloudT::Ptr>& split_keypoints)
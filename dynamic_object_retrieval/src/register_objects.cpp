@@ -15,6 +15,10 @@
 #include <pcl/features/normal_3d_omp.h>
 #include <pcl/octree/octree.h>
 
+#include <numeric>
+#include <random>
+#include <unordered_set>
+
 #define VISUALIZE false
 
 using namespace std;
@@ -22,71 +26,57 @@ using namespace std;
 float register_objects::sRGB_LUT[256] = {- 1};
 float register_objects::sXYZ_LUT[4000] = {- 1};
 
-template<typename PointT,
-         typename LeafContainerT = pcl::octree::OctreeContainerPointIndices,
-         typename BranchContainerT = pcl::octree::OctreeContainerEmpty >
-class OctreePointCloudOverlap : public pcl::octree::OctreePointCloud<PointT,
-        LeafContainerT, BranchContainerT, pcl::octree::Octree2BufBase<LeafContainerT, BranchContainerT> >
-
+// packs the integer coordinates of the voxel containing each finite point of cloud into one key,
+// the cloud is transformed by T first. 21 bits per axis are plenty for the resolutions we use here
+void insert_voxel_keys(std::unordered_set<uint64_t>& voxels, const pcl::PointCloud<pcl::PointXYZRGB>& cloud,
+                       const Eigen::Matrix4f& T, float resolution)
 {
-
-public:
-
-    OctreePointCloudOverlap(const double resolution_arg) :
-        pcl::octree::OctreePointCloud<PointT, LeafContainerT, BranchContainerT,
-        pcl::octree::Octree2BufBase<LeafContainerT, BranchContainerT> >(resolution_arg)
-    {
-    }
-
-    virtual ~OctreePointCloudOverlap()
-    {
-    }
-
-    std::size_t getNewOccupiedVoxelCenters()
-    {
-
-        std::vector<pcl::octree::OctreeContainerPointIndices*> leaf_containers;
-        this->serializeNewLeafs(leaf_containers); // this method is actually public, so actually no need to subclass
-        return leaf_containers.size();
+    const int64_t offset = int64_t(1) << 20;
+    const uint64_t mask = (uint64_t(1) << 21) - 1;
+    Eigen::Matrix4f S = T;
+    S.topRows<3>() /= resolution; // scale to voxel units together with the transformation
+    voxels.reserve(voxels.size() + cloud.size());
+    for (const pcl::PointXYZRGB& p : cloud.points) {
+        if (!pcl::isFinite(p)) {
+            continue;
+        }
+        Eigen::Vector4f q = S*Eigen::Vector4f(p.x, p.y, p.z, 1.0f);
+        uint64_t key = 0;
+        for (int i = 0; i < 3; ++i) {
+            key = (key << 21) | (uint64_t(int64_t(std::floor(q(i))) + offset) & mask);
+        }
+        voxels.insert(key);
     }
-};
+}
 
 double register_objects::compute_overlap(CloudT::Ptr& A, CloudT::Ptr& B)
 {
-    // Octree resolution - side length of octree voxels
-    const float resolution = 0.05f;
-
-    // Instantiate octree-based point cloud change detection class
-    OctreePointCloudOverlap<PointT> octree(resolution);
-
-    // Add points from cloudA to octree
-    octree.setInputCloud(A);
-    octree.addPointsFromInputCloud();
-
-    std::vector<PointT, Eigen::aligned_allocator<PointT> > dummy;
-    double nbr_total_A = octree.getOccupiedVoxelCenters(dummy);
-
-    // Switch octree buffers: This resets octree but keeps previous tree structure in memory.
-    octree.switchBuffers();
-
-    // Add points from cloudB to octree
-    octree.setInputCloud(B);
-    octree.addPointsFromInputCloud();
+    return compute_overlap(A, B, Eigen::Matrix4f::Identity());
+}
 
-    double nbr_total_B = octree.getOccupiedVoxelCenters(dummy);
+// the fraction of occupied voxels that are occupied by both clouds, B is transformed by TB.
+// the voxels are kept in hash sets so that no octree or transformed copy of B has to be built
+double register_objects::compute_overlap(CloudT::Ptr& A, CloudT::Ptr& B, const Eigen::Matrix4f& TB)
+{
+    // side length of voxels
+    const float resolution = 0.05f;
 
-    // Get vector of point indices from octree voxels which did not exist in previous buffer
+    std::unordered_set<uint64_t> voxels_A;
+    insert_voxel_keys(voxels_A, *A, Eigen::Matrix4f::Identity(), resolution);
+    std::unordered_set<uint64_t> voxels_B;
+    insert_voxel_keys(voxels_B, *B, TB, resolution);
 
-    double nbr_not_A = octree.getNewOccupiedVoxelCenters();
-    //std::vector<pcl::octree::OctreeContainerPointIndices*> leaf_containers;
-    //octree.serializeNewLeafs(leaf_containers); // this method is actually public, so actually no need to subclass
-    //double nbr_not_A = double(leaf_containers.size());
+    double nbr_total_A = voxels_A.size();
+    double nbr_both = 0.0;
+    for (uint64_t key : voxels_B) {
+        nbr_both += voxels_A.count(key);
+    }
+    double nbr_not_A = double(voxels_B.size()) - nbr_both;
 
-    if (nbr_not_A == nbr_total_B) {
+    if (nbr_both == 0.0) {
         return 0.0;
     }
 
-    double nbr_both = nbr_total_B - nbr_not_A;
     double nbr_total = nbr_total_A + nbr_not_A;
 
     double overlap_fraction = nbr_both / nbr_total;
@@ -94,7 +84,7 @@ double register_objects::compute_overlap(CloudT::Ptr& A, CloudT::Ptr& B)
     return overlap_fraction;
 }
 
-register_objects::register_objects()
+register_objects::register_objects() : nbr_correspondences(0)
 {
 
 }
@@ -354,35 +344,85 @@ void register_objects::do_registration()
 
 }
 
-void register_objects::do_registration(SiftCloudT::Ptr& sift_cloud1, SiftCloudT::Ptr& sift_cloud2,
-                                       CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2)
+cv::Mat sift_descriptor_index::descriptor_view(const SiftCloudT::Ptr& cloud)
 {
-    cout << "We are actually inside the registration!" << endl;
-    if (sift_cloud1->empty() || sift_cloud2->empty()) {
-        T.setIdentity();
+    // the histograms are stored after each other, so the points can be used as rows directly
+    return cv::Mat(cloud->size(), 128, CV_32F, cloud->points.data(), sizeof(SiftT));
+}
+
+sift_descriptor_index::sift_descriptor_index(const SiftCloudT::Ptr& features) : features(features)
+{
+    if (features->empty()) {
+        return;
+    }
+    descriptors = descriptor_view(features);
+    // same parameters as the default cv::FlannBasedMatcher
+    index = std::make_shared<cv::flann::Index>(descriptors, cv::flann::KDTreeIndexParams(4));
+}
+
+void sift_descriptor_index::match(vector<cv::DMatch>& matches, const cv::Mat& query_descriptors) const
+{
+    matches.clear();
+    if (!index || query_descriptors.empty()) {
         return;
     }
 
-    cv::Mat descriptors1(sift_cloud1->size(), 128, CV_32F);
-    cv::Mat descriptors2(sift_cloud2->size(), 128, CV_32F);
+    // all of the query descriptors are searched in one batch
+    cv::Mat indices(query_descriptors.rows, 1, CV_32S);
+    cv::Mat distances(query_descriptors.rows, 1, CV_32F);
+    index->knnSearch(query_descriptors, indices, distances, 1, cv::flann::SearchParams(32));
 
-    for (int i = 0; i < sift_cloud1->size(); ++i) {
-        for (int j = 0; j < 128; ++j) {
-            descriptors1.at<float>(i, j) = sift_cloud1->at(i).histogram[j];
-        }
+    matches.reserve(query_descriptors.rows);
+    for (int i = 0; i < query_descriptors.rows; ++i) {
+        // flann gives us the squared distances
+        matches.push_back(cv::DMatch(i, indices.at<int>(i, 0), sqrt(distances.at<float>(i, 0))));
+    }
+}
+
+void sift_descriptor_index::match(vector<cv::DMatch>& matches, const cv::Mat& query_descriptors, float max_ratio) const
+{
+    matches.clear();
+    if (!index || query_descriptors.empty()) {
+        return;
+    }
+    if (size() < 2) {
+        match(matches, query_descriptors);
+        return;
     }
 
-    for (int i = 0; i < sift_cloud2->size(); ++i) {
-        for (int j = 0; j < 128; ++j) {
-            descriptors2.at<float>(i, j) = sift_cloud2->at(i).histogram[j];
+    cv::Mat indices(query_descriptors.rows, 2, CV_32S);
+    cv::Mat distances(query_descriptors.rows, 2, CV_32F);
+    index->knnSearch(query_descriptors, indices, distances, 2, cv::flann::SearchParams(32));
+
+    // the distances are squared, so we compare with the squared ratio
+    float max_squared_ratio = max_ratio*max_ratio;
+    for (int i = 0; i < query_descriptors.rows; ++i) {
+        if (distances.at<float>(i, 0) < max_squared_ratio*distances.at<float>(i, 1)) {
+            matches.push_back(cv::DMatch(i, indices.at<int>(i, 0), sqrt(distances.at<float>(i, 0))));
         }
     }
+}
 
-    // matching descriptors
-    //cv::BFMatcher matcher;
-    cv::FlannBasedMatcher matcher;
+void register_objects::do_registration(SiftCloudT::Ptr& sift_cloud1, SiftCloudT::Ptr& sift_cloud2,
+                                       CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2)
+{
+    cout << "We are actually inside the registration!" << endl;
+    sift_descriptor_index sift_index2(sift_cloud2);
+    do_registration(sift_cloud1, sift_index2, keypoint_cloud1, keypoint_cloud2);
+}
+
+void register_objects::do_registration(SiftCloudT::Ptr& sift_cloud1, const sift_descriptor_index& sift_index2,
+                                       CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2)
+{
+    nbr_correspondences = 0;
+    if (sift_cloud1->empty() || sift_index2.empty()) {
+        T.setIdentity();
+        return;
+    }
+
+    // matching descriptors, we look up the closest feature in cloud 2 for every feature in cloud 1
     vector<cv::DMatch> matches;
-    matcher.match(descriptors1, descriptors2, matches); // query / train
+    sift_index2.match(matches, sift_descriptor_index::descriptor_view(sift_cloud1), 0.8f); // query / train
 
     pcl::CorrespondencesPtr correspondences(new pcl::Correspondences);
     // do ransac on all the matches to find the transformation
@@ -393,23 +433,133 @@ void register_objects::do_registration(SiftCloudT::Ptr& sift_cloud1, SiftCloudT:
         c.distance = m.distance;
         correspondences->push_back(c);
     }
+    nbr_correspondences = correspondences->size();
 
-    // TODO: add a check here to see if it's actually possible to estimate transformation
-    pcl::registration::CorrespondenceRejectorSampleConsensus<PointT> cr;
-    pcl::Correspondences sac_correspondences;
-    cr.setInputSource(keypoint_cloud1);
-    cr.setInputTarget(keypoint_cloud2);
-    cr.setInputCorrespondences(correspondences);
-    cr.setInlierThreshold(0.01);
-    cr.setMaximumIterations(4000);
-    cr.getCorrespondences(sac_correspondences);
-    T = cr.getBestTransformation();
+    estimate_transformation(correspondences, keypoint_cloud1, keypoint_cloud2);
+}
 
-    pcl::registration::TransformationEstimationSVD<PointT, PointT> trans_est;
-    trans_est.estimateRigidTransformation(*keypoint_cloud1, *keypoint_cloud2, sac_correspondences, T);
+// RANSAC over the correspondences that stops as soon as we are confident that we have found the best
+// transformation. the correspondences with the smallest descriptor distances are sampled first and
+// the pool grows to include all of them (as in PROSAC), so good matches are usually found quickly
+size_t register_objects::estimate_transformation_adaptive(vector<int>& inliers, const pcl::Correspondences& correspondences,
+                                                          CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2)
+{
+    const float inlier_threshold = 0.01f;
+    const double confidence = 0.99;
+    const size_t max_iterations = 4000;
+    const size_t initial_pool = 10;
+
+    size_t nbr_correspondences = correspondences.size();
+    // too few to sample a transformation, as pcl::registration::CorrespondenceRejectorSampleConsensus
+    // all of them are kept and the caller uses the identity transformation
+    if (nbr_correspondences < 3) {
+        inliers.resize(nbr_correspondences);
+        std::iota(inliers.begin(), inliers.end(), 0);
+        return 0;
+    }
+    vector<int> order(nbr_correspondences);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int i, int j) {
+        return correspondences[i].distance < correspondences[j].distance;
+    });
+
+    // keep the points in columns so that all of them can be checked at once
+    Eigen::Matrix3Xf source(3, nbr_correspondences);
+    Eigen::Matrix3Xf target(3, nbr_correspondences);
+    for (size_t i = 0; i < nbr_correspondences; ++i) {
+        source.col(i) = keypoint_cloud1->at(correspondences[order[i]].index_query).getVector3fMap();
+        target.col(i) = keypoint_cloud2->at(correspondences[order[i]].index_match).getVector3fMap();
+    }
+
+    std::mt19937 generator(nbr_correspondences); // same result every time for the same input
+    Eigen::Array<bool, 1, Eigen::Dynamic> best_mask;
+    size_t best_nbr_inliers = 0;
+    size_t nbr_iterations = max_iterations;
+    size_t i;
+    for (i = 0; i < nbr_iterations; ++i) {
+        size_t pool = std::min(nbr_correspondences, initial_pool + i);
+        std::uniform_int_distribution<int> distribution(0, pool - 1);
+        int a = distribution(generator);
+        int b = distribution(generator);
+        int c = distribution(generator);
+        if (a == b || a == c || b == c) {
+            continue;
+        }
 
-    if (sac_correspondences.empty() || correspondences->size() == sac_correspondences.size()) { // No samples could be selected
+        // a rigid transformation keeps the distances, skip the samples that can not be right
+        bool consistent = true;
+        for (const pair<int, int>& e : { make_pair(a, b), make_pair(a, c), make_pair(b, c) }) {
+            float source_dist = (source.col(e.first) - source.col(e.second)).norm();
+            float target_dist = (target.col(e.first) - target.col(e.second)).norm();
+            consistent = consistent && std::abs(source_dist - target_dist) < 2.0f*inlier_threshold;
+        }
+        Eigen::Vector3f normal = (source.col(b) - source.col(a)).cross(source.col(c) - source.col(a));
+        if (!consistent || normal.squaredNorm() < 1e-10f) { // almost on a line
+            continue;
+        }
+
+        Eigen::Matrix3f sample_source, sample_target;
+        sample_source << source.col(a), source.col(b), source.col(c);
+        sample_target << target.col(a), target.col(b), target.col(c);
+        Eigen::Matrix4f hypothesis = Eigen::umeyama(sample_source, sample_target, false);
+
+        Eigen::Array<bool, 1, Eigen::Dynamic> mask = (((hypothesis.topLeftCorner<3, 3>()*source).colwise() + hypothesis.topRightCorner<3, 1>()) - target)
+                .colwise().squaredNorm().array() < inlier_threshold*inlier_threshold;
+        size_t nbr_inliers = mask.count();
+        if (nbr_inliers <= best_nbr_inliers) {
+            continue;
+        }
+
+        best_nbr_inliers = nbr_inliers;
+        best_mask = mask;
+        // the number of iterations needed to sample only inliers at least once with the given confidence
+        double inlier_ratio = double(nbr_inliers)/double(nbr_correspondences);
+        double outlier_sample = 1.0 - inlier_ratio*inlier_ratio*inlier_ratio;
+        if (outlier_sample <= 0.0) {
+            nbr_iterations = i + 1;
+        }
+        else {
+            nbr_iterations = std::min(max_iterations, size_t(std::ceil(std::log(1.0 - confidence)/std::log(outlier_sample))));
+        }
+    }
+
+    inliers.clear();
+    for (size_t j = 0; j < size_t(best_mask.size()); ++j) {
+        if (best_mask(j)) {
+            inliers.push_back(order[j]);
+        }
+    }
+    std::sort(inliers.begin(), inliers.end());
+
+    return i;
+}
+
+void register_objects::estimate_transformation(pcl::CorrespondencesPtr& correspondences,
+                                               CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2)
+{
+    const size_t min_correspondences = 5;
+
+    // too few distinctive matches, no need to look for a transformation
+    if (correspondences->size() < min_correspondences) {
+        cout << "Only " << correspondences->size() << " matches, skipping registration" << endl;
         T.setIdentity();
+        return;
+    }
+
+    vector<int> inliers;
+    size_t nbr_iterations = estimate_transformation_adaptive(inliers, *correspondences, keypoint_cloud1, keypoint_cloud2);
+    cout << "Found " << inliers.size() << " inliers out of " << correspondences->size() << " matches in " << nbr_iterations << " iterations" << endl;
+
+    if (inliers.size() < min_correspondences || inliers.size() == correspondences->size()) { // No samples could be selected
+        T.setIdentity();
+    }
+    else {
+        pcl::Correspondences sac_correspondences;
+        for (int i : inliers) {
+            sac_correspondences.push_back(correspondences->at(i));
+        }
+        pcl::registration::TransformationEstimationSVD<PointT, PointT> trans_est;
+        trans_est.estimateRigidTransformation(*keypoint_cloud1, *keypoint_cloud2, sac_correspondences, T);
     }
 
     cout << "Estimated transformation: " << endl;
@@ -616,10 +766,8 @@ pair<double, double> register_objects::get_match_score()
     if (c1->empty() || c2->empty()) {
         return make_pair(0.05, 0.0);
     }
-    CloudT::Ptr new_cloud(new CloudT);
-    pcl::transformPointCloud(*c1, *new_cloud, T);
 
-    double overlap = compute_overlap(c2, new_cloud);
+    double overlap = compute_overlap(c2, c1, T);
     overlap = std::max(overlap, 0.05);
 
     return make_pair(overlap, 0.0);
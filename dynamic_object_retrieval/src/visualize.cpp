@@ -1,9 +1,12 @@
 #include "dynamic_object_retrieval/visualize.h"
+#include "dynamic_object_retrieval/descriptor_projection.h"
 
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/filters/approximate_voxel_grid.h>
 #include <cereal/archives/binary.hpp>
 
+#include <type_traits>
+
 POINT_CLOUD_REGISTER_POINT_STRUCT (HistT,
                                    (float[N], histogram, histogram)
 )
@@ -46,47 +49,55 @@ void visualize(CloudT::Ptr& cloud, float subsample_size)
     }
 }
 
-// we need to put these in some file as they will be used throughout, summary_convenience?
-void save_vocabulary(vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path)
+// the vocabularies of projected descriptors are kept in the same files,
+// the descriptor projection next to them tells which kind a folder contains
+template <typename Point>
+boost::filesystem::path vocabulary_file(const vocabulary_tree<Point, 8>&, const boost::filesystem::path& vocabulary_path)
 {
-    ofstream out((vocabulary_path / "vocabulary.cereal").string(), ios::binary);
-    {
-        cereal::BinaryOutputArchive archive_o(out);
-        archive_o(vt);
-    }
+    return vocabulary_path / "vocabulary.cereal";
 }
 
-void load_vocabulary(vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path)
+template <typename Point>
+boost::filesystem::path vocabulary_file(const grouped_vocabulary_tree<Point, 8>&, const boost::filesystem::path& vocabulary_path)
 {
-    ifstream in((vocabulary_path / "vocabulary.cereal").string(), ios::binary);
-    {
-        cereal::BinaryInputArchive archive_i(in);
-        archive_i(vt);
-    }
+    return vocabulary_path / "grouped_vocabulary.cereal";
 }
 
-void save_vocabulary(grouped_vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path)
+// we need to put these in some file as they will be used throughout, summary_convenience?
+template <typename VocabularyT>
+void save_vocabulary(VocabularyT& vt, const boost::filesystem::path& vocabulary_path)
 {
-    ofstream out((vocabulary_path / "grouped_vocabulary.cereal").string(), ios::binary);
+    ofstream out(vocabulary_file(vt, vocabulary_path).string(), ios::binary);
     {
         cereal::BinaryOutputArchive archive_o(out);
         archive_o(vt);
     }
-
-    //string group_file = segment_path + "/" + descriptor_config::grouped_associations_file;
-    //vt.save_group_associations(group_file);
 }
 
-void load_vocabulary(grouped_vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path)
+template <typename VocabularyT>
+void load_vocabulary(VocabularyT& vt, const boost::filesystem::path& vocabulary_path)
 {
-    ifstream in((vocabulary_path / "grouped_vocabulary.cereal").string(), ios::binary);
+    bool projected = std::is_same<typename VocabularyT::point_type, ProjectedHistT>::value;
+    if (has_descriptor_projection(vocabulary_path) != projected) {
+        cout << vocabulary_path.string() << " contains a vocabulary of " << (projected? "full" : "projected")
+             << " descriptors, it can not be loaded as a vocabulary of " << (projected? "projected" : "full") << " descriptors..." << endl;
+        exit(-1);
+    }
+
+    ifstream in(vocabulary_file(vt, vocabulary_path).string(), ios::binary);
     {
         cereal::BinaryInputArchive archive_i(in);
         archive_i(vt);
     }
-
-    //string group_file = segment_path + "/" + descriptor_config::grouped_associations_file;
-    //vt.load_group_associations(group_file);
 }
 
+template void save_vocabulary(vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+template void load_vocabulary(vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+template void save_vocabulary(grouped_vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+template void load_vocabulary(grouped_vocabulary_tree<HistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+template void save_vocabulary(vocabulary_tree<ProjectedHistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+template void load_vocabulary(vocabulary_tree<ProjectedHistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+template void save_vocabulary(grouped_vocabulary_tree<ProjectedHistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+template void load_vocabulary(grouped_vocabulary_tree<ProjectedHistT, 8>& vt, const boost::filesystem::path& vocabulary_path);
+
 }
@@ -3,8 +3,6 @@
 #include <pcl/io/pcd_io.h>
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/common/centroid.h>
-#include <cereal/types/set.hpp>
-#include <cereal/archives/binary.hpp>
 
 #include <metaroom_xml_parser/load_utilities.h>
 #include <dynamic_object_retrieval/definitions.h>
@@ -39,6 +37,9 @@ int main(int argc, char** argv)
 
     vector<string> folder_xmls = semantic_map_load_utilties::getSweepXmls<PointT>(data_path.string(), true);
 
+    // we only need the cache path to read the adjacencies, not the vocabulary itself
+    grouped_vocabulary_tree<HistT, 8> vt(vocabulary_path.string());
+
     size_t counter = 0;
     for (const string& xml : folder_xmls) {
         if (counter > 10 && counter < folder_xmls.size() - 10) {
@@ -59,17 +60,10 @@ int main(int argc, char** argv)
             centroids->back().getVector4fMap() = point;
         }
 
-        stringstream ss;
-        ss << "group" << setfill('0') << setw(6) << counter;
-        boost::filesystem::path adjacencies_path = vocabulary_path / "vocabulary_vectors" / ss.str() / "adjacencies.cereal";
-        cout << "Reading " << adjacencies_path.string() << endl;
-        set<pair<int, int> > adjacencies;
-        ifstream ina(adjacencies_path.string());
-        {
-            cereal::BinaryInputArchive archive_i(ina);
-            archive_i(adjacencies);
-        }
-        ina.close();
+        cout << "Reading adjacencies of group " << counter << endl;
+        vector<vocabulary_vector> vectors;
+        subgroup_adjacencies adjacencies;
+        vt.load_cached_vocabulary_vectors_for_group(vectors, adjacencies, counter);
 
         boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer(new pcl::visualization::PCLVisualizer ("3D Viewer"));
         viewer->setBackgroundColor(1, 1, 1);
@@ -78,12 +72,14 @@ int main(int argc, char** argv)
         viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "sample cloud");
 
         int i = 0;
-        for (const pair<int, int>& a : adjacencies) {
-            string line_id = string("line") + to_string(i);
-            cout << "Centroids size: " << centroids->size() << endl;
-            cout << "Adjacency: (" << a.first << ", " << a.second << ")" << endl;
-            viewer->addLine<PointT>(centroids->at(a.first), centroids->at(a.second), 1.0, 0.0, 0.0, line_id);
-            ++i;
+        for (int a = 0; a < adjacencies.size(); ++a) {
+            for (auto it = adjacencies.neighbours_begin(a); it != adjacencies.neighbours_end(a) && *it < a; ++it) {
+                string line_id = string("line") + to_string(i);
+                cout << "Centroids size: " << centroids->size() << endl;
+                cout << "Adjacency: (" << a << ", " << *it << ")" << endl;
+                viewer->addLine<PointT>(centroids->at(a), centroids->at(*it), 1.0, 0.0, 0.0, line_id);
+                ++i;
+            }
         }
 
         //viewer->addCoordinateSystem(1.0);
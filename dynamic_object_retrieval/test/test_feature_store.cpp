@@ -0,0 +1,100 @@
+#include "dynamic_object_retrieval/feature_store.h"
+
+#include <random>
+#include <iostream>
+
+using namespace std;
+
+using PointT = pcl::PointXYZRGB;
+using CloudT = pcl::PointCloud<PointT>;
+using HistT = pcl::Histogram<N>;
+using HistCloudT = pcl::PointCloud<HistT>;
+
+// writes one sweep with a segment of random features and a segment with only the
+// inf row of segments without features, and checks that they are read back the
+// same with every encoding
+int main(int argc, char** argv)
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> value(0.0f, 100.0f);
+
+    HistCloudT features;
+    CloudT keypoints;
+    for (int i = 0; i < 20; ++i) {
+        HistT f;
+        PointT p;
+        for (int j = 0; j < N; ++j) {
+            f.histogram[j] = value(gen);
+        }
+        p.x = value(gen); p.y = value(gen); p.z = value(gen);
+        features.push_back(f);
+        keypoints.push_back(p);
+    }
+
+    HistCloudT empty_features;
+    CloudT empty_keypoints;
+    HistT inf_feature;
+    PointT inf_keypoint;
+    for (int j = 0; j < N; ++j) {
+        inf_feature.histogram[j] = std::numeric_limits<float>::infinity();
+    }
+    inf_keypoint.x = inf_keypoint.y = inf_keypoint.z = std::numeric_limits<float>::infinity();
+    empty_features.push_back(inf_feature);
+    empty_keypoints.push_back(inf_keypoint);
+
+    boost::filesystem::path store_path = boost::filesystem::temp_directory_path() /
+                                         boost::filesystem::unique_path("test_%%%%%%%%_features.store");
+
+    const dynamic_object_retrieval::feature_store_encoding encodings[] = {
+        dynamic_object_retrieval::float32_encoding, dynamic_object_retrieval::float16_encoding, dynamic_object_retrieval::uint8_encoding
+    };
+    // the codes round to within half a step of the largest bin
+    const float tolerances[] = { 0.0f, 1e-3f, 0.5f/255.0f };
+
+    int result = 0;
+    for (int e = 0; e < 3; ++e) {
+        {
+            dynamic_object_retrieval::feature_store_writer writer(store_path, encodings[e]);
+            writer.add_sweep("sweep", 0);
+            writer.add_segment(features, keypoints);
+            writer.add_segment(empty_features, empty_keypoints);
+        }
+
+        dynamic_object_retrieval::feature_store store;
+        if (!store.open(store_path)) {
+            cout << "Could not open the store with encoding " << encodings[e] << "..." << endl;
+            result = 1;
+            continue;
+        }
+
+        HistCloudT read_features;
+        store.get_cloud(read_features, 0);
+        float max_error = 0.0f;
+        for (size_t i = 0; i < features.size(); ++i) {
+            float max_value = *std::max_element(features[i].histogram, features[i].histogram + N);
+            for (int j = 0; j < N; ++j) {
+                max_error = std::max(max_error, fabs(read_features[i].histogram[j] - features[i].histogram[j]) / max_value);
+            }
+        }
+        cout << "Encoding " << encodings[e] << ": relative error " << max_error << endl;
+        if (read_features.size() != features.size() || max_error > tolerances[e]) {
+            cout << "The features do not match..." << endl;
+            result = 1;
+        }
+
+        HistCloudT read_empty_features;
+        CloudT read_empty_keypoints;
+        store.get_cloud(read_empty_features, 1);
+        store.get_cloud(read_empty_keypoints, 1);
+        if (read_empty_features.size() != 1 || read_empty_keypoints.size() != 1 ||
+                !std::all_of(read_empty_features[0].histogram, read_empty_features[0].histogram + N, [](float v) { return std::isinf(v); }) ||
+                !std::isinf(read_empty_keypoints[0].x)) {
+            cout << "The inf row of the empty segment was not kept..." << endl;
+            result = 1;
+        }
+    }
+
+    boost::filesystem::remove(store_path);
+
+    return result;
+}
@@ -0,0 +1,77 @@
+#include "object_3d_retrieval/feature_pipeline.h"
+
+#include <pcl/features/pfhrgb.h>
+
+#include <random>
+#include <iostream>
+
+using namespace std;
+using namespace pfhrgb_estimation;
+
+// compares the vectorized pfhrgb descriptors with the ones of pcl::PFHRGBEstimation,
+// the cloud contains duplicate points and black points since those are the special cases.
+// the bins are sums of the same increment, so they only match if the pairs are put in
+// the same bins as in pcl, which is needed for the vocabularies trained on the old features
+int main(int argc, char** argv)
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> coord(0.0f, 0.1f);
+    std::uniform_int_distribution<int> color(0, 255);
+
+    CloudT::Ptr cloud(new CloudT);
+    for (int i = 0; i < 500; ++i) {
+        PointT p;
+        p.x = coord(gen);
+        p.y = coord(gen);
+        p.z = 0.2f*p.x*p.y;
+        p.r = color(gen); p.g = color(gen); p.b = color(gen);
+        if (i % 10 == 0) {
+            p.r = p.g = p.b = 0;
+        }
+        else if (i % 10 == 1) {
+            p.r = 0;
+        }
+        cloud->push_back(p);
+        if (i % 7 == 0) {
+            cloud->push_back(p);
+        }
+    }
+
+    const double radius = 0.04;
+    feature_pipeline pipeline(cloud, radius);
+    NormalCloudT::Ptr normals = pipeline.compute_normals(radius);
+
+    vector<int> keypoint_indices;
+    for (int i = 0; i < int(cloud->size()); i += 13) {
+        keypoint_indices.push_back(i);
+    }
+    PfhRgbCloudT::Ptr features(new PfhRgbCloudT);
+    pipeline.compute_pfhrgb_features(features, keypoint_indices, normals, radius);
+
+    pcl::PFHRGBEstimation<PointT, NormalT, pcl::PFHRGBSignature250> estimation;
+    Eigen::VectorXf histogram(250);
+    vector<int> neighbors;
+    size_t mismatches = 0;
+    float max_error = 0.0f;
+    for (size_t i = 0; i < keypoint_indices.size(); ++i) {
+        pipeline.get_neighborhoods().get_neighbors(neighbors, keypoint_indices[i], radius);
+        estimation.computePointPFHRGBSignature(*cloud, *normals, neighbors, 5, histogram);
+        float error = 0.0f;
+        for (int j = 0; j < 250; ++j) {
+            // relative to the bin, so one pair in another bin is always a mismatch
+            float bin = std::max(std::abs(histogram(j)), std::abs(features->points[i].histogram[j]));
+            if (bin > 0.0f) {
+                error = std::max(error, std::abs(histogram(j) - features->points[i].histogram[j]) / bin);
+            }
+        }
+        max_error = std::max(max_error, error);
+        if (error > 1e-5f) {
+            ++mismatches;
+        }
+    }
+
+    cout << "Compared " << keypoint_indices.size() << " descriptors, " << mismatches
+         << " differ from pcl, max relative difference " << max_error << endl;
+
+    return mismatches == 0? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#include "object_3d_retrieval/register_objects.h"
+
+#include <random>
+#include <iostream>
+
+using namespace std;
+
+using PointT = pcl::PointXYZRGB;
+using CloudT = pcl::PointCloud<PointT>;
+using SiftT = pcl::Histogram<128>;
+using SiftCloudT = pcl::PointCloud<SiftT>;
+
+// gives access to the ransac of the registration
+class adaptive_registration : public register_objects {
+public:
+    using register_objects::estimate_transformation_adaptive;
+};
+
+// with fewer than 3 correspondences no transformation can be sampled, so all of them should be kept
+bool check_few_correspondences(CloudT::Ptr& keypoint_cloud1, CloudT::Ptr& keypoint_cloud2)
+{
+    adaptive_registration ro;
+    for (int n = 0; n < 3; ++n) {
+        pcl::Correspondences correspondences;
+        for (int i = 0; i < n; ++i) {
+            correspondences.push_back(pcl::Correspondence(i, i, 0.0f));
+        }
+        vector<int> inliers;
+        size_t nbr_iterations = ro.estimate_transformation_adaptive(inliers, correspondences, keypoint_cloud1, keypoint_cloud2);
+        if (inliers.size() != size_t(n) || nbr_iterations != 0) {
+            cout << "With " << n << " correspondences, got " << inliers.size() << " inliers in " << nbr_iterations << " iterations..." << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// checks that registering with a prebuilt index of the candidate features gives
+// the same matches as the plain registration, also when the index is reused by a
+// second registration. the query has fewer features than the candidate so matching
+// in the wrong direction would give more matches
+int main(int argc, char** argv)
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> coord(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> value(0.0f, 100.0f);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+
+    Eigen::Affine3f transform = Eigen::Affine3f::Identity();
+    transform.rotate(Eigen::AngleAxisf(0.3f, Eigen::Vector3f::UnitZ()));
+    transform.translation() << 0.1f, -0.2f, 0.05f;
+
+    SiftCloudT::Ptr sift_cloud1(new SiftCloudT);
+    SiftCloudT::Ptr sift_cloud2(new SiftCloudT);
+    CloudT::Ptr keypoint_cloud1(new CloudT);
+    CloudT::Ptr keypoint_cloud2(new CloudT);
+    for (int i = 0; i < 300; ++i) {
+        SiftT f;
+        PointT p;
+        for (int j = 0; j < 128; ++j) {
+            f.histogram[j] = value(gen);
+        }
+        p.x = coord(gen); p.y = coord(gen); p.z = coord(gen);
+        sift_cloud2->push_back(f);
+        keypoint_cloud2->push_back(p);
+        // every third candidate feature is also seen in the query
+        if (i % 3 == 0) {
+            for (int j = 0; j < 128; ++j) {
+                f.histogram[j] += noise(gen);
+            }
+            p.getVector3fMap() = transform.inverse()*p.getVector3fMap();
+            sift_cloud1->push_back(f);
+            keypoint_cloud1->push_back(p);
+        }
+    }
+
+    register_objects ro1;
+    ro1.set_input_clouds(keypoint_cloud1, keypoint_cloud2);
+    ro1.do_registration(sift_cloud1, sift_cloud2, keypoint_cloud1, keypoint_cloud2);
+
+    sift_descriptor_index sift_index2(sift_cloud2);
+    register_objects ro2;
+    ro2.set_input_clouds(keypoint_cloud1, keypoint_cloud2);
+    ro2.do_registration(sift_cloud1, sift_index2, keypoint_cloud1, keypoint_cloud2);
+
+    register_objects ro3;
+    ro3.set_input_clouds(keypoint_cloud1, keypoint_cloud2);
+    ro3.do_registration(sift_cloud1, sift_index2, keypoint_cloud1, keypoint_cloud2);
+
+    cout << "Plain registration: " << ro1.get_nbr_correspondences() << " correspondences" << endl;
+    cout << "Indexed registration: " << ro2.get_nbr_correspondences() << " correspondences" << endl;
+    cout << "Reused index registration: " << ro3.get_nbr_correspondences() << " correspondences" << endl;
+
+    if (ro1.get_nbr_correspondences() != ro2.get_nbr_correspondences() ||
+            ro2.get_nbr_correspondences() != ro3.get_nbr_correspondences() ||
+            ro1.get_nbr_correspondences() == 0 || ro1.get_nbr_correspondences() > sift_cloud1->size()) {
+        cout << "The registrations do not match..." << endl;
+        return 1;
+    }
+
+    if (!check_few_correspondences(keypoint_cloud1, keypoint_cloud2)) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <fstream>
 
 #include <boost/filesystem.hpp>
+#include <boost/dynamic_bitset.hpp>
 
 #define ONCE_PER_MAP 0
 
@@ -34,7 +35,7 @@ template <typename Point, size_t K>
 void grouped_vocabulary_tree<Point, K>::query_vocabulary(vector<result_type>& updated_scores, CloudPtrT& query_cloud, size_t nbr_query)
 {
     // need a way to get
-    // 1. mapping - can get this directly but would need to cache
+    // 1. node ids - these are now stored in the nodes
     // 2. vocabulary_norms, vocabulary_vectors and vocabulary_index_vectors, all for one sweep!
     // 3. the clouds - for what do we actually need them? aa, yes, to get the adjacency
     // 4. folder path for saving and loading - part of initialization
@@ -48,23 +49,12 @@ void grouped_vocabulary_tree<Point, K>::query_vocabulary(vector<result_type>& up
         top_combined_similarities(scores, query_cloud, 200); // make initial number of subsegments configurable
     }
 
-    if (mapping.empty()) {
-        super::get_node_mapping(mapping);
-    }
-
-    // TODO: fix this part
-    // these two must be computed at runtime, probably the first time this function is called
-    map<int, node*> inverse_mapping;
-    for (const pair<node*, int>& u : mapping) {
-        inverse_mapping.insert(make_pair(u.second, u.first));
-    }
-
     //std::vector<result_type> updated_scores;
     //std::vector<group_type> updated_indices;
     //vector<index_score> total_scores;
     for (size_t i = 0; i < scores.size(); ++i) {
         vector<vocabulary_vector> vectors;
-        set<pair<int, int> > adjacencies;
+        subgroup_adjacencies adjacencies;
 
         cout << "Loading " << i << ":th score with group: " << scores[i].group_index << endl;
         cout << "Loading " << i << ":th score with subsegment: " << scores[i].subgroup_index << endl;
@@ -74,7 +64,7 @@ void grouped_vocabulary_tree<Point, K>::query_vocabulary(vector<result_type>& up
         vector<int> selected_indices;
         // get<1>(scores[i])) is actually the index within the group!
         double score = super::compute_min_combined_dist(selected_indices, query_cloud, vectors, adjacencies,
-                                                        mapping, inverse_mapping, scores[i].subgroup_index);
+                                                        scores[i].subgroup_index);
         //double score = scores[i].score;
         //selected_indices.push_back(scores[i].subgroup_index);
         updated_scores.push_back(result_type(float(score), scores[i].group_index, selected_indices[0]));
@@ -87,55 +77,32 @@ void grouped_vocabulary_tree<Point, K>::query_vocabulary(vector<result_type>& up
 
     std::sort(updated_scores.begin(), updated_scores.end(), [](const result_type& s1, const result_type& s2)
     {
-        return s1.group_index < s2.group_index;
-    });
-
-    // this approach has some problems, most importantly, we should keep the intersection with the lowest distance
-    /*
-    auto new_end = std::unique(updated_scores.begin(), updated_scores.end(), [](const result_type& s1, const result_type& s2)
-    {
-        return s1.group_index == s2.group_index && (s1.subgroup_group_indices.begin(), s1.subgroup_group_indices.end(),
-                                                    s2.subgroup_group_indices.begin(), s2.subgroup_group_indices.end()) != s1.subgroup_group_indices.end();
+        return s1.score < s2.score;
     });
-    updated_scores.erase(new_end, updated_scores.end());
-    */
 
-    // just go through everything in a group, keep everything unless there is overlap with one of the previous ones,
-    // in that case keep the one with the highest score
-    vector<pair<result_type, size_t> > index_scores;
-    int current_index = -1;
+    // non-maximum suppression within the groups: go through the results from best to worst,
+    // keep a result only if none of its subsegments were already claimed by a better one in the same group
+    unordered_map<int, boost::dynamic_bitset<> > claimed_subgroups;
+    size_t nbr_kept = 0;
     for (size_t i = 0; i < updated_scores.size(); ++i) {
-        if (updated_scores[i].group_index != current_index) {
-            current_index = updated_scores[i].group_index;
-            std::sort(index_scores.begin(), index_scores.end(), [](const pair<result_type, size_t>& s1, const pair<result_type, size_t>& s2)
-            {
-                return s1.first.score < s2.first.score;
-            });
-            for (size_t j = 1; j < index_scores.size(); ++j) {
-                for (size_t k = 0; k < j; ++k) { // this is a f*in bug, we shouldn't remove stuff that we already removed...
-                    if (updated_scores[index_scores[k].second].score > 999.0f) { // if we already removed it, don't check overlap
-                        continue;
-                    }
-                    // check if there is an overlap with any of the better scoring segments, if so, remove
-                    if (std::find_first_of(index_scores[j].first.subgroup_group_indices.begin(), index_scores[j].first.subgroup_group_indices.end(),
-                        index_scores[k].first.subgroup_group_indices.begin(), index_scores[k].first.subgroup_group_indices.end()) !=
-                            index_scores[j].first.subgroup_group_indices.end()) {
-                        // not good, it has an overlap with some of the others, discard by setting score very high!
-                        //remove_indices.push_back(index_scores[j].second);
-                        updated_scores[index_scores[j].second].score = 1000.0f;
-                        break;
-                    }
-                }
-            }
-            index_scores.clear();
+        const vector<int>& subgroup_indices = updated_scores[i].subgroup_group_indices;
+        boost::dynamic_bitset<>& claimed = claimed_subgroups[updated_scores[i].group_index];
+        int max_index = *std::max_element(subgroup_indices.begin(), subgroup_indices.end());
+        if (size_t(max_index) >= claimed.size()) {
+            claimed.resize(max_index + 1);
         }
-        index_scores.push_back(make_pair(updated_scores[i], i));
+        if (std::any_of(subgroup_indices.begin(), subgroup_indices.end(), [&](int j) { return claimed[j]; })) {
+            continue;
+        }
+        for (int j : subgroup_indices) {
+            claimed.set(j);
+        }
+        if (nbr_kept != i) {
+            updated_scores[nbr_kept] = std::move(updated_scores[i]);
+        }
+        ++nbr_kept;
     }
-
-    std::sort(updated_scores.begin(), updated_scores.end(), [](const result_type& s1, const result_type& s2)
-    {
-        return s1.score < s2.score;
-    });
+    updated_scores.resize(nbr_kept);
 
     if (nbr_query > 0 && updated_scores.size() > nbr_query) {
         updated_scores.resize(nbr_query);
@@ -176,111 +143,175 @@ void grouped_vocabulary_tree<Point, K>::query_vocabulary(vector<result_type>& up
 }
 
 
+// the cached data of all groups are appended to one packed file per type, e.g. vectors.cereal,
+// together with an index file with one (group, offset) record per group, e.g. vectors.index
 template <typename Point, size_t K>
-void grouped_vocabulary_tree<Point, K>::cache_group_adjacencies(int start_ind, vector<set<pair<int, int> > >& adjacencies)
+void grouped_vocabulary_tree<Point, K>::load_packed_offsets(unordered_map<int, uint64_t>& offsets, const string& name)
 {
-    boost::filesystem::path cache_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors";
-    boost::filesystem::create_directory(cache_path);
+    offsets.clear();
+    if (save_state_path.empty()) {
+        return;
+    }
 
-    for (int i = 0; i < adjacencies.size(); ++i) {
-        stringstream ss;
-        ss << "group" << setfill('0') << setw(6) << start_ind + i;
-        boost::filesystem::path group_path = cache_path / ss.str();
-        boost::filesystem::create_directory(group_path);
-
-        boost::filesystem::path adjacencies_path = group_path / "adjacencies.cereal";
-        ofstream outa(adjacencies_path.string());
-        {
-            cereal::BinaryOutputArchive archive_o(outa);
-            archive_o(adjacencies[i]);
-        }
-        outa.close();
+    boost::filesystem::path index_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors" / (name + ".index");
+    ifstream in(index_path.string(), ios::binary);
+    int32_t group;
+    uint64_t offset;
+    while (in.read(reinterpret_cast<char*>(&group), sizeof(group)) && in.read(reinterpret_cast<char*>(&offset), sizeof(offset))) {
+        offsets[group] = offset; // if a group was written twice, the last one is used
     }
 }
 
-// takes a vector which for each groups contains the adjacencies of the elements, stores in gvt location
-// we need something more here, like at which index the cloud starts
+// the offsets are read once here and then only read by the queries, which may run concurrently
+template <typename Point, size_t K>
+void grouped_vocabulary_tree<Point, K>::load_packed_offsets()
+{
+    load_packed_offsets(vectors_offsets, "vectors");
+    load_packed_offsets(adjacencies_offsets, "adjacencies");
+}
+
+// truncates the packed files, when we start training into a folder with an old vocabulary
 template <typename Point, size_t K>
-void grouped_vocabulary_tree<Point, K>::cache_vocabulary_vectors(int start_ind, CloudPtrT& cloud)
+void grouped_vocabulary_tree<Point, K>::clear_packed(unordered_map<int, uint64_t>& offsets, const string& name)
 {
-    // fuck, we need boost to create folders in the adjacencies
     boost::filesystem::path cache_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors";
-    boost::filesystem::create_directory(cache_path);
+    ofstream outd((cache_path / (name + ".cereal")).string(), ios::binary | ios::trunc);
+    ofstream outi((cache_path / (name + ".index")).string(), ios::binary | ios::trunc);
+    offsets.clear();
+}
 
-    // we need this to compute the vectors
-    if (mapping.empty()) {
-        super::get_node_mapping(mapping);
-    }
+template <typename Point, size_t K>
+template <typename T>
+void grouped_vocabulary_tree<Point, K>::save_packed_for_group(const T& data, int i, const string& name, unordered_map<int, uint64_t>& offsets)
+{
+    boost::filesystem::path cache_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors";
+    boost::filesystem::path data_path = cache_path / (name + ".cereal");
+    boost::filesystem::path index_path = cache_path / (name + ".index");
 
-    int current_group = group_subgroup[super::indices[start_ind]].first;
-    int current_subgroup = 0;
-    vector<vocabulary_vector> current_vectors;
-    CloudPtrT current_cloud(new CloudT);
+    uint64_t offset = boost::filesystem::exists(data_path) ? boost::filesystem::file_size(data_path) : 0;
+    ofstream outd(data_path.string(), ios::binary | ios::app);
+    {
+        cereal::BinaryOutputArchive archive_o(outd);
+        archive_o(data);
+    }
+    outd.close();
 
-    // iterate through all the groups and create the vocabulary vectors and norms
-    for (int i = 0; i <= cloud->size(); ++i) {
-        pair<int, int> group;
-        if (i == cloud->size()) {
-            group = make_pair(-1, -1);
-        }
-        else {
-            group = group_subgroup[super::indices[start_ind + i]]; // this will have to be index in cleaned up cloud
-        }
+    int32_t group = i;
+    ofstream outi(index_path.string(), ios::binary | ios::app);
+    outi.write(reinterpret_cast<const char*>(&group), sizeof(group));
+    outi.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    outi.close();
 
-        if (group.second != current_subgroup || group.first != current_group) {
+    offsets[i] = offset;
+}
 
-            if (!current_cloud->empty()) {
-                vocabulary_vector vec = super::compute_query_index_vector(current_cloud, mapping);
-                vec.subgroup = current_subgroup;
-                current_vectors.push_back(vec);
-            }
-            current_subgroup = group.second;
-            current_cloud->clear();
+template <typename Point, size_t K>
+template <typename T>
+bool grouped_vocabulary_tree<Point, K>::load_packed_for_group(T& data, int i, const string& name, const unordered_map<int, uint64_t>& offsets) const
+{
+    auto iter = offsets.find(i);
+    if (iter == offsets.end()) {
+        return false;
+    }
 
-            if (group.first != current_group) {
-                save_cached_vocabulary_vectors_for_group(current_vectors, current_group);
-                current_group = group.first;
-                current_vectors.clear();
-            }
-        }
+    boost::filesystem::path data_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors" / (name + ".cereal");
+    ifstream in(data_path.string(), ios::binary);
+    in.seekg(iter->second);
+    {
+        cereal::BinaryInputArchive archive_i(in);
+        archive_i(data);
+    }
+    in.close();
 
-        if (i < cloud->size()) {
-            current_cloud->push_back(cloud->at(i));
-        }
-        // now, get all of the elements in the group
-        // wait 2 s, what happens if we split up one group in the middle?????? we need to make sure that does never happen
-        // if group_subgroup was a vector this would be more natural
+    return true;
+}
 
+template <typename Point, size_t K>
+void grouped_vocabulary_tree<Point, K>::cache_group_adjacencies(int start_ind, vector<subgroup_adjacencies>& adjacencies)
+{
+    boost::filesystem::path cache_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors";
+    boost::filesystem::create_directory(cache_path);
+    if (start_ind == 0) {
+        clear_packed(adjacencies_offsets, "adjacencies");
     }
 
-    // actually, maybe we should do this at the same time as we add the cloud
-    // should we demand that the adjacencies are handed in at the same time????
-    // yes let's assume that for now
+    for (int i = 0; i < adjacencies.size(); ++i) {
+        save_packed_for_group(adjacencies[i], start_ind + i, "adjacencies", adjacencies_offsets);
+    }
 }
 
+// computes the vocabulary vectors of all the subgroups of the points from start_ind, stores in gvt location.
+// start_ind is the number of points in the tree before they were added, the nan points are never in the tree
 template <typename Point, size_t K>
-void grouped_vocabulary_tree<Point, K>::save_cached_vocabulary_vectors_for_group(vector<vocabulary_vector>& vectors, int i)
+void grouped_vocabulary_tree<Point, K>::cache_vocabulary_vectors(int start_ind)
 {
     boost::filesystem::path cache_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors";
+    boost::filesystem::create_directory(cache_path);
+    if (start_ind == 0) {
+        clear_packed(vectors_offsets, "vectors");
+    }
 
-    stringstream ss;
-    ss << "group" << setfill('0') << setw(6) << i;
-    boost::filesystem::path group_path = cache_path / ss.str();
-    boost::filesystem::create_directory(group_path);
-
-    boost::filesystem::path vectors_path = group_path / "vectors.cereal";
-    ofstream outv(vectors_path.string());
-    {
-        cereal::BinaryOutputArchive archive_o(outv);
-        archive_o(vectors);
+    // the points were put in their leaves when they were added, no need to descend the tree again
+    vector<int> point_leaves;
+    super::get_leaves_for_points(point_leaves, start_ind);
+    size_t nbr_new_points = super::indices.size() - start_ind;
+    if (point_leaves.size() != nbr_new_points) {
+        cout << "The tree has " << point_leaves.size() << " new points but " << nbr_new_points << " new indices..." << endl;
+        exit(-1);
+    }
+    vector<vector<int> > leaf_paths;
+    super::get_leaf_paths(leaf_paths);
+
+    // all points of a subgroup are added after each other, find the start of every subgroup
+    // wait 2 s, what happens if we split up one group in the middle?????? we need to make sure that does never happen
+    vector<pair<int, int> > subgroups;
+    vector<size_t> subgroup_starts;
+    for (size_t i = 0; i < nbr_new_points; ++i) {
+        const pair<int, int>& group = group_subgroup[super::indices[start_ind + i]];
+        if (subgroups.empty() || group != subgroups.back()) {
+            subgroups.push_back(group);
+            subgroup_starts.push_back(i);
+        }
+    }
+    subgroup_starts.push_back(nbr_new_points);
+
+    // the subgroups are independent so we can compute the vectors in parallel
+    vector<vocabulary_vector> vectors(subgroups.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int j = 0; j < int(subgroups.size()); ++j) {
+        vectors[j] = super::compute_leaf_index_vector(leaf_paths, point_leaves.cbegin() + subgroup_starts[j],
+                                                      point_leaves.cbegin() + subgroup_starts[j+1]);
+        vectors[j].subgroup = subgroups[j].second;
+    }
+
+    // then append them to the packed file, one record per group
+    size_t group_start = 0;
+    for (size_t j = 1; j <= subgroups.size(); ++j) {
+        if (j == subgroups.size() || subgroups[j].first != subgroups[group_start].first) {
+            vector<vocabulary_vector> group_vectors(std::make_move_iterator(vectors.begin() + group_start),
+                                                    std::make_move_iterator(vectors.begin() + j));
+            save_cached_vocabulary_vectors_for_group(group_vectors, subgroups[group_start].first);
+            group_start = j;
+        }
     }
-    outv.close();
+}
+
+template <typename Point, size_t K>
+void grouped_vocabulary_tree<Point, K>::save_cached_vocabulary_vectors_for_group(vector<vocabulary_vector>& vectors, int i)
+{
+    save_packed_for_group(vectors, i, "vectors", vectors_offsets);
 }
 
 template <typename Point, size_t K>
 void grouped_vocabulary_tree<Point, K>::load_cached_vocabulary_vectors_for_group(vector<vocabulary_vector>& vectors,
-                                                                                 set<pair<int, int> >& adjacencies, int i)
+                                                                                 subgroup_adjacencies& adjacencies, int i)
 {
+    if (load_packed_for_group(vectors, i, "vectors", vectors_offsets) &&
+        load_packed_for_group(adjacencies, i, "adjacencies", adjacencies_offsets)) {
+        return;
+    }
+
+    // vocabularies trained before the packed files were introduced have one folder per group
     boost::filesystem::path cache_path = boost::filesystem::path(save_state_path) / "vocabulary_vectors";
 
     stringstream ss;
@@ -297,13 +328,16 @@ void grouped_vocabulary_tree<Point, K>::load_cached_vocabulary_vectors_for_group
     }
     inv.close();
 
+    // these also stored the adjacencies as a set of subgroup pairs
     boost::filesystem::path adjacencies_path = group_path / "adjacencies.cereal";
+    set<pair<int, int> > adjacency_pairs;
     ifstream ina(adjacencies_path.string());
     {
         cereal::BinaryInputArchive archive_i(ina);
-        archive_i(adjacencies);
+        archive_i(adjacency_pairs);
     }
     ina.close();
+    adjacencies.assign(adjacency_pairs);
 
     cout << "Finished loading " << group_path << endl;
 }
@@ -432,14 +466,16 @@ void grouped_vocabulary_tree<Point, K>::append_cloud(CloudPtrT& extra_cloud, vec
     nbr_points += counter;
     cout << "Found " << nbr_subgroups << " number of subgroups" << endl;
 
+    // the new points start after the ones already in the tree
+    int start_ind = super::indices.size();
     super::append_cloud(temp_cloud, new_indices, store_points);
     // here we save our vocabulary vectors in a folder structure
-    cache_vocabulary_vectors(nbr_points-temp_cloud->size(), temp_cloud);
+    cache_vocabulary_vectors(start_ind);
 }
 
 template <typename Point, size_t K>
-//void grouped_vocabulary_tree<Point, K>::append_cloud(CloudPtrT& extra_cloud, vector<pair<int, int> >& indices, vector<set<pair<int, int> > >& adjacencies, bool store_points)
-void grouped_vocabulary_tree<Point, K>::append_cloud(CloudPtrT& extra_cloud, vector<index_type>& indices, vector<set<pair<int, int> > >& adjacencies, bool store_points)
+//void grouped_vocabulary_tree<Point, K>::append_cloud(CloudPtrT& extra_cloud, vector<pair<int, int> >& indices, vector<subgroup_adjacencies>& adjacencies, bool store_points)
+void grouped_vocabulary_tree<Point, K>::append_cloud(CloudPtrT& extra_cloud, vector<index_type>& indices, vector<subgroup_adjacencies>& adjacencies, bool store_points)
 {
     if (save_state_path.empty()) {
         cout << "If adjacencies are used, need to initialize with the cache path..." << endl;
@@ -462,14 +498,14 @@ void grouped_vocabulary_tree<Point, K>::add_points_from_input_cloud(bool save_cl
 {
     super::add_points_from_input_cloud(true);
     // here we save our vocabulary vectors in a folder structure
-    cache_vocabulary_vectors(0, super::cloud);
+    cache_vocabulary_vectors(0);
     if (!save_cloud) {
         super::cloud->clear();
     }
 }
 
 template <typename Point, size_t K>
-void grouped_vocabulary_tree<Point, K>::add_points_from_input_cloud(vector<set<pair<int, int> > >& adjacencies, bool save_cloud)
+void grouped_vocabulary_tree<Point, K>::add_points_from_input_cloud(vector<subgroup_adjacencies>& adjacencies, bool save_cloud)
 {
     if (save_state_path.empty()) {
         cout << "If adjacencies are used, need to initialize with the cache path..." << endl;
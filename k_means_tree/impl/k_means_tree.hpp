@@ -24,6 +24,9 @@ void k_means_tree<Point, K, Data, Lp>::add_points_from_input_cloud()
     }
     root.range = assign_nodes(cloud, root.children, 0, inds);
     inserted_points = cloud->size();
+    int counter = 0;
+    assign_node_ids(&root, counter);
+    nbr_nodes = counter;
 }
 
 template <typename Point, size_t K, typename Data, int Lp>
@@ -337,23 +340,54 @@ void k_means_tree<Point, K, Data, Lp>::append_leaves(node* n)
 }
 
 template <typename Point, size_t K, typename Data, int Lp>
-void k_means_tree<Point, K, Data, Lp>::assign_mapping_recursive(node* n, map<node*, int>& mapping, int& counter)
+void k_means_tree<Point, K, Data, Lp>::assign_node_ids(node* n, int& counter)
 {
-    mapping[n] = counter;
+    // same order as the old node mapping, so cached index vectors stay valid
+    n->id = counter;
     ++counter;
     if (n->is_leaf) {
         return;
     }
     for (node* c : n->children) {
-        assign_mapping_recursive(c, mapping, counter);
+        assign_node_ids(c, counter);
     }
 }
 
 template <typename Point, size_t K, typename Data, int Lp>
-void k_means_tree<Point, K, Data, Lp>::get_node_mapping(map<node*, int>& mapping)
+void k_means_tree<Point, K, Data, Lp>::append_leaf_paths(node* n, vector<int>& path, vector<vector<int> >& leaf_paths)
 {
-    int counter = 0;
-    assign_mapping_recursive(&root, mapping, counter);
+    path.push_back(n->id);
+    if (n->is_leaf) {
+        leaf_paths[n->range.first] = path;
+    }
+    else {
+        for (node* c : n->children) {
+            append_leaf_paths(c, path, leaf_paths);
+        }
+    }
+    path.pop_back();
+}
+
+// the node ids on the path from the root to every leaf, same as get_path_for_point for the points in the leaf
+template <typename Point, size_t K, typename Data, int Lp>
+void k_means_tree<Point, K, Data, Lp>::get_leaf_paths(vector<vector<int> >& leaf_paths)
+{
+    leaf_paths.resize(leaves.size());
+    vector<int> path;
+    append_leaf_paths(&root, path, leaf_paths);
+}
+
+// the leaf index of all the inserted points from start_ind, without descending the tree again
+template <typename Point, size_t K, typename Data, int Lp>
+void k_means_tree<Point, K, Data, Lp>::get_leaves_for_points(vector<int>& point_leaves, size_t start_ind)
+{
+    point_leaves.assign(inserted_points - start_ind, -1);
+    for (size_t i = 0; i < leaves.size(); ++i) {
+        // points are always added at the end of the leaves, so we only need to look at the last ones
+        for (auto it = leaves[i]->inds.rbegin(); it != leaves[i]->inds.rend() && size_t(*it) >= start_ind; ++it) {
+            point_leaves[*it - start_ind] = i;
+        }
+    }
 }
 
 template <typename Point, size_t K, typename Data, int Lp>
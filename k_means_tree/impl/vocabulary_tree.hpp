@@ -66,7 +66,7 @@ bool has_key_intersection(const set<Key>& lhs, const map<Key, Value>& rhs)
 
 template <typename Point, size_t K>
 void vocabulary_tree<Point, K>::compute_new_weights(map<int, double>& original_norm_constants,
-                                                    map<node*, double>& original_weights,
+                                                    map<int, double>& original_weights,
                                                     vector<pair<int, double> >& weighted_indices,
                                                     CloudPtrT& query_cloud)
 {
@@ -123,10 +123,10 @@ void vocabulary_tree<Point, K>::compute_new_weights(map<int, double>& original_n
 
     for (pair<node* const, pair<size_t, double> >& v : new_weights) {
         // compute and store the new weights
-        double original_weight = v.first->weight;
+        double original_weight = weights[v.first->id];
         double new_weight = (v.second.second / double(v.second.first)) * original_weight;
-        original_weights.insert(make_pair(v.first, original_weight));
-        v.first->weight = new_weight;
+        original_weights.insert(make_pair(v.first->id, original_weight));
+        weights[v.first->id] = new_weight;
 
         // update the normalization computations
         map<int, int> source_inds;
@@ -144,7 +144,7 @@ void vocabulary_tree<Point, K>::compute_new_weights(map<int, double>& original_n
 
 template <typename Point, size_t K>
 void vocabulary_tree<Point, K>::compute_new_weights(map<int, double>& original_norm_constants,
-                                                    map<node*, double>& original_weights,
+                                                    map<int, double>& original_weights,
                                                     vector<pair<set<int>, double> >& weighted_indices,
                                                     CloudPtrT& query_cloud)
 {
@@ -193,10 +193,10 @@ void vocabulary_tree<Point, K>::compute_new_weights(map<int, double>& original_n
 
     for (pair<node* const, pair<size_t, double> >& v : new_weights) {
         // compute and store the new weights
-        double original_weight = v.first->weight;
+        double original_weight = weights[v.first->id];
         double new_weight = (v.second.second / double(v.second.first)) * original_weight;
-        original_weights.insert(make_pair(v.first, original_weight));
-        v.first->weight = new_weight;
+        original_weights.insert(make_pair(v.first->id, original_weight));
+        weights[v.first->id] = new_weight;
 
         // update the normalization computations
         map<int, int> source_inds;
@@ -214,11 +214,11 @@ void vocabulary_tree<Point, K>::compute_new_weights(map<int, double>& original_n
 
 template <typename Point, size_t K>
 void vocabulary_tree<Point, K>::restore_old_weights(map<int, double>& original_norm_constants,
-                                                    map<node*, double>& original_weights)
+                                                    map<int, double>& original_weights)
 {
-    for (pair<node* const, double> v : original_weights) {
+    for (const pair<const int, double>& v : original_weights) {
         // restore the node weights
-        v.first->weight = v.second;
+        weights[v.first] = v.second;
     }
 
     for (pair<const int, double>& v : original_norm_constants) {
@@ -285,7 +285,7 @@ void vocabulary_tree<Point, K>::compute_vocabulary_vector(std::map<node*, double
     }
 
     for (std::pair<node* const, double>& v : query_id_freqs) {
-        v.second = v.first->weight*v.second;
+        v.second = weights[v.first->id]*v.second;
     }
 }
 
@@ -301,7 +301,7 @@ void vocabulary_tree<Point, K>::source_freqs_for_node(std::map<int, int>& source
 
 template <typename Point, size_t K>
 double vocabulary_tree<Point, K>::compute_min_combined_dist(vector<int>& included_indices, CloudPtrT& cloud, vector<vocabulary_vector>& smaller_freqs,
-                                                            set<pair<int, int> >& adjacencies, map<node*, int>& mapping, map<int, node*>& inverse_mapping, int hint) // TODO: const
+                                                            const subgroup_adjacencies& adjacencies, int hint)
 {
     vector<int> subgroup_indices;
     for (const vocabulary_vector& vec : smaller_freqs) {
@@ -309,6 +309,14 @@ double vocabulary_tree<Point, K>::compute_min_combined_dist(vector<int>& include
         subgroup_indices.push_back(vec.subgroup);
     }
 
+    // marks the subgroups that are adjacent to any of the included ones, updated with
+    // the neighbours of every subgroup that we include instead of probing all included pairs
+    size_t nbr_subgroup_ids = adjacencies.size();
+    for (int subgroup : subgroup_indices) {
+        nbr_subgroup_ids = std::max(nbr_subgroup_ids, size_t(subgroup + 1));
+    }
+    vector<bool> adjacent_to_included(nbr_subgroup_ids, false);
+
     // used to return which indices are picked
     vector<int> remaining_indices;
     for (int i = 0; i < smaller_freqs.size(); ++i) {
@@ -318,13 +326,13 @@ double vocabulary_tree<Point, K>::compute_min_combined_dist(vector<int>& include
     vector<double> pnorms(smaller_freqs.size(), 0.0); // compute these from smaller_freqs and current vocab weights
     for (int i = 0; i < smaller_freqs.size(); ++i) {
         for (const pair<int, pair<int, double> >& u : smaller_freqs[i].vec) {
-            pnorms[i] += pexp(inverse_mapping[u.first]->weight*double(u.second.first));
+            pnorms[i] += pexp(weights[u.first]*double(u.second.first));
         }
     }
 
     // first compute vectors to describe cloud and smaller_clouds
     map<int, double> cloud_freqs;
-    double qnorm = compute_query_index_vector(cloud_freqs, cloud, mapping);
+    double qnorm = compute_query_index_vector(cloud_freqs, cloud);
     double vnorm = 0.0;
 
     map<int, double> source_freqs; // to be filled in
@@ -348,26 +356,10 @@ double vocabulary_tree<Point, K>::compute_min_combined_dist(vector<int>& include
         for (size_t i = 0; i < smaller_freqs.size(); ++i) {
             // if added any parts, check if close enough to previous ones
             if (!included_indices.empty()) {
-                bool close_enough = false;
-                for (int j : included_indices) {
-                    //cout << "<<<<<<" << endl;
-                    //cout << j << endl;
-                    //cout << remaining_indices.at(i) << endl;
-                    //cout << subgroup_indices.size() << endl;
-                    //cout << ">>>>>>" << endl;
-                    if (adjacencies.count(make_pair(subgroup_indices[j], subgroup_indices[remaining_indices.at(i)])) ||
-                        adjacencies.count(make_pair(subgroup_indices[remaining_indices.at(i)], subgroup_indices[j]))) {
-                        close_enough = true;
-                        break;
-                    }
-                }
-                if (!close_enough) {
+                if (!adjacent_to_included[subgroup_indices[remaining_indices.at(i)]]) {
                     //cout << "Did not find any adjacencies!" << endl;
                     continue;
                 }
-                else {
-                    //cout << "Found adjacencies!" << endl;
-                }
             }
             else if (hint != -1) {
                 i = hint;
@@ -383,8 +375,9 @@ double vocabulary_tree<Point, K>::compute_min_combined_dist(vector<int>& include
                 if (source_freqs.count(v.first) != 0) { // this could be maintained in a map as a pair with cloud_freqs
                     source_comp = source_freqs[v.first];
                 }
-                if (smaller_freqs[i].vec.count(v.first) != 0) {
-                    cand_comp = inverse_mapping[v.first]->weight*double(smaller_freqs[i].vec[v.first].first);
+                auto cand_it = smaller_freqs[i].vec.find(v.first);
+                if (cand_it != smaller_freqs[i].vec.end()) {
+                    cand_comp = weights[v.first]*double(cand_it->second.first);
                 }
                 normdiff += pexp(source_comp) + pexp(cand_comp) - pexp(source_comp+cand_comp);
                 if (source_comp != 0 || cand_comp != 0) {
@@ -411,7 +404,7 @@ double vocabulary_tree<Point, K>::compute_min_combined_dist(vector<int>& include
         //vnorm += pnorms[minind];
 
         for (pair<const int, pair<int, double> >& v : smaller_freqs[minind].vec) {
-            double val = inverse_mapping[v.first]->weight*double(v.second.first);
+            double val = weights[v.first]*double(v.second.first);
             if (source_freqs.count(v.first) != 0) {
                 vnorm += pexp(source_freqs[v.first]+val) - pexp(source_freqs[v.first]);
             }
@@ -426,6 +419,13 @@ double vocabulary_tree<Point, K>::compute_min_combined_dist(vector<int>& include
         pnorms.erase(pnorms.begin() + minind);
         included_indices.push_back(remaining_indices.at(minind));
         remaining_indices.erase(remaining_indices.begin() + minind);
+
+        int included_subgroup = subgroup_indices[included_indices.back()];
+        if (size_t(included_subgroup) < adjacencies.size()) {
+            for (auto it = adjacencies.neighbours_begin(included_subgroup); it != adjacencies.neighbours_end(included_subgroup); ++it) {
+                adjacent_to_included[*it] = true;
+            }
+        }
     }
 
     /*
@@ -577,6 +577,7 @@ void vocabulary_tree<Point, K>::normalizing_constants_for_node(std::map<int, int
     else {
         n->weight = log(N) - log(double(normalizing_constants.size()));
     }
+    weights[n->id] = n->weight;
 
     // this could be further up if we do not want to e.g. calculate weights for upper nodes
     if (current_depth < matching_min_depth) {
@@ -594,10 +595,23 @@ template <typename Point, size_t K>
 void vocabulary_tree<Point, K>::compute_normalizing_constants()
 {
     db_vector_normalizing_constants.clear(); // this should be safe...
+    weights.assign(super::nbr_nodes, 0.0);
     std::map<int, int> normalizing_constants;
     normalizing_constants_for_node(normalizing_constants, &(super::root), 0);
 }
 
+template <typename Point, size_t K>
+void vocabulary_tree<Point, K>::gather_weights(node* n)
+{
+    weights[n->id] = n->weight;
+    if (n->is_leaf) {
+        return;
+    }
+    for (node* c : n->children) {
+        gather_weights(c);
+    }
+}
+
 template <typename Point, size_t K>
 void vocabulary_tree<Point, K>::top_combined_similarities(std::vector<result_type>& scores, CloudPtrT& query_cloud, size_t nbr_results)
 {
@@ -615,7 +629,7 @@ void vocabulary_tree<Point, K>::top_combined_similarities(std::vector<result_typ
             continue;
         }*/
         for (const std::pair<int, int>& u : source_id_freqs) {
-            map_scores[u.first] += std::min(v.first->weight*double(u.second), qi);
+            map_scores[u.first] += std::min(weights[v.first->id]*double(u.second), qi);
         }
     }
 
@@ -671,7 +685,7 @@ void vocabulary_tree<Point, K>::debug_similarities(std::vector<result_type>& sco
                 pk = dbnorm; // 1.0f for not normalized
                 pkr = proot(pk);
             }
-            double pi = v.first->weight*double(u.second)/pkr;
+            double pi = weights[v.first->id]*double(u.second)/pkr;
             double residual = pexp(qi-pi)-pexp(pi)-pexp(qi); // = 2*(pexp(std::max(qi-pi, 0.0))-pexp(qi));
             if (map_scores.count(u.first) == 1) {
                 map_scores.at(u.first) += residual;
@@ -721,7 +735,7 @@ double vocabulary_tree<Point, K>::compute_query_vector(std::map<node*, double>&
     }
     double qnorm = 0.0;
     for (std::pair<node* const, double>& v : query_id_freqs) {
-        v.second = v.first->weight*v.second;
+        v.second = weights[v.first->id]*v.second;
         qnorm += pexp(v.second);
     }
 
@@ -770,7 +784,7 @@ double vocabulary_tree<Point, K>::compute_query_vector(map<node*, pair<double, i
     }
     double qnorm = 0.0f;
     for (std::pair<node* const, pair<double, int> >& v : query_id_freqs) {
-        v.second.second = v.first->weight*v.second.second;
+        v.second.second = weights[v.first->id]*v.second.second;
         qnorm += pexp(v.second.second);
     }
 
@@ -778,44 +792,66 @@ double vocabulary_tree<Point, K>::compute_query_vector(map<node*, pair<double, i
 }
 
 template <typename Point, size_t K>
-double vocabulary_tree<Point, K>::compute_query_index_vector(map<int, double>& query_index_freqs, CloudPtrT& query_cloud, map<node*, int>& mapping)
+double vocabulary_tree<Point, K>::compute_query_index_vector(map<int, double>& query_index_freqs, CloudPtrT& query_cloud)
 {
     map<node*, double> query_node_freqs;
     double qnorm = compute_query_vector(query_node_freqs, query_cloud);
     for (pair<node* const, double>& u : query_node_freqs) {
-        query_index_freqs[mapping[u.first]] = u.second;
+        query_index_freqs[u.first->id] = u.second;
     }
     return qnorm;
 }
 
 template <typename Point, size_t K>
-void vocabulary_tree<Point, K>::compute_query_index_vector(map<int, int>& query_index_freqs, CloudPtrT& query_cloud, map<node*, int>& mapping)
+void vocabulary_tree<Point, K>::compute_query_index_vector(map<int, int>& query_index_freqs, CloudPtrT& query_cloud)
 {
     map<node*, int> query_node_freqs;
     compute_query_vector(query_node_freqs, query_cloud);
     for (const pair<node*, int>& u : query_node_freqs) {
-        query_index_freqs[mapping[u.first]] = u.second;
+        query_index_freqs[u.first->id] = u.second;
     }
 }
 
 // this version computes the unnormalized and normalized histograms, basically the both base version at the same time
 template <typename Point, size_t K>
-vocabulary_vector vocabulary_tree<Point, K>::compute_query_index_vector(CloudPtrT& query_cloud, map<node*, int>& mapping)
+vocabulary_vector vocabulary_tree<Point, K>::compute_query_index_vector(CloudPtrT& query_cloud)
 {
-    // the mapping is gonna have to be internal to the class, no real idea in having it outside
+    // the node ids are stored in the nodes, so the indices are stable between runs
     vocabulary_vector vec;
     map<node*, int> query_node_freqs;
     compute_query_vector(query_node_freqs, query_cloud);
     vec.norm = 0.0;
     for (const pair<node*, int>& u : query_node_freqs) {
-        double element = u.first->weight*double(u.second);
-        vec.vec[mapping[u.first]] = make_pair(u.second, element);
+        double element = weights[u.first->id]*double(u.second);
+        vec.vec[u.first->id] = make_pair(u.second, element);
         vec.norm += pexp(element);
     }
 
     return vec;
 }
 
+// same as above but for points that are already in the tree, takes the leaf index of every point
+// together with the node ids on the paths to the leaves (from get_leaf_paths) instead of a cloud
+template <typename Point, size_t K>
+vocabulary_vector vocabulary_tree<Point, K>::compute_leaf_index_vector(const vector<vector<int> >& leaf_paths,
+                                                                       vector<int>::const_iterator begin, vector<int>::const_iterator end)
+{
+    vocabulary_vector vec;
+    for (vector<int>::const_iterator it = begin; it != end; ++it) {
+        const vector<int>& path = leaf_paths[*it];
+        for (size_t current_depth = matching_min_depth; current_depth < path.size(); ++current_depth) {
+            vec.vec[path[current_depth]].first += 1;
+        }
+    }
+    vec.norm = 0.0;
+    for (pair<const int, pair<int, double> >& u : vec.vec) {
+        u.second.second = weights[u.first]*double(u.second.first);
+        vec.norm += pexp(u.second.second);
+    }
+
+    return vec;
+}
+
 /*
 template <typename Point, size_t K>
 template <class Archive>
@@ -4,6 +4,7 @@
 #include "vocabulary_tree/vocabulary_tree.h"
 
 #include <unordered_map>
+#include <cstdint>
 #include <vector>
 #include <map>
 
@@ -63,19 +64,28 @@ protected:
 
     // TODO: check if any of these are necessary, clean up this mess of a class!
     std::string save_state_path;
-    std::map<node*, int> mapping; // for mapping to unique node IDs that can be used in the next run, might be empty
+    // offsets of the groups in the packed cache files, the index files are read when the cache path is set
+    std::unordered_map<int, uint64_t> vectors_offsets;
+    std::unordered_map<int, uint64_t> adjacencies_offsets;
 
 protected:
 
     // for caching the vocabulary vectors
-    void cache_group_adjacencies(int start_ind, std::vector<std::set<std::pair<int, int> > >& adjacencies);
-    void cache_vocabulary_vectors(int start_ind, CloudPtrT& cloud);
+    void load_packed_offsets(std::unordered_map<int, uint64_t>& offsets, const std::string& name);
+    void load_packed_offsets();
+    void clear_packed(std::unordered_map<int, uint64_t>& offsets, const std::string& name);
+    template <typename T>
+    void save_packed_for_group(const T& data, int i, const std::string& name, std::unordered_map<int, uint64_t>& offsets);
+    template <typename T>
+    bool load_packed_for_group(T& data, int i, const std::string& name, const std::unordered_map<int, uint64_t>& offsets) const;
+    void cache_group_adjacencies(int start_ind, std::vector<subgroup_adjacencies>& adjacencies);
+    void cache_vocabulary_vectors(int start_ind);
     void save_cached_vocabulary_vectors_for_group(std::vector<vocabulary_vector>& vectors, int i);
 
 public:
 
     // should maybe be protected but needed for incremental segmentation comparison
-    void load_cached_vocabulary_vectors_for_group(std::vector<vocabulary_vector>& vectors, std::set<std::pair<int, int> >& adjacencies, int i);
+    void load_cached_vocabulary_vectors_for_group(std::vector<vocabulary_vector>& vectors, subgroup_adjacencies& adjacencies, int i);
 
     void query_vocabulary(std::vector<result_type>& results, CloudPtrT& query_cloud, size_t nbr_query);
 
@@ -86,15 +96,16 @@ public:
     void set_input_cloud(CloudPtrT& new_cloud, std::vector<index_type>& indices);
     //void append_cloud(CloudPtrT& extra_cloud, std::vector<std::pair<int, int> >& indices, bool store_points = true);
     void append_cloud(CloudPtrT& extra_cloud, std::vector<index_type>& indices, bool store_points = true);
-    //void append_cloud(CloudPtrT& extra_cloud, std::vector<std::pair<int, int> >& indices, std::vector<std::set<std::pair<int, int> > >& adjacencies, bool store_points = true);
-    void append_cloud(CloudPtrT& extra_cloud, std::vector<index_type>& indices, std::vector<std::set<std::pair<int, int> > >& adjacencies, bool store_points = true);
+    //void append_cloud(CloudPtrT& extra_cloud, std::vector<std::pair<int, int> >& indices, std::vector<subgroup_adjacencies>& adjacencies, bool store_points = true);
+    void append_cloud(CloudPtrT& extra_cloud, std::vector<index_type>& indices, std::vector<subgroup_adjacencies>& adjacencies, bool store_points = true);
     void add_points_from_input_cloud(bool save_cloud = true);
-    void add_points_from_input_cloud(std::vector<std::set<std::pair<int, int> > >& adjacencies, bool save_cloud = true);
+    void add_points_from_input_cloud(std::vector<subgroup_adjacencies>& adjacencies, bool save_cloud = true);
     void top_combined_similarities(std::vector<result_type>& scores, CloudPtrT& query_cloud, size_t nbr_results);
 
     void set_cache_path(const std::string& cache_path)
     {
         save_state_path = cache_path;
+        load_packed_offsets();
     }
 
     void clear()
@@ -116,6 +127,7 @@ public:
     {
         super::load(archive);
         archive(nbr_points, nbr_subgroups, group_subgroup, save_state_path);
+        load_packed_offsets();
         std::cout << "Finished loading grouped_vocabulary_tree" << std::endl;
     }
 
@@ -127,7 +139,10 @@ public:
     }
 
     grouped_vocabulary_tree() : super(), nbr_points(0), nbr_subgroups(0) {}
-    grouped_vocabulary_tree(const std::string& save_state_path) : super(), nbr_points(0), nbr_subgroups(0), save_state_path(save_state_path) {}
+    grouped_vocabulary_tree(const std::string& save_state_path) : super(), nbr_points(0), nbr_subgroups(0), save_state_path(save_state_path)
+    {
+        load_packed_offsets();
+    }
 };
 
 #ifndef VT_PRECOMPILE
@@ -97,7 +97,8 @@ public:
         bool is_leaf;
         leaf_range range;
         double weight;
-        node() : is_leaf(false)
+        int id; // dense index in depth first order, assigned when built or loaded
+        node() : is_leaf(false), id(-1)
         {
             for (ptr_type& n : children) {
                n = NULL;
@@ -174,6 +175,7 @@ protected:
     size_t depth;
     std::vector<leaf*> leaves;
     size_t inserted_points;
+    size_t nbr_nodes; // ids of all nodes are in [0, nbr_nodes)
 
 protected:
 
@@ -187,10 +189,14 @@ protected:
     bool compare_centroids(const Eigen::Matrix<float, rows, dim>& centroids,
                            const Eigen::Matrix<float, rows, dim>& last_centroids) const;
     void assign_extra(CloudPtrT& subcloud, node *n, const std::vector<int>& subinds);
-    void assign_mapping_recursive(node* n, std::map<node*, int>& mapping, int& counter);
+    void assign_node_ids(node* n, int& counter);
+    void append_leaf_paths(node* n, std::vector<int>& path, std::vector<std::vector<int> >& leaf_paths);
 
 public:
 
+    using point_type = Point;
+    using cloud_ptr_type = CloudPtrT;
+
     std::vector<size_t> sample_without_replacement(size_t upper) const;
     std::vector<size_t> sample_with_replacement(size_t upper) const;
 
@@ -218,7 +224,9 @@ public:
     void get_path_for_point(std::vector<std::pair<node*, int> >& depth_path, const PointT& point);
     void get_cloud_for_point_at_level(CloudPtrT& nodecloud, const PointT& p, size_t level);
     size_t points_in_node(node* n);
-    void get_node_mapping(std::map<node*, int>& mapping);
+    size_t get_nbr_nodes() const { return nbr_nodes; }
+    void get_leaf_paths(std::vector<std::vector<int> >& leaf_paths);
+    void get_leaves_for_points(std::vector<int>& point_leaves, size_t start_ind);
     double get_mean_leaf_points();
     /*
     template <class Archive> void save(Archive& archive) const;
@@ -244,10 +252,13 @@ public:
         archive(root);
         std::cout << "Setting up the leaves vector" << std::endl;
         append_leaves(&root);
+        int counter = 0;
+        assign_node_ids(&root, counter);
+        nbr_nodes = counter;
         std::cout << "Finished loading k_means_tree" << std::endl;
     }
 
-    k_means_tree(size_t depth = 5) : depth(depth), inserted_points(0) {}
+    k_means_tree(size_t depth = 5) : depth(depth), inserted_points(0), nbr_nodes(0) {}
     virtual ~k_means_tree() { leaves.clear(); }
 
 };
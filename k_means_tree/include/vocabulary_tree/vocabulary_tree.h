@@ -7,6 +7,10 @@
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/vector.hpp>
 
+#include <algorithm>
+#include <numeric>
+#include <set>
+
 /*
  * vocabulary_tree
  *
@@ -41,6 +45,73 @@ struct vocabulary_vector
     }
 };
 
+// adjacency graph of the subgroups within one group in compressed sparse row format,
+// the neighbours of subgroup i are neighbours[offsets[i]] to neighbours[offsets[i+1]],
+// sorted by subgroup id. the graph is undirected so every edge is stored in both rows
+struct subgroup_adjacencies
+{
+    std::vector<int> offsets;
+    std::vector<int> neighbours;
+
+    size_t size() const { return offsets.empty()? 0 : offsets.size() - 1; }
+    size_t nbr_edges() const { return neighbours.size() / 2; }
+    bool empty() const { return neighbours.empty(); }
+    std::vector<int>::const_iterator neighbours_begin(int i) const { return neighbours.cbegin() + offsets[i]; }
+    std::vector<int>::const_iterator neighbours_end(int i) const { return neighbours.cbegin() + offsets[i+1]; }
+
+    // the edges may be given in any direction and may contain duplicates and self loops
+    void assign(const std::vector<std::pair<int, int> >& edges, size_t nbr_subgroups = 0)
+    {
+        for (const std::pair<int, int>& e : edges) {
+            nbr_subgroups = std::max(nbr_subgroups, size_t(std::max(e.first, e.second) + 1));
+        }
+
+        // count the degrees and turn them into row offsets
+        offsets.assign(nbr_subgroups + 1, 0);
+        for (const std::pair<int, int>& e : edges) {
+            if (e.first != e.second) {
+                ++offsets[e.first + 1];
+                ++offsets[e.second + 1];
+            }
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        neighbours.resize(offsets.back());
+        std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+        for (const std::pair<int, int>& e : edges) {
+            if (e.first != e.second) {
+                neighbours[fill[e.first]++] = e.second;
+                neighbours[fill[e.second]++] = e.first;
+            }
+        }
+
+        // sort every row and remove the duplicate edges
+        int nbr_kept = 0;
+        for (size_t i = 0; i < nbr_subgroups; ++i) {
+            std::vector<int>::iterator first = neighbours.begin() + offsets[i];
+            std::vector<int>::iterator last = neighbours.begin() + offsets[i+1];
+            std::sort(first, last);
+            last = std::unique(first, last);
+            offsets[i] = nbr_kept;
+            nbr_kept = std::copy(first, last, neighbours.begin() + nbr_kept) - neighbours.begin();
+        }
+        offsets.back() = nbr_kept;
+        neighbours.resize(nbr_kept);
+    }
+
+    void assign(const std::set<std::pair<int, int> >& edges, size_t nbr_subgroups = 0)
+    {
+        assign(std::vector<std::pair<int, int> >(edges.begin(), edges.end()), nbr_subgroups);
+    }
+
+    // for cereal serialization
+    template <class Archive>
+    void serialize(Archive& archive)
+    {
+        archive(offsets, neighbours);
+    }
+};
+
 struct vocabulary_result {
     int index;
     float score;
@@ -68,6 +139,7 @@ protected:
 
     std::vector<int> indices; // the source indices of the points (image ids of features), change this to uint32_t
     std::map<int, double> db_vector_normalizing_constants; // normalizing constants for the p vectors
+    std::vector<double> weights; // node weights indexed by node id, these are the ones used (and re-weighted) when querying
     double N; // number of sources (images) in database
     static const bool normalized = true;
     int matching_min_depth;
@@ -81,6 +153,7 @@ protected:
     double compute_query_vector(std::map<node*, std::pair<double, int> >& query_id_freqs, CloudPtrT& query_cloud);
     void source_freqs_for_node(std::map<int, int>& source_id_freqs, node* n) const;
     void normalizing_constants_for_node(std::map<int, int>& normalizing_constants, node* n, int current_depth);
+    void gather_weights(node* n);
 
     void unfold_nodes(std::vector<node*>& path, node* n, const PointT& p, std::map<node*, double>& active);
     void get_path_for_point(std::vector<node*>& path, const PointT& point, std::map<node*, double>& active);
@@ -90,17 +163,17 @@ protected:
 public:
 
     void query_vocabulary(std::vector<result_type>& results, CloudPtrT& query_cloud, size_t nbr_results);
-    void compute_new_weights(std::map<int, double>& original_norm_constants, std::map<node*, double>& original_weights,
+    void compute_new_weights(std::map<int, double>& original_norm_constants, std::map<int, double>& original_weights,
                              std::vector<std::pair<int, double> >& weighted_indices, CloudPtrT& query_cloud);
     void compute_new_weights(std::map<int, double>& original_norm_constants,
-                             std::map<node*, double>& original_weights,
+                             std::map<int, double>& original_weights,
                              std::vector<std::pair<std::set<int>, double> >& weighted_indices,
                              CloudPtrT& query_cloud);
-    void restore_old_weights(std::map<int, double>& original_norm_constants, std::map<node*, double>& original_weights);
+    void restore_old_weights(std::map<int, double>& original_norm_constants, std::map<int, double>& original_weights);
 
     double compute_vocabulary_norm(CloudPtrT& cloud);
     double compute_min_combined_dist(std::vector<int>& smallest_ind_combination, CloudPtrT& cloud, std::vector<vocabulary_vector>& smaller_freqs,
-                                     std::set<std::pair<int, int> >& adjacencies, std::map<node*, int>& mapping, std::map<int, node*>& inverse_mapping, int hint);
+                                     const subgroup_adjacencies& adjacencies, int hint);
 
     void set_min_match_depth(int depth);
     void compute_normalizing_constants(); // this also computes the weights
@@ -125,9 +198,11 @@ public:
     void top_combined_similarities(std::vector<result_type>& scores, CloudPtrT& query_cloud, size_t nbr_results);
     void debug_similarities(std::vector<result_type>& scores, CloudPtrT& query_cloud, size_t nbr_results);
 
-    double compute_query_index_vector(std::map<int, double>& query_index_freqs, CloudPtrT& query_cloud, std::map<node*, int>& mapping);
-    void compute_query_index_vector(std::map<int, int>& query_index_freqs, CloudPtrT& query_cloud, std::map<node*, int>& mapping);
-    vocabulary_vector compute_query_index_vector(CloudPtrT& query_cloud, std::map<node *, int> &mapping);
+    double compute_query_index_vector(std::map<int, double>& query_index_freqs, CloudPtrT& query_cloud);
+    void compute_query_index_vector(std::map<int, int>& query_index_freqs, CloudPtrT& query_cloud);
+    vocabulary_vector compute_query_index_vector(CloudPtrT& query_cloud);
+    vocabulary_vector compute_leaf_index_vector(const std::vector<std::vector<int> >& leaf_paths,
+                                                std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end);
 
     /*
     template <class Archive> void save(Archive& archive) const;
@@ -149,6 +224,8 @@ public:
         archive(indices);
         archive(db_vector_normalizing_constants);
         archive(N);
+        weights.assign(super::nbr_nodes, 0.0);
+        gather_weights(&(super::root));
         std::cout << "Finished loading vocabulary_tree" << std::endl;
     }
 
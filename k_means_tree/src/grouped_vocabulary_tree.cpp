@@ -9,3 +9,4 @@ template class grouped_vocabulary_tree<pcl::Histogram<128>, 8>;
 template class grouped_vocabulary_tree<pcl::Histogram<131>, 8>;
 template class grouped_vocabulary_tree<pcl::Histogram<1344>, 8>;
 template class grouped_vocabulary_tree<pcl::Histogram<250>, 8>;
+template class grouped_vocabulary_tree<pcl::Histogram<64>, 8>;
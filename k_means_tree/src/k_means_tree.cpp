@@ -39,3 +39,4 @@ template class k_means_tree<pcl::Histogram<33>, 8>;
 template class k_means_tree<pcl::Histogram<128>, 8>;
 template class k_means_tree<pcl::Histogram<1344>, 8>;
 template class k_means_tree<pcl::Histogram<250>, 8>;
+template class k_means_tree<pcl::Histogram<64>, 8>;
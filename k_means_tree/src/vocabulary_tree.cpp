@@ -11,5 +11,7 @@ template class vocabulary_tree<pcl::Histogram<131>, 8>;
 template class vocabulary_tree<pcl::Histogram<1344>, 8>;
 template class vocabulary_tree<pcl::Histogram<250>, 8>;
 template class k_means_tree<pcl::Histogram<250>, 8, inverted_file>;
+template class vocabulary_tree<pcl::Histogram<64>, 8>;
+template class k_means_tree<pcl::Histogram<64>, 8, inverted_file>;
 //template void serialize(cereal::BinaryOutputArchive& archive, vocabulary_tree<pcl::Histogram<131>, 8>& vt);
 //template void serialize(cereal::BinaryInputArchive& archive, vocabulary_tree<pcl::Histogram<131>, 8>& vt);